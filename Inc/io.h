@@ -8,49 +8,245 @@
 
 #include "fatfs.h"
 #include <stdint.h>
+#include <stddef.h>
 
 
 #define BUF_MULTIPLIER 1
-/* Buffer size, in number of sectors.
+/* Default buffer size, in number of sectors (see io_open_ex to choose it for each file).
  * During the tests, BUF_MULTIPLIER was 1. Increasing its value will consume more memory
+ * It must be a power of two.
  */
 
+#if ((BUF_MULTIPLIER) & ((BUF_MULTIPLIER) - 1)) != 0
+#error BUF_MULTIPLIER must be a power of two
+#endif
+
 #define MAX_BUFFER_SIZE 16384
 /*
  * Limit the buffer size.
  * When trying to read or write more than MAX_BUFFER_SIZE bytes, io_write will return FR_NOT_ENOUGH_CORE
  */
 
+#define IO_FA_FASTSEEK 0x80
+/*
+ * io_open mode flag (not passed to FatFs).
+ * Builds a cluster link map table so that moving inside the file doesn't walk the FAT chain (needs _USE_FASTSEEK).
+ * The table is allocated by IO API, and rebuilt when the file grows.
+ */
+
+#define IO_FA_CONTIGUOUS 0x40
+/*
+ * io_open mode flag (not passed to FatFs).
+ * If the file is contiguous, its first sector is computed once, and data is read/written with
+ * disk_read/disk_write instead of f_read/f_write (needs IO_USE_DIRECT_LBA and _USE_FASTSEEK).
+ * Files created with io_create_contiguous always use this mode.
+ */
+
+#define IO_USE_DIRECT_LBA 1
+/*
+ * Set to 0 if the disk functions (diskio.h) must not be called by IO API.
+ * IO_FA_CONTIGUOUS is then ignored.
+ */
+
+#define IO_BUFFER_ALIGN 32
+/*
+ * Alignment of the buffers (in bytes), so that disk drivers can use DMA with them instead of an internal bounce buffer.
+ * 32 is the cache line size of Cortex-M7. Buffer sizes are rounded up to whole IO_BUFFER_ALIGN blocks,
+ * so that cache maintenance on a buffer never touches other data. It must be a power of two.
+ */
+
+#if ((IO_BUFFER_ALIGN) & ((IO_BUFFER_ALIGN) - 1)) != 0
+#error IO_BUFFER_ALIGN must be a power of two
+#endif
+
+#define IO_BUFFER_MALLOC(size) malloc(size)
+#define IO_BUFFER_FREE(ptr) free(ptr)
+/*
+ * Default functions used to allocate and free the buffers (see io_set_allocator).
+ * Redefine them to place the buffers in a memory region reachable by the DMA controller.
+ */
+
+#define IO_MEMORY_BUDGET 0
+/*
+ * Maximum number of bytes used by the buffers of all open files (0: no limit), see io_set_memory_budget.
+ * When a new buffer would go over the budget, the least recently used buffers of other files are saved and freed.
+ */
+
+#define IO_DISCARD 0
+/*
+ * Default setting of io_set_discard: 1 to tell the disk which sectors were freed by io_truncate, io_unlink and
+ * io_create_contiguous (disk_ioctl CTRL_TRIM), so that SD cards don't slow down as they fill with stale data.
+ * Needs IO_USE_DIRECT_LBA and _USE_FASTSEEK. FatFs own trim (_USE_TRIM) can stay disabled.
+ */
+
+#define IO_EXTENT_INDEX_SIZE 16
+/*
+ * Number of free extents (runs of free clusters) remembered for one volume, 0 to disable the index (see io_extent_index_build).
+ * The biggest extents are kept. io_create_contiguous asks FatFs to look for a contiguous area from the best fitting extent,
+ * instead of scanning the FAT from the last allocated cluster (needs IO_USE_DIRECT_LBA and _USE_EXPAND).
+ */
+
+#define IO_AUTOTUNE_PERIOD 16
+/*
+ * Number of io_read/io_write calls observed before auto-tuning decides to grow or shrink the buffer window
+ * (see autoTune in IO_OpenOptions).
+ */
+
+#define IO_LINKMAP_SIZE 16
+/*
+ * Initial size of the cluster link map table (in number of DWORD items).
+ * The table is automatically enlarged if the file is more fragmented.
+ */
+
+#define IO_TINY_CACHE 0
+/*
+ * Set to 1 to enable, only used when FatFs is built with _FS_TINY (needs IO_USE_DIRECT_LBA and _USE_FASTSEEK).
+ * The buffer of IO API becomes the data buffer of every file: files are opened with a cluster link map table,
+ * and data is read/written by whole sectors with disk_read/disk_write. FatFs window then only holds FAT sectors.
+ * If the table can't be allocated, the file is read/written with f_read/f_write.
+ */
+
+/* Base 2 logarithm of a power of two (up to 2^16), usable in constant expressions */
+#define IO_LOG2(x) ((x) >= 0x10000 ? 16 : (x) >= 0x8000 ? 15 : (x) >= 0x4000 ? 14 : (x) >= 0x2000 ? 13 : \
+                    (x) >= 0x1000 ? 12 : (x) >= 0x800 ? 11 : (x) >= 0x400 ? 10 : (x) >= 0x200 ? 9 : \
+                    (x) >= 0x100 ? 8 : (x) >= 0x80 ? 7 : (x) >= 0x40 ? 6 : (x) >= 0x20 ? 5 : \
+                    (x) >= 0x10 ? 4 : (x) >= 0x8 ? 3 : (x) >= 0x4 ? 2 : (x) >= 0x2 ? 1 : 0)
+
 typedef struct {
+	uint32_t requests;         /* io_read/io_write calls since the file was opened */
+	uint32_t hits;             /* Calls served by the existing buffer */
+	uint32_t sequential;       /* Calls starting where the previous one ended */
+	UINT windowSize;           /* Current buffer window (in bytes) */
+	UINT targetWindowSize;     /* Window chosen by auto-tuning, used when the buffer is replaced (in bytes) */
+	UINT averageRequest;       /* Average request size during the last period (in bytes) */
+	uint8_t sequentialPercent; /* Sequential calls during the last period (in %) */
+	uint8_t hitPercent;        /* Calls served by the buffer during the last period (in %) */
+	uint32_t grows;            /* Number of times auto-tuning doubled the window */
+	uint32_t shrinks;          /* Number of times auto-tuning halved the window */
+	uint32_t seeksAvoided;     /* Same as IO_FileDescriptor */
+	uint32_t flushes;          /* Number of times modified data was saved */
+	uint32_t unitFlushes;      /* Flushes of a whole write unit, aligned on a write unit boundary */
+} IO_Stats;
+
+typedef struct IO_FileDescriptor {
 	uint8_t isOpen;            /* Bool telling if the file is opened or not */
-	UINT ssize;                /* Sector size * BUF_MULTIPLIER (in bytes) */
+	UINT ssize;                /* Sector size * number of sectors of the buffer (in bytes) */
+	uint8_t ssizeShift;        /* log2(ssize), used instead of multiplications and divisions */
+	uint8_t sectorShift;       /* log2(sector size) */
+	UINT readAhead;            /* Number of buffer windows read in advance when reading sequentially */
+	uint8_t writeBack;         /* IO_WRITE_BACK or IO_WRITE_THROUGH */
+	UINT writeUnit;            /* Small writes are gathered in buffers of writeUnit bytes, aligned on writeUnit (0: disabled) */
+	uint8_t autoTune;          /* Bool telling if the window size follows the access pattern */
+	uint8_t advice;            /* Access pattern given by io_advise (IO_ADVICE_NORMAL, SEQUENTIAL, RANDOM or NOREUSE) */
+	uint8_t targetShift;       /* log2 of the window chosen by auto-tuning */
+	uint8_t minShift;          /* log2 of the smallest window: one sector, or one cluster with clusterWindows */
+	uint16_t periodRequests;   /* Calls observed during the current auto-tuning period */
+	uint16_t periodSequential; /* Sequential calls during the current period */
+	uint16_t periodHits;       /* Calls served by the buffer during the current period */
+	uint32_t periodBytes;      /* Bytes requested during the current period */
+	IO_Stats stats;            /* Access pattern statistics, see io_stats */
 	UINT bufferBegin;          /* Buffer beginning (in ssize bytes) */
 	UINT bufferSize;           /* Buffer size (in bytes) */
 	UINT actualSize;           /* Only useful when increasing file size : actualSize is the number of bytes that have the correct value */
-	uint8_t* buffer;           /* Buffer */
+	uint8_t* buffer;           /* Buffer (aligned on IO_BUFFER_ALIGN bytes) */
+	void* bufferBlock;         /* Memory block allocated for the buffer */
+	size_t bufferBlockSize;    /* Size of bufferBlock (in bytes), counted in the memory budget */
+	struct IO_FileDescriptor* lruPrev; /* Buffer used more recently (list of the buffers of all files) */
+	struct IO_FileDescriptor* lruNext; /* Buffer used less recently */
 	FIL* file;                 /* FATFS File object */
+	DWORD* linkMap;            /* Cluster link map table used by FatFs fast seek (NULL if disabled) */
+	UINT linkMapSize;          /* Size of linkMap (in number of DWORD items) */
 	uint8_t unsavedData;       /* Bool telling if the buffer has been modified */
 	FSIZE_t actualFileSize;    /* Actual file size, knowing buffer modifications */
+	FSIZE_t diskFileSize;      /* File size known by FatFs (updated on flush, truncate and preallocation) */
+	FSIZE_t allocatedSize;     /* Size of the clusters allocated to the file (in bytes) */
+	UINT clusterSize;          /* Cluster size (in bytes) */
+	DWORD directSector;        /* First sector of a contiguous file, 0 if disk functions aren't used directly */
+	FSIZE_t directSize;        /* Size of the contiguous area starting at directSector (in bytes) */
 	FSIZE_t rwPointer;         /* Position of the read/write pointer */
+	FSIZE_t fatfsPointer;      /* Position of FatFs read/write pointer (shadow copy, avoids useless f_lseek calls) */
+	uint8_t fatfsPointerValid; /* Bool telling if fatfsPointer can be trusted */
+	uint32_t seeksAvoided;     /* Number of f_lseek calls skipped because FatFs pointer was already at the right place */
 } IO_FileDescriptor;
 
+#define IO_WRITE_BACK 0    /* Modified data is saved when the buffer is reused, synced or closed */
+#define IO_WRITE_THROUGH 1 /* Modified data is saved by each io_write call */
+
+/* io_advise hints */
+#define IO_ADVICE_NORMAL 0     /* No particular access pattern (default) */
+#define IO_ADVICE_SEQUENTIAL 1 /* The file is read from beginning to end: at least one window is read in advance */
+#define IO_ADVICE_RANDOM 2     /* Random access: no read-ahead */
+#define IO_ADVICE_WILLNEED 3   /* The range will be read soon: it is loaded in the buffer now */
+#define IO_ADVICE_DONTNEED 4   /* The range won't be used again: the buffer holding it is saved and freed */
+#define IO_ADVICE_NOREUSE 5    /* Data is used once: written through, and its buffer is the first one evicted */
+
+typedef struct {
+	UINT windowSectors;        /* Buffer size (in sectors, power of two), 0 for BUF_MULTIPLIER */
+	UINT readAhead;            /* Number of buffer windows read in advance when the file is read sequentially */
+	uint8_t writeBack;         /* IO_WRITE_BACK or IO_WRITE_THROUGH */
+	FSIZE_t preallocHint;      /* Expected size of a new file (in bytes), 0 if unknown */
+	uint8_t autoTune;          /* Bool: grow or shrink the window (from windowSectors) according to the access pattern */
+	uint8_t clusterWindows;    /* Bool: windows are whole clusters (at least windowSectors), ignored if a cluster is over MAX_BUFFER_SIZE */
+	UINT writeUnit;            /* Flush unit (in bytes, power of two), e.g. the SD card allocation unit, limited to MAX_BUFFER_SIZE. 0: disabled */
+} IO_OpenOptions;
+
+typedef struct {
+	void* (*descriptorAlloc)(size_t size); /* Allocates IO_FileDescriptor, FIL and cluster link map tables */
+	void (*descriptorFree)(void* ptr);     /* Frees memory allocated by descriptorAlloc */
+	void* (*bufferAlloc)(size_t size);     /* Allocates buffers (IO_BUFFER_ALIGN is applied by IO API) */
+	void (*bufferFree)(void* ptr);         /* Frees memory allocated by bufferAlloc */
+} IO_Allocator;
+
+typedef struct {
+	size_t used;               /* Bytes allocated for the buffers of all files */
+	size_t peak;               /* Highest value of used since the budget was set */
+	size_t budget;             /* Memory budget (0: no limit) */
+	UINT buffers;              /* Number of allocated buffers */
+	UINT dirtyBuffers;         /* Number of buffers holding unsaved data */
+	uint32_t evictions;        /* Number of buffers freed to stay within the budget */
+} IO_MemoryUsage;
+
 
-/* File creation, opening and closing */
+/* Memory management */
+void io_set_allocator(const IO_Allocator* allocator);
+FRESULT io_set_memory_budget(size_t budget);
+FRESULT io_trim_memory(size_t target);
+void io_memory_usage(IO_MemoryUsage* usage);
+
+/* Disk management */
+FRESULT io_set_discard(uint8_t enable);
+FRESULT io_extent_index_build(FATFS* fs);
+FRESULT io_extent_index_find(FATFS* fs, DWORD clusters, DWORD* start, DWORD* length);
+
+/* File creation, opening, closing and deletion */
 IO_FileDescriptor* io_create_contiguous(const TCHAR* path, BYTE mode, FSIZE_t size);
 IO_FileDescriptor* io_open(const TCHAR* path, BYTE mode);
+IO_FileDescriptor* io_open_ex(const TCHAR* path, BYTE mode, const IO_OpenOptions* options);
 FRESULT io_close(IO_FileDescriptor* fp);
+FRESULT io_unlink(const TCHAR* path);
 
 /* Managing metadata */
 FRESULT io_size(IO_FileDescriptor* fp, FSIZE_t* size);
 FRESULT io_error(IO_FileDescriptor* fp);
+FRESULT io_stats(IO_FileDescriptor* fp, IO_Stats* stats);
 FRESULT io_set_timestamp(const TCHAR* path, uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t min, uint8_t sec);
 
 /* Editing a file contents */
 FRESULT io_write(IO_FileDescriptor* fp, const void* buff, UINT position, UINT btw, UINT* bw);
 void* io_read(IO_FileDescriptor* fp, UINT position, UINT btr, UINT* br);
+FRESULT io_forward(IO_FileDescriptor* fp, UINT position, UINT btf, UINT (*func)(const BYTE*, UINT), UINT* bf);
+FRESULT io_read_exact(IO_FileDescriptor* fp, void* buff, UINT position, UINT length);
+FRESULT io_write_exact(IO_FileDescriptor* fp, const void* buff, UINT position, UINT length);
+FRESULT io_advise(IO_FileDescriptor* fp, UINT offset, UINT len, uint8_t advice);
 FRESULT io_sync(IO_FileDescriptor* fp);
 FRESULT io_truncate(IO_FileDescriptor* fp, FSIZE_t newSize);
 FRESULT io_tell(IO_FileDescriptor* fp, FSIZE_t* rwPointer);
 FRESULT io_lseek(IO_FileDescriptor* fp, FSIZE_t rwPointer);
 
+/* Little-endian words of on-disk formats */
+void io_store_le16(uint8_t* ptr, uint16_t value);
+uint16_t io_load_le16(const uint8_t* ptr);
+void io_store_le32(uint8_t* ptr, uint32_t value);
+uint32_t io_load_le32(const uint8_t* ptr);
+
 #endif /* INC_IO_H_ */
@@ -0,0 +1,60 @@
+/** @file io_col.h
+ *
+ * @brief This file contains an API to store multi-channel samples by column, so that a channel is read without the others
+ */
+
+#ifndef INC_IO_COL_H_
+#define INC_IO_COL_H_
+
+#include "io.h"
+
+
+#define IO_COL_MAX_CHANNELS 32
+/*
+ * Maximum number of channels. The writer holds a buffer of _MAX_SS bytes per channel.
+ */
+
+#define IO_COL_MAGIC 0x4C4F4349
+/*
+ * First word of the directory file ("ICOL").
+ */
+
+#define IO_COL_HEADER_SIZE (8 + IO_COL_MAX_CHANNELS)
+/*
+ * Header of the directory file: magic (32 bits), number of channels (16 bits), unused (16 bits), sample size of each channel (8 bits each).
+ */
+
+#define IO_COL_ENTRY_SIZE 8
+/*
+ * Directory entry of a chunk: channel (16 bits), number of samples (16 bits), row of the first sample (32 bits).
+ * Chunk n is the sector n of the data file.
+ */
+
+typedef struct {
+	IO_FileDescriptor* data;   /* Data file: chunks of one sector (_MAX_SS bytes) */
+	IO_FileDescriptor* directory; /* Directory file: header, then an entry per chunk */
+	UINT channels;             /* Number of channels */
+	uint8_t sampleSize[IO_COL_MAX_CHANNELS]; /* Size of a sample of each channel (in bytes) */
+	UINT chunks;               /* Number of chunks in the data file */
+	uint32_t rows;             /* Number of rows appended */
+	UINT fill[IO_COL_MAX_CHANNELS]; /* Number of samples in the buffer of each channel */
+	uint8_t buffer[IO_COL_MAX_CHANNELS][_MAX_SS]; /* Chunk being filled, for each channel */
+} IO_ColumnWriter;
+
+typedef struct {
+	IO_FileDescriptor* data;   /* Data file */
+	IO_FileDescriptor* directory; /* Directory file */
+	UINT channels;             /* Number of channels */
+	uint8_t sampleSize[IO_COL_MAX_CHANNELS]; /* Size of a sample of each channel (in bytes) */
+	UINT chunks;               /* Number of chunks in the data file */
+} IO_ColumnReader;
+
+
+FRESULT io_col_create(IO_ColumnWriter* writer, const TCHAR* path, const TCHAR* directoryPath, UINT channels, const uint8_t* sampleSize);
+FRESULT io_col_append(IO_ColumnWriter* writer, const void* row);
+FRESULT io_col_close(IO_ColumnWriter* writer);
+FRESULT io_col_open(IO_ColumnReader* reader, const TCHAR* path, const TCHAR* directoryPath);
+FRESULT io_col_read(IO_ColumnReader* reader, UINT channel, uint32_t firstRow, void* buff, UINT rows, UINT* read);
+FRESULT io_col_reader_close(IO_ColumnReader* reader);
+
+#endif /* INC_IO_COL_H_ */
@@ -0,0 +1,52 @@
+/** @file io_log.h
+ *
+ * @brief This file contains an API to append data to a preallocated log, whose end is found again quickly after a power loss
+ */
+
+#ifndef INC_IO_LOG_H_
+#define INC_IO_LOG_H_
+
+#include "io.h"
+
+
+#define IO_LOG_MAGIC 0x474F4C49
+/*
+ * First word of the header sector of a log file ("ILOG").
+ */
+
+#define IO_LOG_SECTOR_HEADER 8
+/*
+ * Bytes at the beginning of each data sector: sequence number XOR log id (32 bits), payload length (16 bits)
+ * and Fletcher-16 checksum of the sector header and payload (16 bits). The other bytes of the sector hold data.
+ * Log sectors are _MAX_SS bytes.
+ */
+
+#if (_MAX_SS <= IO_LOG_SECTOR_HEADER)
+#error _MAX_SS is too small for io_log
+#endif
+
+#if (_MAX_SS != _MIN_SS)
+#error io_log requires a fixed sector size (_MAX_SS == _MIN_SS): a log sector must be a sector of the volume
+#endif
+
+typedef struct {
+	IO_FileDescriptor* fp;     /* Contiguous file */
+	uint32_t logId;            /* Changes each time the log is created, so sectors of an older log aren't valid */
+	UINT sectors;              /* Number of data sectors of the file */
+	UINT next;                 /* Data sector being filled: sectors before it are sealed */
+	UINT fill;                 /* Number of data bytes in sector */
+	UINT readSector;           /* Reading position: data sector */
+	UINT readOffset;           /* Reading position: data byte in readSector */
+	uint8_t sector[_MAX_SS];   /* Sector being filled */
+} IO_Log;
+
+
+FRESULT io_log_create(IO_Log* log, const TCHAR* path, FSIZE_t size);
+FRESULT io_log_open(IO_Log* log, const TCHAR* path);
+FRESULT io_log_append(IO_Log* log, const void* data, UINT length);
+FRESULT io_log_commit(IO_Log* log);
+FRESULT io_log_read(IO_Log* log, void* buff, UINT btr, UINT* br);
+FRESULT io_log_rewind(IO_Log* log);
+FRESULT io_log_close(IO_Log* log);
+
+#endif /* INC_IO_LOG_H_ */
@@ -0,0 +1,62 @@
+/** @file io_mux.h
+ *
+ * @brief This file contains an API to write several logical streams in a single contiguous file
+ */
+
+#ifndef INC_IO_MUX_H_
+#define INC_IO_MUX_H_
+
+#include "io.h"
+
+
+#define IO_MUX_MAX_STREAMS 16
+/*
+ * Maximum number of streams of a file (at most 255). The multiplexer holds a buffer of _MAX_SS bytes per stream.
+ */
+
+#if (IO_MUX_MAX_STREAMS > 255)
+#error IO_MUX_MAX_STREAMS must be at most 255
+#endif
+
+#define IO_MUX_MAGIC 0x584D4F49
+/*
+ * First word of the header sector ("IOMX").
+ */
+
+#define IO_MUX_CHUNK_HEADER 4
+/*
+ * Bytes at the beginning of each chunk (_MAX_SS bytes): stream number + 1 (8 bits), unused (8 bits), data length (16 bits).
+ * The file holds a header sector (magic, number of streams, number of chunks the file can hold, number of chunks written),
+ * the index (stream number + 1 of each chunk, one byte per chunk), then the chunks.
+ */
+
+typedef struct {
+	IO_FileDescriptor* fp;     /* Contiguous file */
+	UINT streams;              /* Number of streams */
+	UINT capacity;             /* Number of chunks the file can hold */
+	UINT indexSectors;         /* Number of sectors of the index */
+	UINT count;                /* Number of chunks written */
+	uint8_t index[_MAX_SS];    /* Index sector holding the entry of the next chunk */
+	UINT fill[IO_MUX_MAX_STREAMS]; /* Data bytes in the buffer of each stream */
+	uint8_t buffer[IO_MUX_MAX_STREAMS][_MAX_SS]; /* Chunk being filled, for each stream */
+} IO_Mux;
+
+typedef struct {
+	IO_Mux* mux;               /* Multiplexer */
+	UINT stream;               /* Stream read */
+	UINT chunk;                /* Next chunk to read, chunks of the other streams are skipped */
+	UINT offset;               /* Next data byte in the chunk */
+	UINT indexSector;          /* Index sector held in index (0: none) */
+	uint8_t index[_MAX_SS];    /* Copy of an index sector */
+} IO_MuxReader;
+
+
+FRESULT io_mux_create(IO_Mux* mux, const TCHAR* path, UINT streams, FSIZE_t size);
+FRESULT io_mux_open(IO_Mux* mux, const TCHAR* path);
+FRESULT io_mux_write(IO_Mux* mux, UINT stream, const void* data, UINT length);
+FRESULT io_mux_sync(IO_Mux* mux);
+FRESULT io_mux_close(IO_Mux* mux);
+FRESULT io_mux_reader_init(IO_MuxReader* reader, IO_Mux* mux, UINT stream);
+FRESULT io_mux_read(IO_MuxReader* reader, void* buff, UINT btr, UINT* br);
+
+#endif /* INC_IO_MUX_H_ */
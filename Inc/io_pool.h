@@ -0,0 +1,39 @@
+/** @file io_pool.h
+ *
+ * @brief This file contains an API to keep contiguous files in reserve, so that creating a file is only a rename
+ */
+
+#ifndef INC_IO_POOL_H_
+#define INC_IO_POOL_H_
+
+#include "io.h"
+
+
+#define IO_POOL_MAX_FILES 8
+/*
+ * Maximum number of spare files of a pool (at most 100).
+ */
+
+#if (IO_POOL_MAX_FILES > 100)
+#error IO_POOL_MAX_FILES must be at most 100
+#endif
+
+#define IO_POOL_PATH_LENGTH 32
+/*
+ * Maximum length of the path of a spare file (in TCHAR, with the number of the file and the null character).
+ */
+
+typedef struct {
+	TCHAR prefix[IO_POOL_PATH_LENGTH]; /* Path of the spare files, their number (0 to count - 1) is added to it */
+	UINT count;                        /* Number of spare files kept in reserve */
+	FSIZE_t size;                      /* Size of each spare file (in bytes) */
+	uint8_t ready[IO_POOL_MAX_FILES];  /* Bool telling if each spare file exists */
+} IO_Pool;
+
+
+FRESULT io_pool_init(IO_Pool* pool, const TCHAR* prefix, UINT count, FSIZE_t size);
+FRESULT io_pool_refill(IO_Pool* pool, UINT maxFiles);
+IO_FileDescriptor* io_pool_acquire(IO_Pool* pool, const TCHAR* path, BYTE mode);
+UINT io_pool_available(const IO_Pool* pool);
+
+#endif /* INC_IO_POOL_H_ */
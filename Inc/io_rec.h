@@ -0,0 +1,29 @@
+/** @file io_rec.h
+ *
+ * @brief This file contains an API to use a file as an array of fixed-size records
+ */
+
+#ifndef INC_IO_REC_H_
+#define INC_IO_REC_H_
+
+#include "io.h"
+
+
+#define IO_REC_PACKED 0 /* Records follow each other, a record may cross a sector boundary */
+#define IO_REC_PADDED 1 /* The end of each sector (_MAX_SS bytes) is left unused, so that no record crosses a sector boundary. Requires _MAX_SS == _MIN_SS */
+
+typedef struct {
+	IO_FileDescriptor* fp;     /* File */
+	UINT recordSize;           /* Size of a record (in bytes) */
+	UINT perSector;            /* Number of records in a sector with IO_REC_PADDED, 0 with IO_REC_PACKED */
+} IO_RecordFile;
+
+
+FRESULT io_rec_open(IO_RecordFile* rf, const TCHAR* path, BYTE mode, UINT recordSize, uint8_t layout);
+const void* io_rec_get(IO_RecordFile* rf, UINT index);
+FRESULT io_rec_put(IO_RecordFile* rf, UINT index, const void* record);
+FRESULT io_rec_count(IO_RecordFile* rf, UINT* count);
+FRESULT io_rec_bsearch(IO_RecordFile* rf, int (*compare)(const void* record, const void* key), const void* key, UINT* index);
+FRESULT io_rec_close(IO_RecordFile* rf);
+
+#endif /* INC_IO_REC_H_ */
@@ -0,0 +1,42 @@
+/** @file io_ring.h
+ *
+ * @brief This file contains an API to use a contiguous file as a circular log, which keeps the most recent data
+ */
+
+#ifndef INC_IO_RING_H_
+#define INC_IO_RING_H_
+
+#include "io.h"
+
+
+#define IO_RING_MAGIC 0x474E5249
+/*
+ * First word of the header sector of a ring file ("IRNG").
+ */
+
+#define IO_RING_HEADER_SIZE 16
+/*
+ * Bytes used in the header sector: magic, capacity, head and used, stored as little-endian 32-bit words.
+ * The header takes a whole sector, the data area starts at the second sector of the file.
+ */
+
+typedef struct {
+	IO_FileDescriptor* fp;     /* Contiguous file */
+	UINT dataOffset;           /* Position of the data area in the file (one sector) */
+	UINT capacity;             /* Size of the data area (in bytes, multiple of the sector size) */
+	UINT head;                 /* Position of the oldest byte in the data area */
+	UINT used;                 /* Number of bytes stored */
+	UINT cursor;               /* Reading position, from the oldest byte */
+	uint8_t headerDirty;       /* Bool telling if head/used changed since the header was written */
+} IO_Ring;
+
+
+FRESULT io_ring_create(IO_Ring* ring, const TCHAR* path, UINT capacity);
+FRESULT io_ring_open(IO_Ring* ring, const TCHAR* path);
+FRESULT io_ring_append(IO_Ring* ring, const void* data, UINT length);
+FRESULT io_ring_read(IO_Ring* ring, void* buff, UINT btr, UINT* br);
+FRESULT io_ring_rewind(IO_Ring* ring);
+FRESULT io_ring_sync(IO_Ring* ring);
+FRESULT io_ring_close(IO_Ring* ring);
+
+#endif /* INC_IO_RING_H_ */
@@ -0,0 +1,53 @@
+/** @file io_tlv.h
+ *
+ * @brief This file contains an API to log type-length-value records in sector-aligned frames
+ */
+
+#ifndef INC_IO_TLV_H_
+#define INC_IO_TLV_H_
+
+#include "io.h"
+
+
+#define IO_TLV_FRAME_HEADER 4
+/*
+ * Bytes at the beginning of each frame (_MAX_SS bytes): position of the first record starting in the frame
+ * (16 bits, IO_TLV_NO_RECORD if there is none) and number of records starting in the frame (16 bits).
+ * A record is its type (8 bits), its length (16 bits) and its value, which may continue in the next frames.
+ */
+
+#define IO_TLV_RECORD_HEADER 3
+#define IO_TLV_NO_RECORD 0xFFFF
+#define IO_TLV_END 0 /* Type 0 pads the end of a frame, io_tlv_read gives it at the end of the log */
+
+#if (_MAX_SS > IO_TLV_NO_RECORD)
+#error _MAX_SS is too big for io_tlv
+#endif
+
+#if (_MAX_SS != _MIN_SS)
+#error io_tlv requires a fixed sector size (_MAX_SS == _MIN_SS): a frame must be a sector of the volume
+#endif
+
+typedef struct {
+	IO_FileDescriptor* fp;     /* File */
+	UINT frame;                /* Frame being filled */
+	UINT fill;                 /* Bytes used in buffer */
+	uint16_t first;            /* Position of the first record starting in the frame */
+	uint16_t count;            /* Number of records starting in the frame */
+	uint8_t buffer[_MAX_SS];   /* Frame being filled */
+} IO_TlvWriter;
+
+typedef struct {
+	IO_FileDescriptor* fp;     /* File */
+	UINT frame;                /* Frame being read */
+	UINT offset;               /* Position of the next record in the frame */
+} IO_TlvReader;
+
+
+FRESULT io_tlv_writer_init(IO_TlvWriter* writer, IO_FileDescriptor* fp);
+FRESULT io_tlv_write(IO_TlvWriter* writer, uint8_t type, const void* value, UINT length);
+FRESULT io_tlv_flush(IO_TlvWriter* writer);
+FRESULT io_tlv_seek(IO_TlvReader* reader, IO_FileDescriptor* fp, UINT frame);
+FRESULT io_tlv_read(IO_TlvReader* reader, uint8_t* type, void* buff, UINT size, UINT* length);
+
+#endif /* INC_IO_TLV_H_ */
@@ -0,0 +1,39 @@
+/** @file io_ts.h
+ *
+ * @brief This file contains an API to log timestamped records, with a sparse index to read a time range quickly
+ */
+
+#ifndef INC_IO_TS_H_
+#define INC_IO_TS_H_
+
+#include "io_rec.h"
+
+
+#define IO_TS_INDEX_ENTRY 8
+/*
+ * Size of an entry of the index file: timestamp of the first record of a group of sectors, and number of this sector
+ * (little-endian 32-bit words).
+ */
+
+#if (_MAX_SS != _MIN_SS)
+#error io_ts requires a fixed sector size (_MAX_SS == _MIN_SS): its records are stored with IO_REC_PADDED
+#endif
+
+typedef struct {
+	IO_RecordFile data;        /* Records (IO_REC_PADDED), starting with their timestamp (little-endian 32-bit word) */
+	IO_RecordFile index;       /* Index entries (IO_REC_PACKED) */
+	UINT interval;             /* Number of data sectors between two index entries */
+	UINT count;                /* Number of records */
+	uint32_t lastTime;         /* Timestamp of the last record */
+	UINT cursor;               /* Next record given by io_ts_next */
+	uint32_t endTime;          /* End of the range given to io_ts_query */
+} IO_TimeLog;
+
+
+FRESULT io_ts_open(IO_TimeLog* log, const TCHAR* path, const TCHAR* indexPath, UINT recordSize, UINT interval);
+FRESULT io_ts_append(IO_TimeLog* log, const void* record);
+FRESULT io_ts_query(IO_TimeLog* log, uint32_t begin, uint32_t end);
+const void* io_ts_next(IO_TimeLog* log);
+FRESULT io_ts_close(IO_TimeLog* log);
+
+#endif /* INC_IO_TS_H_ */
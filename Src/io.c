@@ -6,18 +6,394 @@
 #include "io.h"
 #include <stdlib.h>
 #include <string.h>
+#if IO_USE_DIRECT_LBA
+#include "diskio.h"
+#endif
+
+/* Data sectors of any file are found with the cluster link map table, see IO_TINY_CACHE */
+#define IO_MAPPED_LBA ((IO_TINY_CACHE) && (IO_USE_DIRECT_LBA) && (_FS_TINY) && (_USE_FASTSEEK))
+
+/* Freed clusters are found with the cluster link map table, and discarded with disk_ioctl, see IO_DISCARD */
+#define IO_DISCARD_AVAILABLE ((IO_USE_DIRECT_LBA) && (_USE_FASTSEEK))
+
+/* FatFs file status flag (private to ff.c): f_sync updates the timestamp and the archive attribute of the file */
+#ifndef FA_MODIFIED
+#define FA_MODIFIED 0x40
+#endif
+
+/* Free clusters are found by reading the FAT with disk_read, see IO_EXTENT_INDEX_SIZE */
+#define IO_EXTENT_INDEX_AVAILABLE ((IO_EXTENT_INDEX_SIZE > 0) && (IO_USE_DIRECT_LBA) && (_USE_EXPAND == 1) && (_FS_READONLY == 0))
+
+/* State of the free-extent index */
+#define EXTENT_NONE 0        /* Not built */
+#define EXTENT_VALID 1       /* Built for extentFs */
+#define EXTENT_UNAVAILABLE 2 /* Couldn't be built for extentFs (FAT12, disk error), not retried until the next mount */
 
 const uint64_t MAX_FILE_SIZE = 4294967294;
 
+/* Buffer size is a power of two, so every offset computation uses shifts and masks.
+ * When sector size is fixed, the sector shift is a compile time constant.
+ */
+#define WIN_SHIFT(fp) ((UINT)(fp)->ssizeShift)
+#define WIN_MASK(fp) (((UINT)1 << WIN_SHIFT(fp)) - 1)
+#if (_MAX_SS == _MIN_SS)
+#define SECTOR_SHIFT(fp) ((UINT)IO_LOG2(_MAX_SS))
+#else
+#define SECTOR_SHIFT(fp) ((UINT)(fp)->sectorShift)
+#endif
+#define SECTOR_MASK(fp) (((UINT)1 << SECTOR_SHIFT(fp)) - 1)
+
+/* Data that won't be used again isn't kept dirty in the buffer */
+#define WRITE_THROUGH(fp) (((fp)->writeBack == IO_WRITE_THROUGH) || ((fp)->advice == IO_ADVICE_NOREUSE))
+
 static FRESULT buffer_specs(IO_FileDescriptor* fp, UINT bytes, UINT start, UINT* begin, UINT* end, UINT* size);
 static uint8_t buffer_exists(IO_FileDescriptor* fp, UINT begin, UINT size);
+static void readahead_specs(IO_FileDescriptor* fp, UINT begin, UINT* size);
+static UINT readahead_windows(IO_FileDescriptor* fp);
+static void writeunit_specs(IO_FileDescriptor* fp, UINT* begin, UINT end, UINT* size);
+static void flush_record(IO_FileDescriptor* fp);
+static void autotune_record(IO_FileDescriptor* fp, UINT position, UINT bytes, uint8_t hit);
+static uint8_t autotune_apply(IO_FileDescriptor* fp);
 static FRESULT free_buffer(IO_FileDescriptor* fp, uint8_t ignoreWriteErrors);
 static FRESULT alloc_buffer(IO_FileDescriptor* fp, UINT begin, UINT size);
 static FRESULT write_cache(IO_FileDescriptor* fp);
+static FRESULT read_cache(IO_FileDescriptor* fp, UINT* bytesread);
 static FRESULT modif_cache(IO_FileDescriptor* fp, const void* data, UINT position, UINT btw, UINT* bw);
 static FRESULT seek(IO_FileDescriptor* fp, FSIZE_t ofs);
 static FRESULT preallocate(IO_FileDescriptor* fp, FSIZE_t size);
+static void set_disk_size(IO_FileDescriptor* fp, FSIZE_t size);
+static FRESULT linkmap_build(IO_FileDescriptor* fp);
+static void linkmap_free(IO_FileDescriptor* fp);
+static uint8_t direct_mapped(IO_FileDescriptor* fp);
+#if IO_USE_DIRECT_LBA
+static void direct_enable(IO_FileDescriptor* fp, uint8_t check);
+static uint8_t direct_active(IO_FileDescriptor* fp);
+static UINT direct_map(IO_FileDescriptor* fp, FSIZE_t position, UINT count, DWORD* sector);
+static uint8_t direct_window(IO_FileDescriptor* fp);
+static uint8_t direct_needs_fill(IO_FileDescriptor* fp, UINT position, UINT btw);
+static FRESULT direct_read(IO_FileDescriptor* fp, FSIZE_t position, BYTE* data, UINT count);
+static FRESULT direct_write(IO_FileDescriptor* fp, FSIZE_t position, const BYTE* data, UINT count);
+static FRESULT write_user_buffer(IO_FileDescriptor* fp, const void* buff, UINT position, UINT btw, UINT* bw);
+#endif
+#if IO_DISCARD_AVAILABLE
+static uint8_t release_tracked(FATFS* fs);
+static FRESULT release_clusters(FATFS* fs, const DWORD* linkMap, DWORD first);
+#endif
+#if IO_EXTENT_INDEX_AVAILABLE
+static uint8_t extent_valid(FATFS* fs);
+static FRESULT extent_read(FATFS* fs, DWORD sector, BYTE* data);
+static UINT extent_search(DWORD length);
+static void extent_remove(UINT index);
+static void extent_insert(DWORD start, DWORD length);
+static void extent_allocated(DWORD start, DWORD length);
+#endif
 static IO_FileDescriptor* allocFileDescriptor();
+static void* default_buffer_alloc(size_t size);
+static void default_buffer_free(void* ptr);
+static void lru_insert(IO_FileDescriptor* fp);
+static void lru_append(IO_FileDescriptor* fp);
+static void lru_remove(IO_FileDescriptor* fp);
+static void lru_touch(IO_FileDescriptor* fp);
+static FRESULT memory_reserve(size_t size);
+
+/* Memory allocator of IO API, see io_set_allocator */
+static IO_Allocator allocator = {malloc, free, default_buffer_alloc, default_buffer_free};
+
+/* Buffers of all files, from the most recently used one (lruHead) to the least recently used one (lruTail) */
+static IO_FileDescriptor* lruHead = NULL;
+static IO_FileDescriptor* lruTail = NULL;
+static size_t memoryBudget = IO_MEMORY_BUDGET;
+static size_t memoryUsed = 0;
+static size_t memoryPeak = 0;
+static uint32_t memoryEvictions = 0;
+
+/* Bool telling if freed clusters are discarded, see io_set_discard */
+static uint8_t discardEnabled = IO_DISCARD;
+
+#if IO_EXTENT_INDEX_AVAILABLE
+/* Free extents of one mounted volume, sorted by length (the shortest first) */
+static FATFS* extentFs = NULL;
+static WORD extentFsId = 0;
+static uint8_t extentState = EXTENT_NONE;
+static DWORD extentStart[IO_EXTENT_INDEX_SIZE];  /* First cluster */
+static DWORD extentLength[IO_EXTENT_INDEX_SIZE]; /* Number of clusters */
+static UINT extentCount = 0;
+#endif
+
+/**
+  * @brief Selects the functions used to allocate memory
+  * @param alloc[IN] Descriptor and buffer hooks, NULL to restore malloc/free and IO_BUFFER_MALLOC/IO_BUFFER_FREE
+  * @retval None
+  * @note A pair of hooks which allocation function is NULL keeps its default functions
+  * @warning Must be called when no file is open: memory is freed with the hooks set when freeing it
+  */
+void io_set_allocator(const IO_Allocator* alloc)
+{
+	allocator.descriptorAlloc = malloc;
+	allocator.descriptorFree = free;
+	allocator.bufferAlloc = default_buffer_alloc;
+	allocator.bufferFree = default_buffer_free;
+
+	if (alloc == NULL)
+	{
+		return;
+	}
+	if ((alloc->descriptorAlloc != NULL) && (alloc->descriptorFree != NULL))
+	{
+		allocator.descriptorAlloc = alloc->descriptorAlloc;
+		allocator.descriptorFree = alloc->descriptorFree;
+	}
+	if ((alloc->bufferAlloc != NULL) && (alloc->bufferFree != NULL))
+	{
+		allocator.bufferAlloc = alloc->bufferAlloc;
+		allocator.bufferFree = alloc->bufferFree;
+	}
+}
+
+/**
+  * @brief Sets the maximum number of bytes used by the buffers of all files
+  * @param budget[IN] Memory budget (in bytes), 0 for no limit
+  * @retval FRESULT: error while saving evicted buffers, FR_OK else
+  * @note Buffers are evicted right now if the memory used is over the new budget
+  * @note The peak of memory usage restarts from the memory currently used
+  */
+FRESULT io_set_memory_budget(size_t budget)
+{
+	memoryBudget = budget;
+	memoryPeak = memoryUsed;
+	if (budget == 0)
+	{
+		return FR_OK;
+	}
+	return io_trim_memory(budget);
+}
+
+/**
+  * @brief Saves and frees the least recently used buffers
+  * @param target[IN] Memory that buffers may still use (in bytes), 0 frees every buffer
+  * @retval FRESULT: first error while saving a buffer, FR_OK else
+  * @note A buffer that can't be saved is kept, and the next one is evicted
+  */
+FRESULT io_trim_memory(size_t target)
+{
+	FRESULT res = FR_OK;
+	FRESULT err;
+	IO_FileDescriptor* victim = lruTail;
+	IO_FileDescriptor* next;
+
+	while ((victim != NULL) && (memoryUsed > target))
+	{
+		next = victim->lruPrev;
+		err = free_buffer(victim, 0);
+		if (err != FR_OK)
+		{
+			if (res == FR_OK)
+			{
+				res = err;
+			}
+		}
+		else
+		{
+			memoryEvictions++;
+		}
+		victim = next;
+	}
+	return res;
+}
+
+/**
+  * @brief Reports the memory used by the buffers of all files
+  * @param usage[OUT] Memory usage
+  * @retval None
+  */
+void io_memory_usage(IO_MemoryUsage* usage)
+{
+	IO_FileDescriptor* fp;
+
+	usage->used = memoryUsed;
+	usage->peak = memoryPeak;
+	usage->budget = memoryBudget;
+	usage->evictions = memoryEvictions;
+	usage->buffers = 0;
+	usage->dirtyBuffers = 0;
+	for (fp = lruHead; fp != NULL; fp = fp->lruNext)
+	{
+		usage->buffers++;
+		if (fp->unsavedData)
+		{
+			usage->dirtyBuffers++;
+		}
+	}
+}
+
+/**
+  * @brief Enables or disables discarding the clusters freed by io_truncate, io_unlink and io_create_contiguous
+  * @param enable[IN] 1 to send CTRL_TRIM requests to the disk, 0 else
+  * @retval FRESULT: FR_DENIED if the disk functions or fast seek aren't available
+  */
+FRESULT io_set_discard(uint8_t enable)
+{
+#if IO_DISCARD_AVAILABLE
+	discardEnabled = (enable != 0);
+	return FR_OK;
+#else
+	discardEnabled = 0;
+	return (enable != 0) ? FR_DENIED : FR_OK;
+#endif
+}
+
+/**
+  * @brief Builds the index of free extents of a volume, by reading its FAT (or its allocation bitmap)
+  * @param fs[IN] File system object of a mounted volume
+  * @retval FRESULT: FR_DENIED on FAT12 volumes or if the index is disabled, FR_DISK_ERR, FR_NOT_ENOUGH_CORE
+  * @note The index is built once per mount: call it when the application is idle, else the first io_create_contiguous call
+  * builds it. It is then updated when IO API allocates or frees clusters (freed clusters are known with _USE_FASTSEEK).
+  * @note Clusters allocated by FatFs when a file grows aren't removed from the index: it only gives FatFs
+  * a place to start looking for a contiguous area, FatFs still checks that the clusters are free
+  */
+FRESULT io_extent_index_build(FATFS* fs)
+{
+#if IO_EXTENT_INDEX_AVAILABLE
+	void* block;
+	BYTE* data;
+	UINT sectorSize;
+	UINT ofs;
+	DWORD sector;
+	DWORD clst;
+	DWORD value;
+	DWORD runStart = 0;
+	DWORD runLength = 0;
+	uint8_t isFree;
+	FRESULT res = FR_OK;
+
+	if (fs == NULL)
+	{
+		return FR_INVALID_OBJECT;
+	}
+
+	extentFs = fs;
+	extentFsId = fs->id;
+	extentState = EXTENT_UNAVAILABLE;
+	extentCount = 0;
+
+	if ((fs->fs_type != FS_FAT16) && (fs->fs_type != FS_FAT32) && (fs->fs_type != FS_EXFAT))
+	{
+		// FAT12 entries straddle sectors, and these volumes are small enough to be scanned by FatFs
+		return FR_DENIED;
+	}
+
+#if (_MAX_SS == _MIN_SS)
+	sectorSize = _MAX_SS;
+#else
+	sectorSize = fs->ssize;
+#endif
+	// FAT sectors are read with disk_read: the buffer is allocated and aligned like file buffers
+	block = allocator.bufferAlloc(sectorSize + IO_BUFFER_ALIGN - 1);
+	if (block == NULL)
+	{
+		return FR_NOT_ENOUGH_CORE;
+	}
+	data = (BYTE*)(((uintptr_t)block + IO_BUFFER_ALIGN - 1) & ~(uintptr_t)(IO_BUFFER_ALIGN - 1));
+
+	// Cluster 0 and 1 don't exist: the FAT starts with two reserved entries, the allocation bitmap with cluster 2
+	clst = (fs->fs_type == FS_EXFAT) ? 2 : 0;
+#if _FS_EXFAT
+	sector = (fs->fs_type == FS_EXFAT) ? fs->bitbase : fs->fatbase;
+#else
+	sector = fs->fatbase;
+#endif
+	while ((clst < fs->n_fatent) && (res == FR_OK))
+	{
+		res = extent_read(fs, sector++, data);
+		for (ofs = 0; (res == FR_OK) && (ofs < sectorSize) && (clst < fs->n_fatent); )
+		{
+			if (fs->fs_type == FS_EXFAT)
+			{
+				isFree = ((data[ofs] >> ((clst - 2) & 7)) & 1) == 0;
+				if (((clst - 2) & 7) == 7)
+				{
+					ofs++;
+				}
+			}
+			else if (fs->fs_type == FS_FAT16)
+			{
+				value = (DWORD)data[ofs] | ((DWORD)data[ofs + 1] << 8);
+				isFree = (value == 0);
+				ofs += 2;
+			}
+			else
+			{
+				value = (DWORD)data[ofs] | ((DWORD)data[ofs + 1] << 8) | ((DWORD)data[ofs + 2] << 16) | ((DWORD)data[ofs + 3] << 24);
+				isFree = ((value & 0x0FFFFFFF) == 0);
+				ofs += 4;
+			}
+
+			if ((clst >= 2) && isFree)
+			{
+				if (runLength == 0)
+				{
+					runStart = clst;
+				}
+				runLength++;
+			}
+			else if (runLength != 0)
+			{
+				extent_insert(runStart, runLength);
+				runLength = 0;
+			}
+			clst++;
+		}
+	}
+	extent_insert(runStart, runLength);
+	allocator.bufferFree(block);
+
+	if (res != FR_OK)
+	{
+		extentCount = 0;
+		return res;
+	}
+	extentState = EXTENT_VALID;
+	return FR_OK;
+#else
+	(void)fs;
+	return FR_DENIED;
+#endif
+}
+
+/**
+  * @brief Finds the smallest free extent holding a number of clusters
+  * @param fs[IN] File system object
+  * @param clusters[IN] Number of clusters needed
+  * @param start[OUT] First cluster of the extent
+  * @param length[OUT] Number of clusters of the extent
+  * @retval FRESULT: FR_NOT_ENABLED if the index isn't built for this volume, FR_DENIED if no known extent is big enough
+  * @note Binary search on the extents sorted by length
+  */
+FRESULT io_extent_index_find(FATFS* fs, DWORD clusters, DWORD* start, DWORD* length)
+{
+#if IO_EXTENT_INDEX_AVAILABLE
+	UINT index;
+
+	if (!extent_valid(fs))
+	{
+		return FR_NOT_ENABLED;
+	}
+	index = extent_search(clusters);
+	if (index >= extentCount)
+	{
+		return FR_DENIED;
+	}
+	*start = extentStart[index];
+	*length = extentLength[index];
+	return FR_OK;
+#else
+	(void)fs;
+	(void)clusters;
+	(void)start;
+	(void)length;
+	return FR_NOT_ENABLED;
+#endif
+}
 
 /**
   * @brief Create and open a contiguous file
@@ -27,11 +403,19 @@ static IO_FileDescriptor* allocFileDescriptor();
   * @retval Pointer to a IO_FileDescriptor structure, or NULL in case of error
   * @warning if a file with specified name already exists, it will be deleted
   * @note No need to call io_open after. But don't forget to call io_close !
+  * @note The file is opened with IO_FA_CONTIGUOUS mode
+  * @note FatFs looks for free clusters from the best fitting extent of the free-extent index (see io_extent_index_build)
   */
 IO_FileDescriptor* io_create_contiguous(const TCHAR* path, BYTE mode, FSIZE_t size)
 {
 	FRESULT res;
 	IO_FileDescriptor* fp = NULL;
+#if IO_EXTENT_INDEX_AVAILABLE
+	FATFS* fs;
+	DWORD clusters;
+	DWORD hintStart = 0;
+	DWORD hintLength = 0;
+#endif
 
 	if ((_USE_EXPAND != 1) || (_FS_READONLY != 0))
 	{
@@ -40,12 +424,34 @@ IO_FileDescriptor* io_create_contiguous(const TCHAR* path, BYTE mode, FSIZE_t si
 
 	mode |= FA_WRITE|FA_CREATE_ALWAYS;
 
+#if IO_DISCARD_AVAILABLE
+	// Clusters of the replaced file are discarded or given back to the index (there may be no such file)
+	if (release_tracked(NULL) && (_FS_MINIMIZE == 0))
+	{
+		io_unlink(path);
+	}
+#endif
+
 	fp = io_open(path, mode);
 	if (fp == NULL)
 	{
 		return NULL;
 	}
 
+#if IO_EXTENT_INDEX_AVAILABLE
+	// FatFs scans the FAT from last_clst: start from a free extent big enough
+	fs = fp->file->obj.fs;
+	if ((extentFs != fs) || (extentFsId != fs->id) || (extentState == EXTENT_NONE))
+	{
+		io_extent_index_build(fs);
+	}
+	clusters = (DWORD)((size + fp->clusterSize - 1) / fp->clusterSize);
+	if ((clusters != 0) && (io_extent_index_find(fs, clusters, &hintStart, &hintLength) == FR_OK))
+	{
+		fs->last_clst = hintStart;
+	}
+#endif
+
 	res = f_expand(fp->file, size, 1);
 	if (res != FR_OK)
 	{
@@ -57,22 +463,89 @@ IO_FileDescriptor* io_create_contiguous(const TCHAR* path, BYTE mode, FSIZE_t si
 		return NULL;
 	}
 
+#if IO_EXTENT_INDEX_AVAILABLE
+	if (extent_valid(fs))
+	{
+		if ((hintLength != 0) && (fp->file->obj.sclust != hintStart))
+		{
+			// Some clusters of the extent were allocated by FatFs since the index was built
+			extent_allocated(hintStart, hintLength);
+		}
+		extent_allocated(fp->file->obj.sclust, clusters);
+	}
+#endif
+
+	// f_expand may move FatFs read/write pointer
+	fp->fatfsPointerValid = 0;
+
+	// The cluster link map table was built before allocating clusters
+	if (fp->linkMap != NULL)
+	{
+		linkmap_build(fp);
+	}
+
+	set_disk_size(fp, size);
 	fp->actualFileSize = size;
+
+#if IO_USE_DIRECT_LBA
+	// No need to check that the file is contiguous
+	direct_enable(fp, 0);
+#endif
 	return fp;
 }
 
 /**
   * @brief Open/create a file
   * @param path[IN] File name
-  * @param mode[IN] FATFS mode flags
+  * @param mode[IN] FATFS mode flags, IO_FA_FASTSEEK and IO_FA_CONTIGUOUS
   * @retval Pointer to a IO_FileDescriptor structure, or NULL in case of error
+  * @note If the cluster link map table can't be built, the file is opened without fast seek
+  * @note If the file isn't contiguous, IO_FA_CONTIGUOUS is ignored
+  * @note With IO_TINY_CACHE and _FS_TINY, the cluster link map table is always built
   */
 IO_FileDescriptor* io_open(const TCHAR* path, BYTE mode)
+{
+	return io_open_ex(path, mode, NULL);
+}
+
+/**
+  * @brief Opens a file with its own buffer settings
+  * @param path[IN] File name
+  * @param mode[IN] FATFS mode flags, IO_FA_FASTSEEK and IO_FA_CONTIGUOUS
+  * @param options[IN] Buffer size, read-ahead and write-back policies, preallocation hint (NULL for default settings)
+  * @retval Pointer to a IO_FileDescriptor structure, or NULL in case of error
+  * @note The preallocation hint only asks FatFs to look for a contiguous area for a new file (f_expand with opt 0)
+  * @note With clusterWindows, a window never straddles two clusters, so each fill or flush is one multi-sector transfer
+  * @note With writeUnit, units are aligned on file offsets: they match the card allocation units when the file
+  * starts on an allocation unit boundary
+  */
+IO_FileDescriptor* io_open_ex(const TCHAR* path, BYTE mode, const IO_OpenOptions* options)
 {
 	FRESULT res;
-	WORD sectorSize;
+	UINT sectorSize;
+	UINT windowSectors = BUF_MULTIPLIER;
+	UINT writeUnit = 0;
 	IO_FileDescriptor* fp = NULL;
 	
+	if ((options != NULL) && (options->windowSectors != 0))
+	{
+		windowSectors = options->windowSectors;
+	}
+	if (options != NULL)
+	{
+		writeUnit = options->writeUnit;
+	}
+	if (((windowSectors & (windowSectors - 1)) != 0) || ((writeUnit & (writeUnit - 1)) != 0))
+	{
+		// Buffer size and write unit must be powers of two
+		return NULL;
+	}
+	if (writeUnit > MAX_BUFFER_SIZE)
+	{
+		// The buffer can't hold a whole allocation unit: units are still aligned on AU boundaries
+		writeUnit = MAX_BUFFER_SIZE;
+	}
+
 	fp = allocFileDescriptor();
 	if (fp == NULL)
 	{
@@ -86,25 +559,76 @@ IO_FileDescriptor* io_open(const TCHAR* path, BYTE mode)
 	}
 
 	// Actually open the file
-	res = f_open(fp->file, path, mode);
+	res = f_open(fp->file, path, mode & (BYTE)~(IO_FA_FASTSEEK | IO_FA_CONTIGUOUS));
 	if (res != FR_OK)
 	{
 		io_close(fp);
 		return NULL;
 	}
 	
-	// Updating file descriptor fields value
-	fp->isOpen = 1;
-	fp->actualFileSize = f_size(fp->file);
-	fp->rwPointer =  f_tell(fp->file);
-
 	// Getting sector size
 #if (_MAX_SS == _MIN_SS)
 		sectorSize = _MAX_SS;
 #else
 		sectorSize = fp->file->obj.fs->ssize;
 #endif
-	fp->ssize = sectorSize * BUF_MULTIPLIER;
+	if ((uint64_t)sectorSize * windowSectors > MAX_BUFFER_SIZE)
+	{
+		io_close(fp);
+		return NULL;
+	}
+	fp->ssize = sectorSize * windowSectors;
+	fp->ssizeShift = (uint8_t)IO_LOG2(fp->ssize);
+	fp->sectorShift = (uint8_t)IO_LOG2(sectorSize);
+	fp->clusterSize = (UINT)sectorSize * fp->file->obj.fs->csize;
+	fp->minShift = fp->sectorShift;
+	if ((options != NULL) && (options->clusterWindows != 0) && (fp->clusterSize <= MAX_BUFFER_SIZE))
+	{
+		// Cluster size is a power of two: windows aligned on their size are aligned on clusters
+		if (fp->ssize < fp->clusterSize)
+		{
+			fp->ssize = fp->clusterSize;
+			fp->ssizeShift = (uint8_t)IO_LOG2(fp->ssize);
+		}
+		fp->minShift = (uint8_t)IO_LOG2(fp->clusterSize);
+	}
+	fp->targetShift = fp->ssizeShift;
+	if (options != NULL)
+	{
+		fp->readAhead = options->readAhead;
+		fp->writeBack = options->writeBack;
+		fp->writeUnit = writeUnit;
+		fp->autoTune = options->autoTune;
+	}
+
+	// Updating file descriptor fields value (FatFs metadata is only queried here)
+	fp->isOpen = 1;
+	set_disk_size(fp, f_size(fp->file));
+	fp->actualFileSize = fp->diskFileSize;
+	fp->rwPointer =  f_tell(fp->file);
+	fp->fatfsPointer = fp->rwPointer;
+	fp->fatfsPointerValid = 1;
+
+#if (_USE_EXPAND == 1) && (_FS_READONLY == 0)
+	// FatFs looks for a contiguous area, that will be used when writing the file
+	if ((options != NULL) && (options->preallocHint != 0) && (fp->diskFileSize == 0) && (mode & FA_WRITE))
+	{
+		f_expand(fp->file, options->preallocHint, 0);
+	}
+#endif
+
+#if IO_USE_DIRECT_LBA
+	if (mode & IO_FA_CONTIGUOUS)
+	{
+		direct_enable(fp, 1);
+	}
+#endif
+
+	// With _FS_TINY, the table is also used to find data sectors of fragmented files
+	if ((mode & IO_FA_FASTSEEK) || (IO_MAPPED_LBA && (fp->directSector == 0)))
+	{
+		linkmap_build(fp);
+	}
 	
 	return fp;
 }
@@ -146,22 +670,22 @@ void* io_read(IO_FileDescriptor* fp, UINT position, UINT btr, UINT* br)
 	}
 
 	// Check that the file isn't too small (start of reading block)
-	if (position >= f_size(fp->file))
+	if (position >= fp->diskFileSize)
 	{
 		// Maybe there is cached data that goes over current eof
-		if (position >= fp->actualSize + fp->bufferBegin * fp->ssize)
+		if (position >= fp->actualSize + (fp->bufferBegin << WIN_SHIFT(fp)))
 		{
 			return NULL;
 		}
 	}
 
 	// Check that the file isn't too small (end of reading block)
-	if (position + btr > f_size(fp->file))
+	if (position + btr > fp->diskFileSize)
 	{
 		// Maybe there is cached data that goes over current eof
-		if (position + btr > fp->actualSize + fp->bufferBegin * fp->ssize)
+		if (position + btr > fp->actualSize + (fp->bufferBegin << WIN_SHIFT(fp)))
 		{
-			btr = f_size(fp->file) - position;
+			btr = fp->diskFileSize - position;
 		}
 	}
 
@@ -174,13 +698,15 @@ void* io_read(IO_FileDescriptor* fp, UINT position, UINT btr, UINT* br)
 
 	// Check if the buffer already exists
 	buf_exist = buffer_exists(fp, begin, size);
+	autotune_record(fp, position, btr, (buf_exist == 2));
 
 	if (buf_exist == 2)
 	{
 		// Buffer ready !
-		offset = position - fp->bufferBegin * fp->ssize;
+		offset = position - (fp->bufferBegin << WIN_SHIFT(fp));
 		*br = btr;
 		fp->rwPointer = *br + position;
+		lru_touch(fp);
 		return fp->buffer + offset;
 	}
 	else if (buf_exist == 0)
@@ -192,6 +718,22 @@ void* io_read(IO_FileDescriptor* fp, UINT position, UINT btr, UINT* br)
 			return NULL;
 		}
 
+		// Window size can only change when there is no buffer
+		if (autotune_apply(fp))
+		{
+			res = buffer_specs(fp, btr, position, &begin, &end, &size);
+			if (res != FR_OK)
+			{
+				return NULL;
+			}
+		}
+
+		// Sequential reading: read next windows in advance
+		if ((readahead_windows(fp) != 0) && (position == fp->rwPointer))
+		{
+			readahead_specs(fp, begin, &size);
+		}
+
 		res = alloc_buffer(fp, begin, size);
 		if ((fp->buffer == NULL) || (res != FR_OK))
 		{
@@ -202,38 +744,22 @@ void* io_read(IO_FileDescriptor* fp, UINT position, UINT btr, UINT* br)
 	/* offset variable is the difference between the position of a byte
 	 *  in the buffer and in the file
 	 */
-	offset = position - fp->bufferBegin * fp->ssize;
+	offset = position - (fp->bufferBegin << WIN_SHIFT(fp));
 
-	// Move the read/write pointer to the correct place
-	res = seek(fp, fp->bufferBegin * fp->ssize);
+	// Fill the buffer
+	res = read_cache(fp, &bytesread);
 	if (res != FR_OK)
 	{
 		return NULL;
 	}
 
-	res = f_read(fp->file, fp->buffer, fp->bufferSize, &bytesread);
-
-	// Update actualSize
-	if (fp->actualSize < bytesread)
-	{
-		fp->actualSize = bytesread;
-		if (fp->actualSize + fp->bufferBegin * fp->ssize > fp->actualFileSize)
-		{
-			fp->actualFileSize = fp->actualSize + fp->bufferBegin * fp->ssize;
-		}
-	}
-
 	*br = bytesread - offset;
 	if (*br > btr)
 	{
 		*br = btr;
 	}
 	fp->rwPointer = *br + position;
-
-	if (res != FR_OK)
-	{
-		return NULL;
-	}
+	lru_touch(fp);
 
 	return fp->buffer + offset;
 }
@@ -256,7 +782,8 @@ FRESULT io_write(IO_FileDescriptor* fp, const void* buff, UINT position, UINT bt
 	UINT size = 0;
 	UINT bytesread = 0;
 	FRESULT res;
-	void* io_read_ret_val = NULL;
+	uint8_t fill = 0;
+	uint8_t exists;
 
 	*bw = 0;
 
@@ -292,6 +819,16 @@ FRESULT io_write(IO_FileDescriptor* fp, const void* buff, UINT position, UINT bt
 		return FR_OK;
 	}
 
+#if IO_USE_DIRECT_LBA
+	// Contiguous or mapped file: whole sectors don't need to be copied in the buffer (unless they are gathered in write units)
+	if ((btw >= fp->ssize) && (btw >= fp->writeUnit) && (((position | btw) & SECTOR_MASK(fp)) == 0) && (position <= fp->actualFileSize)
+		&& (((fp->directSector != 0) && ((uint64_t)position + btw <= fp->directSize)) || direct_mapped(fp)))
+	{
+		autotune_record(fp, position, btw, 0);
+		return write_user_buffer(fp, buff, position, btw, bw);
+	}
+#endif
+
 	// Compute the begin and end sectors of the buffer to use, and its size:
 	res = buffer_specs(fp, btw, position, &begin, &end, &size);
 	if (res != FR_OK)
@@ -300,9 +837,25 @@ FRESULT io_write(IO_FileDescriptor* fp, const void* buff, UINT position, UINT bt
 	}
 
 	// Check if the buffer already exists
-	if (buffer_exists(fp, begin, size))
+	exists = buffer_exists(fp, begin, size);
+	autotune_record(fp, position, btw, exists);
+	if (exists)
 	{
+#if IO_USE_DIRECT_LBA
+		if (direct_needs_fill(fp, position, btw))
+		{
+			res = read_cache(fp, &bytesread);
+			if (res != FR_OK)
+			{
+				return res;
+			}
+		}
+#endif
 		res = modif_cache(fp, buff, position, btw, bw);
+		if ((res == FR_OK) && WRITE_THROUGH(fp))
+		{
+			res = write_cache(fp);
+		}
 		return res;
 	}
 
@@ -312,6 +865,19 @@ FRESULT io_write(IO_FileDescriptor* fp, const void* buff, UINT position, UINT bt
 		return res;
 	}
 
+	// Window size can only change when there is no buffer
+	if (autotune_apply(fp))
+	{
+		res = buffer_specs(fp, btw, position, &begin, &end, &size);
+		if (res != FR_OK)
+		{
+			return res;
+		}
+	}
+
+	// Next writes are gathered until the whole unit is flushed
+	writeunit_specs(fp, &begin, end, &size);
+
 	res = alloc_buffer(fp, begin, size);
 	if (res != FR_OK)
 	{
@@ -323,46 +889,297 @@ FRESULT io_write(IO_FileDescriptor* fp, const void* buff, UINT position, UINT bt
 	}
 
 	// Read file to fill the buffer (only read what's necessary)
-	if ((position != begin * fp->ssize) && (begin * fp->ssize < f_size(fp->file)))
+	if (position != (begin << WIN_SHIFT(fp)))
+	{
+		fill = 1;
+	}
+#if IO_USE_DIRECT_LBA
+	if (direct_needs_fill(fp, position, btw))
+	{
+		fill = 1;
+	}
+#endif
+	if ((fill != 0) && ((begin << WIN_SHIFT(fp)) < fp->diskFileSize))
 	{
-		io_read_ret_val = io_read(fp, begin * fp->ssize, position - begin * fp->ssize, &bytesread);
-		if (io_read_ret_val == NULL)
+		res = read_cache(fp, &bytesread);
+		if (res != FR_OK)
 		{
-			return FR_INT_ERR;
+			return res;
 		}
 	}
 
 	// Write data on the buffer
 	res = modif_cache(fp, buff, position, btw, bw);
+	if ((res == FR_OK) && WRITE_THROUGH(fp))
+	{
+		res = write_cache(fp);
+	}
 	return res;
 }
 
 /**
-  * @brief Saves every cached data
-  * @param fp[IN] Pointer to the file IO_FileDescriptor* object structure
-  * @retval FRESULT
+  * @brief Forwards data from a file to a data streaming device, without intermediate copy
+  * @param fp[IN] IO_FileDescriptor* object
+  * @param position[IN] Position of the first byte to forward
+  * @param btf[IN] Number of bytes to forward
+  * @param func[IN] Data streaming function, same as f_forward's one:
+  * func(0, 0) must return 0 when the device is busy, and func(data, n) returns the number of bytes sent
+  * @param bf[OUT] Number of bytes forwarded
+  * @retval FRESULT, same as f_forward
+  * @note Data is given at most one sector at a time, straight from the buffer or from FatFs window
+  * @note With IO_TINY_CACHE, data of mapped files always goes through the buffer
   */
-FRESULT io_sync(IO_FileDescriptor* fp)
+FRESULT io_forward(IO_FileDescriptor* fp, UINT position, UINT btf, UINT (*func)(const BYTE*, UINT), UINT* bf)
 {
-	FRESULT res = FR_OK;
-	if ((fp == NULL)|| (fp->isOpen == 0))
+	FSIZE_t start;
+	FSIZE_t validEnd;
+	UINT chunk;
+	UINT sent;
+#if (_USE_FORWARD == 1) && (_FS_TINY == 1)
+	FRESULT res;
+#endif
+	const uint8_t* data;
+
+	*bf = 0;
+
+	if ((fp == NULL)|| (fp->isOpen == 0) || (func == NULL))
 	{
 		return FR_INVALID_OBJECT;
 	}
-	
-	// First: synchronize FatFs with the buffer
-	res = write_cache(fp);
-	if (res != FR_OK)
+
+	if (fp->ssize == 0)
 	{
-		return res;
+		return FR_INT_ERR;
 	}
 
-	// Synchronize FatFs with the mass storage
-	if (_FS_READONLY != 0)
+	// Don't go over eof
+	if (position >= fp->actualFileSize)
 	{
-		return FR_DENIED;
+		return FR_OK;
+	}
+	if ((FSIZE_t)position + btf > fp->actualFileSize)
+	{
+		btf = (UINT)(fp->actualFileSize - position);
+	}
+
+	while ((btf > 0) && (func(0, 0) != 0))
+	{
+		// Chunks never go over the end of a sector
+		chunk = ((UINT)1 << SECTOR_SHIFT(fp)) - (position & SECTOR_MASK(fp));
+		if (chunk > btf)
+		{
+			chunk = btf;
+		}
+
+		start = (FSIZE_t)fp->bufferBegin << WIN_SHIFT(fp);
+		validEnd = start + fp->actualSize;
+		if ((fp->buffer != NULL) && (position >= start) && (position < validEnd))
+		{
+			// Data is in the buffer (maybe unsaved)
+			if (position + chunk > validEnd)
+			{
+				chunk = (UINT)(validEnd - position);
+			}
+			data = fp->buffer + (position - start);
+		}
+#if (_USE_FORWARD == 1) && (_FS_TINY == 1)
+		else if (!direct_mapped(fp))
+		{
+			// Let FatFs give data from its window, but don't go over the buffer
+			if ((fp->buffer != NULL) && (position < start) && (position + chunk > start))
+			{
+				chunk = (UINT)(start - position);
+			}
+
+			res = seek(fp, position);
+			if (res != FR_OK)
+			{
+				return res;
+			}
+
+			res = f_forward(fp->file, func, chunk, &sent);
+			if (res != FR_OK)
+			{
+				fp->fatfsPointerValid = 0;
+				return res;
+			}
+			fp->fatfsPointer += sent;
+			*bf += sent;
+			position += sent;
+			btf -= sent;
+			fp->rwPointer = position;
+			if (sent < chunk)
+			{
+				// Device busy
+				break;
+			}
+			continue;
+		}
+#endif
+		else
+		{
+			// f_forward is unavailable, or FatFs window must only hold FAT sectors: use the buffer
+			data = io_read(fp, position, chunk, &sent);
+			if (data == NULL)
+			{
+				return FR_INT_ERR;
+			}
+			chunk = sent;
+		}
+
+		sent = func(data, chunk);
+		if (sent == 0)
+		{
+			return FR_INT_ERR;
+		}
+		*bf += sent;
+		position += sent;
+		btf -= sent;
+		fp->rwPointer = position;
+	}
+
+	return FR_OK;
+}
+
+/**
+  * @brief Reads exactly length bytes into a user buffer
+  * @param fp[IN] Pointer to the file IO_FileDescriptor* object structure
+  * @param buff[OUT] Buffer
+  * @param position[IN] Position of the first byte to read in the file
+  * @param length[IN] Number of bytes to read
+  * @retval FRESULT: FR_DISK_ERR if the data couldn't be read (error, or end of the file)
+  * @note io_read stops at the end of its buffer: it is called until everything is read
+  */
+FRESULT io_read_exact(IO_FileDescriptor* fp, void* buff, UINT position, UINT length)
+{
+	const void* data;
+	uint8_t* ptr = (uint8_t*)buff;
+	UINT br;
+
+	if ((fp == NULL) || ((buff == NULL) && (length != 0)))
+	{
+		return FR_INVALID_OBJECT;
+	}
+
+	while (length != 0)
+	{
+		data = io_read(fp, position, length, &br);
+		if ((data == NULL) || (br == 0))
+		{
+			return FR_DISK_ERR;
+		}
+		memcpy(ptr, data, br);
+		ptr += br;
+		position += br;
+		length -= br;
+	}
+	return FR_OK;
+}
+
+/**
+  * @brief Writes exactly length bytes
+  * @param fp[IN] Pointer to the file IO_FileDescriptor* object structure
+  * @param buff[IN] Data to write
+  * @param position[IN] Position of the first byte to write in the file
+  * @param length[IN] Number of bytes to write
+  * @retval FRESULT, same as io_write, or FR_DENIED if less bytes were written (disk full)
+  */
+FRESULT io_write_exact(IO_FileDescriptor* fp, const void* buff, UINT position, UINT length)
+{
+	FRESULT res;
+	UINT bw;
+
+	res = io_write(fp, buff, position, length, &bw);
+	if ((res == FR_OK) && (bw != length))
+	{
+		res = FR_DENIED;
+	}
+	return res;
+}
+
+/**
+  * @brief Stores a little-endian 16-bit word, as used by on-disk formats
+  * @param ptr[OUT] Destination (2 bytes)
+  * @param value[IN] Value
+  * @retval None
+  */
+void io_store_le16(uint8_t* ptr, uint16_t value)
+{
+	ptr[0] = (uint8_t)value;
+	ptr[1] = (uint8_t)(value >> 8);
+}
+
+/**
+  * @brief Loads a little-endian 16-bit word
+  * @param ptr[IN] Source (2 bytes)
+  * @retval Value
+  */
+uint16_t io_load_le16(const uint8_t* ptr)
+{
+	return (uint16_t)(ptr[0] | (ptr[1] << 8));
+}
+
+/**
+  * @brief Stores a little-endian 32-bit word, as used by on-disk formats
+  * @param ptr[OUT] Destination (4 bytes)
+  * @param value[IN] Value
+  * @retval None
+  */
+void io_store_le32(uint8_t* ptr, uint32_t value)
+{
+	ptr[0] = (uint8_t)value;
+	ptr[1] = (uint8_t)(value >> 8);
+	ptr[2] = (uint8_t)(value >> 16);
+	ptr[3] = (uint8_t)(value >> 24);
+}
+
+/**
+  * @brief Loads a little-endian 32-bit word
+  * @param ptr[IN] Source (4 bytes)
+  * @retval Value
+  */
+uint32_t io_load_le32(const uint8_t* ptr)
+{
+	return (uint32_t)ptr[0] | ((uint32_t)ptr[1] << 8) | ((uint32_t)ptr[2] << 16) | ((uint32_t)ptr[3] << 24);
+}
+
+/**
+  * @brief Saves every cached data
+  * @param fp[IN] Pointer to the file IO_FileDescriptor* object structure
+  * @retval FRESULT
+  */
+FRESULT io_sync(IO_FileDescriptor* fp)
+{
+	FRESULT res = FR_OK;
+	if ((fp == NULL)|| (fp->isOpen == 0))
+	{
+		return FR_INVALID_OBJECT;
+	}
+	
+	// First: synchronize FatFs with the buffer
+	res = write_cache(fp);
+	if (res != FR_OK)
+	{
+		return res;
+	}
+
+	// Synchronize FatFs with the mass storage
+	if (_FS_READONLY != 0)
+	{
+		return FR_DENIED;
 	}
 	res = f_sync(fp->file);
+
+#if IO_USE_DIRECT_LBA
+	// FatFs doesn't know that data was written on the disk
+	if ((res == FR_OK) && direct_active(fp))
+	{
+		if (disk_ioctl(fp->file->obj.fs->drv, CTRL_SYNC, NULL) != RES_OK)
+		{
+			res = FR_DISK_ERR;
+		}
+	}
+#endif
 	return res;
 }
 
@@ -400,6 +1217,106 @@ FRESULT io_tell(IO_FileDescriptor* fp, FSIZE_t* rwPointer)
 	return FR_OK;
 }
 
+/**
+  * @brief Gives the expected access pattern of a file, like posix_fadvise
+  * @param fp[IN] IO_FileDescriptor* object
+  * @param offset[IN] Position of the first byte of the range
+  * @param len[IN] Number of bytes of the range, 0 for the rest of the file
+  * @param advice[IN] IO_ADVICE_NORMAL, IO_ADVICE_SEQUENTIAL, IO_ADVICE_RANDOM or IO_ADVICE_NOREUSE (whole file),
+  * IO_ADVICE_WILLNEED or IO_ADVICE_DONTNEED (range)
+  * @retval FRESULT: FR_INVALID_PARAMETER for an unknown hint, error while loading or saving the buffer
+  * @note IO_ADVICE_WILLNEED loads at most MAX_BUFFER_SIZE bytes, and doesn't move the read/write pointer
+  */
+FRESULT io_advise(IO_FileDescriptor* fp, UINT offset, UINT len, uint8_t advice)
+{
+	UINT begin = 0;
+	UINT end = 0;
+	UINT size = 0;
+	UINT bytesread = 0;
+	uint64_t rangeEnd;
+	FRESULT res;
+
+	if ((fp == NULL)|| (fp->isOpen == 0))
+	{
+		return FR_INVALID_OBJECT;
+	}
+
+	switch (advice)
+	{
+	case IO_ADVICE_NORMAL:
+	case IO_ADVICE_SEQUENTIAL:
+	case IO_ADVICE_RANDOM:
+	case IO_ADVICE_NOREUSE:
+		fp->advice = advice;
+		if (advice == IO_ADVICE_NOREUSE)
+		{
+			// Cached data may be reused by other files
+			lru_touch(fp);
+		}
+		return FR_OK;
+
+	case IO_ADVICE_DONTNEED:
+		if (fp->buffer == NULL)
+		{
+			return FR_OK;
+		}
+		rangeEnd = (len == 0) ? (uint64_t)MAX_FILE_SIZE + 1 : (uint64_t)offset + len;
+		if ((rangeEnd <= ((uint64_t)fp->bufferBegin << WIN_SHIFT(fp)))
+			|| (offset >= ((uint64_t)fp->bufferBegin << WIN_SHIFT(fp)) + fp->bufferSize))
+		{
+			// The buffer doesn't hold the range
+			return FR_OK;
+		}
+		return free_buffer(fp, 0);
+
+	case IO_ADVICE_WILLNEED:
+		if (offset >= fp->actualFileSize)
+		{
+			return FR_OK;
+		}
+		if ((len == 0) || ((uint64_t)offset + len > fp->actualFileSize))
+		{
+			len = (UINT)(fp->actualFileSize - offset);
+		}
+		if (len > MAX_BUFFER_SIZE - (offset & WIN_MASK(fp)))
+		{
+			len = MAX_BUFFER_SIZE - (offset & WIN_MASK(fp));
+		}
+		res = buffer_specs(fp, len, offset, &begin, &end, &size);
+		if (res != FR_OK)
+		{
+			return res;
+		}
+		if (buffer_exists(fp, begin, size) == 2)
+		{
+			return FR_OK;
+		}
+		res = free_buffer(fp, 0);
+		if (res != FR_OK)
+		{
+			return res;
+		}
+		if (autotune_apply(fp))
+		{
+			res = buffer_specs(fp, len, offset, &begin, &end, &size);
+			if (res != FR_OK)
+			{
+				return res;
+			}
+		}
+		res = alloc_buffer(fp, begin, size);
+		if (res != FR_OK)
+		{
+			return res;
+		}
+		lru_touch(fp);
+		return read_cache(fp, &bytesread);
+
+	default:
+		return FR_INVALID_PARAMETER;
+	}
+}
+
 /**
   * @brief Moves the current position of read/write pointer
   * @param fp[IN] Pointer to the file IO_FileDescriptor* object structure
@@ -461,6 +1378,9 @@ FRESULT io_truncate(IO_FileDescriptor* fp, FSIZE_t newSize)
 {
 	FRESULT res = FR_OK;
 	FSIZE_t currentSize;
+#if IO_DISCARD_AVAILABLE
+	uint8_t temporaryMap = 0;
+#endif
 	
 	if ((fp == NULL)|| (fp->isOpen == 0))
 	{
@@ -483,13 +1403,13 @@ FRESULT io_truncate(IO_FileDescriptor* fp, FSIZE_t newSize)
 		// Expanding file size
 		return preallocate(fp, newSize);
 	}
-	else if ((newSize < currentSize) && (newSize >= fp->bufferBegin * fp->ssize))
+	else if ((newSize < currentSize) && (newSize >= (fp->bufferBegin << WIN_SHIFT(fp))))
 	{
 		// Reducing file size, but still using the same buffer
 		fp->actualFileSize = newSize;
-		fp->actualSize = (UINT)(fp->actualFileSize - fp->bufferBegin * fp->ssize);
+		fp->actualSize = (UINT)(fp->actualFileSize - (fp->bufferBegin << WIN_SHIFT(fp)));
 	}
-	else if ((newSize < currentSize) && (newSize < fp->bufferBegin * fp->ssize))
+	else if ((newSize < currentSize) && (newSize < (fp->bufferBegin << WIN_SHIFT(fp))))
 	{
 		// Reducing file size enough to make the buffer useless
 		fp->actualFileSize = newSize;
@@ -502,7 +1422,7 @@ FRESULT io_truncate(IO_FileDescriptor* fp, FSIZE_t newSize)
 		}
 	}
 
-	if (newSize < f_size(fp->file))
+	if (newSize < fp->diskFileSize)
 	{
 		// Updating actual file size on disk (only if size was reduced)
 		if ((_FS_READONLY != 0) || (_FS_MINIMIZE != 0))
@@ -510,22 +1430,65 @@ FRESULT io_truncate(IO_FileDescriptor* fp, FSIZE_t newSize)
 			return FR_DENIED;
 		}
 
+#if IO_DISCARD_AVAILABLE
+		// The cluster chain is read before FatFs frees the clusters
+		if (release_tracked(fp->file->obj.fs) && (fp->linkMap == NULL) && (linkmap_build(fp) == FR_OK))
+		{
+			temporaryMap = 1;
+		}
+#endif
+
 		res = seek(fp, newSize);
+		if (res == FR_OK)
+		{
+			res = f_truncate(fp->file);
+		}
+#if IO_DISCARD_AVAILABLE
+		if ((res == FR_OK) && release_tracked(fp->file->obj.fs) && (fp->linkMap != NULL))
+		{
+			res = release_clusters(fp->file->obj.fs, fp->linkMap, (DWORD)((newSize + fp->clusterSize - 1) / fp->clusterSize));
+		}
+		if (temporaryMap != 0)
+		{
+			linkmap_free(fp);
+		}
+#endif
 		if (res != FR_OK)
 		{
 			return res;
 		}
+		set_disk_size(fp, newSize);
 
-		res = f_truncate(fp->file);
-		if (res != FR_OK)
+		// Released clusters may not be contiguous when allocated again
+		if (fp->directSize > fp->allocatedSize)
 		{
-			return res;
+			fp->directSize = fp->allocatedSize;
 		}
 	}
 
 	return FR_OK;
 }
 
+/**
+  * @brief Reports the access pattern of a file and the decisions of auto-tuning
+  * @param fp[IN] Pointer to the file IO_FileDescriptor* object structure
+  * @param stats[OUT] Statistics
+  * @retval FRESULT: FR_OK if there is no error.
+  */
+FRESULT io_stats(IO_FileDescriptor* fp, IO_Stats* stats)
+{
+	if ((fp == NULL)|| (fp->isOpen == 0))
+	{
+		return FR_INVALID_OBJECT;
+	}
+
+	*stats = fp->stats;
+	stats->windowSize = fp->ssize;
+	stats->targetWindowSize = (UINT)1 << fp->targetShift;
+	stats->seeksAvoided = fp->seeksAvoided;
+	return FR_OK;
+}
+
 /**
   * @brief Tests for an error in a file
   * @param fp[IN] Pointer to the file IO_FileDescriptor* object structure
@@ -544,6 +1507,53 @@ FRESULT io_error(IO_FileDescriptor* fp)
 	return FR_DISK_ERR;
 }
 
+/**
+  * @brief Deletes a file, discards its clusters (see io_set_discard) and adds them to the free-extent index
+  * @param path[IN] File name
+  * @retval FRESULT, same as f_unlink, or FR_DISK_ERR if the disk refused to discard the clusters
+  * @warning The file must not be open
+  */
+FRESULT io_unlink(const TCHAR* path)
+{
+	FRESULT res;
+#if IO_DISCARD_AVAILABLE
+	IO_FileDescriptor* fp;
+	DWORD* linkMap = NULL;
+	FATFS* fs = NULL;
+#endif
+
+	if ((_FS_READONLY != 0) || (_FS_MINIMIZE != 0))
+	{
+		return FR_DENIED;
+	}
+
+#if IO_DISCARD_AVAILABLE
+	if (release_tracked(NULL))
+	{
+		// The cluster chain is read before FatFs frees the clusters
+		fp = io_open(path, FA_READ | IO_FA_FASTSEEK);
+		if (fp != NULL)
+		{
+			fs = fp->file->obj.fs;
+			linkMap = fp->linkMap;
+			fp->linkMap = NULL;
+			io_close(fp);
+		}
+	}
+#endif
+
+	res = f_unlink(path);
+
+#if IO_DISCARD_AVAILABLE
+	if ((res == FR_OK) && (linkMap != NULL))
+	{
+		res = release_clusters(fs, linkMap, 0);
+	}
+	allocator.descriptorFree(linkMap);
+#endif
+	return res;
+}
+
 /**
   * @brief Changes the timestamp of a file
   * @param path[IN] File name
@@ -602,22 +1612,27 @@ FRESULT io_close(IO_FileDescriptor* fp)
 		res_return = res;
 	}
 	
-	free(fp->file);
-	free(fp);
+	linkmap_free(fp);
+	allocator.descriptorFree(fp->file);
+	allocator.descriptorFree(fp);
 	fp = NULL;
 	
 	return res_return;
 }
 
 /**
-  * @brief Calls malloc to allocate the buffer
+  * @brief Allocates the buffer with the buffer hook of the allocator
   * @param fp[IN] IO_FileDescriptor* object
   * @param begin[IN] First sector
   * @param size[IN] Size of the buffer (in bytes)
   * @retval FRESULT
+  * @note The buffer is aligned on IO_BUFFER_ALIGN bytes, and ends on a IO_BUFFER_ALIGN boundary
+  * @note Least recently used buffers of other files are evicted to stay within the memory budget
   */
 static FRESULT alloc_buffer(IO_FileDescriptor* fp, UINT begin, UINT size)
 {
+	size_t blockSize;
+
 	if (fp == NULL)
 	{
 		return FR_INVALID_OBJECT;
@@ -632,7 +1647,29 @@ static FRESULT alloc_buffer(IO_FileDescriptor* fp, UINT begin, UINT size)
 		return FR_INVALID_PARAMETER;
 	}
 	
-	fp->buffer = malloc(size * sizeof(uint8_t));
+	fp->buffer = NULL;
+	fp->bufferBlock = NULL;
+	blockSize = ((size + IO_BUFFER_ALIGN - 1) & ~(UINT)(IO_BUFFER_ALIGN - 1)) + IO_BUFFER_ALIGN - 1;
+	if (memory_reserve(blockSize) == FR_OK)
+	{
+		fp->bufferBlock = allocator.bufferAlloc(blockSize);
+	}
+	if (fp->bufferBlock == NULL)
+	{
+		fp->bufferSize = 0;
+		fp->bufferBegin = 0;
+		return FR_NOT_ENOUGH_CORE;
+	}
+	fp->buffer = (uint8_t*)(((uintptr_t)fp->bufferBlock + IO_BUFFER_ALIGN - 1) & ~(uintptr_t)(IO_BUFFER_ALIGN - 1));
+
+	// Count the buffer in the memory budget
+	fp->bufferBlockSize = blockSize;
+	memoryUsed += blockSize;
+	if (memoryUsed > memoryPeak)
+	{
+		memoryPeak = memoryUsed;
+	}
+	lru_insert(fp);
 	
 	return FR_OK;
 }
@@ -662,22 +1699,22 @@ static FRESULT buffer_specs(IO_FileDescriptor* fp, UINT bytes, UINT start, UINT*
 		return FR_INVALID_PARAMETER;
 	}
 	// Compute the begin and end sectors of the buffer to use:
-	if (((start / fp->ssize) * fp->ssize) > fp->actualFileSize)
+	if ((start & ~WIN_MASK(fp)) > fp->actualFileSize)
 	{
 		// If buffer starts after eof
-		begin_tmp = (uint64_t)(fp->actualFileSize / fp->ssize);
+		begin_tmp = (uint64_t)(fp->actualFileSize >> WIN_SHIFT(fp));
 	}
 	else
 	{
-		begin_tmp = start / fp->ssize;
+		begin_tmp = start >> WIN_SHIFT(fp);
 	}
 
-	end_tmp = (uint64_t)((uint64_t)start + (uint64_t)bytes - (uint64_t)1) / fp->ssize;
+	end_tmp = (uint64_t)((uint64_t)start + (uint64_t)bytes - (uint64_t)1) >> WIN_SHIFT(fp);
 	
 	/* It's not a issue if the buffer ends after the file ending thanks
 	 * to actualSize field in IO_FileDescriptor
 	 */
-	size_tmp = (end_tmp - begin_tmp + (uint64_t)1) * fp->ssize;
+	size_tmp = (end_tmp - begin_tmp + (uint64_t)1) << WIN_SHIFT(fp);
 	
 	if (size_tmp > MAX_BUFFER_SIZE)
 	{
@@ -692,67 +1729,278 @@ static FRESULT buffer_specs(IO_FileDescriptor* fp, UINT bytes, UINT start, UINT*
 }
 
 /**
-  * @brief Checks if the buffer with appropriate specs already exists
+  * @brief Enlarges the buffer to read windows in advance
   * @param fp[IN] IO_FileDescriptor* object
-  * @param begin[IN] First sector
-  * @param size[IN] Size of the buffer (in bytes)
-  * @retval 2 if the perfect buffer exists, 1 if the buffer exists but its contents end too soon, 0 else
+  * @param begin[IN] First window of the buffer
+  * @param size[IN/OUT] Size of the buffer (in bytes)
+  * @retval None
+  * @note The buffer doesn't go over MAX_BUFFER_SIZE, nor over the window holding the end of the file
   */
-static uint8_t buffer_exists(IO_FileDescriptor* fp, UINT begin, UINT size)
+static void readahead_specs(IO_FileDescriptor* fp, UINT begin, UINT* size)
 {
-	if (fp->buffer == NULL)
+	uint64_t end = (uint64_t)begin + (*size >> WIN_SHIFT(fp)) + readahead_windows(fp);
+	uint64_t lastWindow;
+
+	if (fp->actualFileSize == 0)
 	{
-		// No buffer allocated
-		return 0;
+		return;
 	}
-	if (begin < fp->bufferBegin)
+	lastWindow = (uint64_t)((fp->actualFileSize - 1) >> WIN_SHIFT(fp));
+	if (begin > lastWindow)
 	{
-		// Buffer allocated but its contents start too far in the file system
-		return 0;
+		return;
 	}
-	if (size + begin * fp->ssize > fp->bufferSize + fp->bufferBegin * fp->ssize)
+	if (end > lastWindow + 1)
 	{
-		// Buffer allocated but it ends too soon in the file system
-		return 0;
+		end = lastWindow + 1;
 	}
-	if (size + begin * fp->ssize > fp->actualSize + fp->bufferBegin * fp->ssize)
+	if (((end - begin) << WIN_SHIFT(fp)) > MAX_BUFFER_SIZE)
 	{
-		// Buffer allocated but its actual contents end too soon in the file system
-		return 1;
+		end = begin + (MAX_BUFFER_SIZE >> WIN_SHIFT(fp));
+	}
+	if (((end - begin) << WIN_SHIFT(fp)) > *size)
+	{
+		*size = (UINT)((end - begin) << WIN_SHIFT(fp));
 	}
-	return 2;
 }
 
 /**
-  * @brief Calls f_write on cached data
-  * @param fp[IN] Pointer to the file IO_FileDescriptor* object structure
-  * @retval FRESULT
+  * @brief Number of windows read in advance, according to the options and io_advise hints
+  * @param fp[IN] IO_FileDescriptor* object
+  * @retval Number of windows
   */
-static FRESULT write_cache(IO_FileDescriptor* fp)
+static UINT readahead_windows(IO_FileDescriptor* fp)
 {
-	uint32_t byteswritten = 0;
-	FRESULT res = FR_OK;
-
-	if ((fp == NULL)|| (fp->isOpen == 0))
+	if (fp->advice == IO_ADVICE_RANDOM)
 	{
-		return FR_INVALID_OBJECT;
+		return 0;
 	}
-
-	if (fp->unsavedData)
+	if ((fp->advice == IO_ADVICE_SEQUENTIAL) && (fp->readAhead == 0))
 	{
-		FSIZE_t newSize;
-		
+		return 1;
+	}
+	return fp->readAhead;
+}
+
+/**
+  * @brief Enlarges a write buffer to the whole write units holding it
+  * @param fp[IN] IO_FileDescriptor* object
+  * @param begin[IN/OUT] First window of the buffer
+  * @param end[IN] Last window of the buffer
+  * @param size[IN/OUT] Size of the buffer (in bytes)
+  * @retval None
+  * @note The buffer is left unchanged if it would go over MAX_BUFFER_SIZE, or if the window is bigger than the unit
+  */
+static void writeunit_specs(IO_FileDescriptor* fp, UINT* begin, UINT end, UINT* size)
+{
+	UINT unitMask;
+	uint64_t first;
+	uint64_t last;
+
+	if (fp->writeUnit <= fp->ssize)
+	{
+		return;
+	}
+	unitMask = (fp->writeUnit >> WIN_SHIFT(fp)) - 1;
+	first = *begin & ~unitMask;
+	last = end | unitMask;
+	if (((last - first + 1) << WIN_SHIFT(fp)) > MAX_BUFFER_SIZE)
+	{
+		return;
+	}
+	*begin = (UINT)first;
+	*size = (UINT)((last - first + 1) << WIN_SHIFT(fp));
+}
+
+/**
+  * @brief Counts a flush of modified data in the statistics
+  * @param fp[IN] IO_FileDescriptor* object
+  * @retval None
+  */
+static void flush_record(IO_FileDescriptor* fp)
+{
+	fp->stats.flushes++;
+	if ((fp->writeUnit != 0) && (fp->actualSize >= fp->writeUnit)
+		&& ((((FSIZE_t)fp->bufferBegin << WIN_SHIFT(fp)) & (fp->writeUnit - 1)) == 0))
+	{
+		fp->stats.unitFlushes++;
+	}
+}
+
+/**
+  * @brief Records a io_read/io_write call, and chooses the window size at the end of each period
+  * @param fp[IN] IO_FileDescriptor* object
+  * @param position[IN] Position of the first byte of the call
+  * @param bytes[IN] Number of bytes of the call
+  * @param hit[IN] Bool telling if the call was served by the existing buffer
+  * @retval None
+  * @note Sequential access doubles the window, random small requests missing the buffer halve it
+  */
+static void autotune_record(IO_FileDescriptor* fp, UINT position, UINT bytes, uint8_t hit)
+{
+	UINT window;
+
+	fp->stats.requests++;
+	fp->periodRequests++;
+	fp->periodBytes += bytes;
+	if (hit)
+	{
+		fp->stats.hits++;
+		fp->periodHits++;
+	}
+	if (position == fp->rwPointer)
+	{
+		fp->stats.sequential++;
+		fp->periodSequential++;
+	}
+
+	if (fp->periodRequests < IO_AUTOTUNE_PERIOD)
+	{
+		return;
+	}
+
+	// End of the period
+	fp->stats.averageRequest = fp->periodBytes / fp->periodRequests;
+	fp->stats.sequentialPercent = (uint8_t)((fp->periodSequential * 100) / fp->periodRequests);
+	fp->stats.hitPercent = (uint8_t)((fp->periodHits * 100) / fp->periodRequests);
+	fp->periodRequests = 0;
+	fp->periodSequential = 0;
+	fp->periodHits = 0;
+	fp->periodBytes = 0;
+
+	if (fp->autoTune == 0)
+	{
+		return;
+	}
+
+	window = (UINT)1 << fp->targetShift;
+	if ((fp->stats.sequentialPercent >= 75) && ((window << 1) <= MAX_BUFFER_SIZE) && (window < fp->actualFileSize))
+	{
+		// Streaming: fewer and bigger transfers
+		fp->targetShift++;
+		fp->stats.grows++;
+	}
+	else if ((fp->stats.sequentialPercent <= 25) && (fp->stats.hitPercent < 50)
+		&& (fp->stats.averageRequest <= (window >> 1)) && (fp->targetShift > fp->minShift))
+	{
+		// Random access: don't read data that won't be used
+		fp->targetShift--;
+		fp->stats.shrinks++;
+	}
+}
+
+/**
+  * @brief Uses the window size chosen by auto-tuning
+  * @param fp[IN] IO_FileDescriptor* object (without buffer)
+  * @retval 1 if the window size changed, 0 else
+  */
+static uint8_t autotune_apply(IO_FileDescriptor* fp)
+{
+	if ((fp->buffer != NULL) || (fp->targetShift == fp->ssizeShift))
+	{
+		return 0;
+	}
+	fp->ssizeShift = fp->targetShift;
+	fp->ssize = (UINT)1 << fp->ssizeShift;
+	return 1;
+}
+
+/**
+  * @brief Checks if the buffer with appropriate specs already exists
+  * @param fp[IN] IO_FileDescriptor* object
+  * @param begin[IN] First sector
+  * @param size[IN] Size of the buffer (in bytes)
+  * @retval 2 if the perfect buffer exists, 1 if the buffer exists but its contents end too soon, 0 else
+  */
+static uint8_t buffer_exists(IO_FileDescriptor* fp, UINT begin, UINT size)
+{
+	if (fp->buffer == NULL)
+	{
+		// No buffer allocated
+		return 0;
+	}
+	if (begin < fp->bufferBegin)
+	{
+		// Buffer allocated but its contents start too far in the file system
+		return 0;
+	}
+	if (size + (begin << WIN_SHIFT(fp)) > fp->bufferSize + (fp->bufferBegin << WIN_SHIFT(fp)))
+	{
+		// Buffer allocated but it ends too soon in the file system
+		return 0;
+	}
+	if (size + (begin << WIN_SHIFT(fp)) > fp->actualSize + (fp->bufferBegin << WIN_SHIFT(fp)))
+	{
+		// Buffer allocated but its actual contents end too soon in the file system
+		return 1;
+	}
+	return 2;
+}
+
+/**
+  * @brief Calls f_write on cached data
+  * @param fp[IN] Pointer to the file IO_FileDescriptor* object structure
+  * @retval FRESULT
+  */
+static FRESULT write_cache(IO_FileDescriptor* fp)
+{
+	uint32_t byteswritten = 0;
+	FRESULT res = FR_OK;
+
+	if ((fp == NULL)|| (fp->isOpen == 0))
+	{
+		return FR_INVALID_OBJECT;
+	}
+
+	if (fp->unsavedData)
+	{
+		FSIZE_t newSize;
+		
 		res = io_size(fp, &newSize);
 		if (res != FR_OK)
 		{
 			return res;
 		}
+
+#if IO_USE_DIRECT_LBA
+		if (direct_window(fp))
+		{
+			// FatFs only has to know the new file size
+			if (newSize > fp->diskFileSize)
+			{
+				res = preallocate(fp, newSize);
+				if (res != FR_OK)
+				{
+					return res;
+				}
+			}
+
+			// The cluster link map table may have been lost when the file grew
+			if (direct_window(fp))
+			{
+				res = direct_write(fp, (FSIZE_t)fp->bufferBegin << WIN_SHIFT(fp), fp->buffer, (fp->actualSize + SECTOR_MASK(fp)) >> SECTOR_SHIFT(fp));
+				if (res != FR_OK)
+				{
+					return res;
+				}
+				flush_record(fp);
+				fp->unsavedData = 0;
+				return FR_OK;
+			}
+		}
+
+		// FatFs will allocate new clusters, that may not be contiguous
+		fp->directSector = 0;
+#endif
 		
 		// Pre-allocate space (and automatically stop if disk is full)
-		res = preallocate(fp, newSize);
+		if (newSize > fp->allocatedSize)
+		{
+			res = preallocate(fp, newSize);
+		}
 
 		// Reposition the read/write pointer
-		res = seek(fp, fp->bufferBegin * fp->ssize);
+		res = seek(fp, fp->bufferBegin << WIN_SHIFT(fp));
 		if (res != FR_OK)
 		{
 			return res;
@@ -768,17 +2016,102 @@ static FRESULT write_cache(IO_FileDescriptor* fp)
 		res = f_write(fp->file, fp->buffer, fp->actualSize, (UINT*)&byteswritten);
 		if (res != FR_OK)
 		{
+			fp->fatfsPointerValid = 0;
 			return res;
 		}
-		else if (byteswritten != fp->actualSize)
+		fp->fatfsPointer += byteswritten;
+		if (fp->fatfsPointer > fp->diskFileSize)
+		{
+			set_disk_size(fp, fp->fatfsPointer);
+		}
+		if (byteswritten != fp->actualSize)
 		{
 			return FR_INT_ERR;
 		}
+		flush_record(fp);
 		fp->unsavedData = 0;
 	}
 	return res;
 }
 
+/**
+  * @brief Fills the buffer with data from the disk
+  * @param fp[IN] Pointer to the file IO_FileDescriptor* object structure
+  * @param bytesread[OUT] Number of bytes read
+  * @retval FRESULT
+  * @note Unsaved data is written before
+  */
+static FRESULT read_cache(IO_FileDescriptor* fp, UINT* bytesread)
+{
+	FRESULT res;
+	FSIZE_t start;
+
+	*bytesread = 0;
+
+	if ((fp == NULL)|| (fp->isOpen == 0) || (fp->buffer == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+
+	// Don't lose modifications
+	res = write_cache(fp);
+	if (res != FR_OK)
+	{
+		return res;
+	}
+
+	start = (FSIZE_t)fp->bufferBegin << WIN_SHIFT(fp);
+
+#if IO_USE_DIRECT_LBA
+	if (direct_window(fp))
+	{
+		if (start < fp->diskFileSize)
+		{
+			*bytesread = fp->bufferSize;
+			if (start + *bytesread > fp->diskFileSize)
+			{
+				*bytesread = (UINT)(fp->diskFileSize - start);
+			}
+			res = direct_read(fp, start, fp->buffer, (*bytesread + SECTOR_MASK(fp)) >> SECTOR_SHIFT(fp));
+			if (res != FR_OK)
+			{
+				*bytesread = 0;
+			}
+		}
+	}
+	else
+#endif
+	{
+		// Move the read/write pointer to the correct place
+		res = seek(fp, start);
+		if (res != FR_OK)
+		{
+			return res;
+		}
+
+		res = f_read(fp->file, fp->buffer, fp->bufferSize, bytesread);
+		if (res == FR_OK)
+		{
+			fp->fatfsPointer += *bytesread;
+		}
+		else
+		{
+			fp->fatfsPointerValid = 0;
+		}
+	}
+
+	// Update actualSize
+	if (fp->actualSize < *bytesread)
+	{
+		fp->actualSize = *bytesread;
+		if (fp->actualSize + start > fp->actualFileSize)
+		{
+			fp->actualFileSize = fp->actualSize + start;
+		}
+	}
+	return res;
+}
+
 /**
   * @brief Write data on the cache
   * @param fp[IN] Pointer to the file IO_FileDescriptor* object structure
@@ -797,7 +2130,7 @@ static FRESULT modif_cache(IO_FileDescriptor* fp, const void* data, UINT positio
 		return FR_INVALID_OBJECT;
 	}
 
-	offset = position - fp->bufferBegin * fp->ssize;
+	offset = position - (fp->bufferBegin << WIN_SHIFT(fp));
 
 	while (offset > fp->actualSize)
 	{
@@ -813,13 +2146,14 @@ static FRESULT modif_cache(IO_FileDescriptor* fp, const void* data, UINT positio
 		fp->actualSize = offset + btw;
 	}
 
-	if (fp->actualSize + fp->bufferBegin * fp->ssize > fp->actualFileSize)
+	if (fp->actualSize + (fp->bufferBegin << WIN_SHIFT(fp)) > fp->actualFileSize)
 	{
-		fp->actualFileSize = fp->actualSize + fp->bufferBegin * fp->ssize;
+		fp->actualFileSize = fp->actualSize + (fp->bufferBegin << WIN_SHIFT(fp));
 	}
 
 	memcpy((void *)(fp->buffer + offset), data, btw);
 	fp->rwPointer = *bw + position;
+	lru_touch(fp);
 	return FR_OK;
 }
 
@@ -845,8 +2179,12 @@ static FRESULT free_buffer(IO_FileDescriptor* fp, uint8_t ignoreWriteErrors)
 		{
 			return res;
 		}
-		free(fp->buffer);
+		allocator.bufferFree(fp->bufferBlock);
+		lru_remove(fp);
+		memoryUsed -= fp->bufferBlockSize;
 		fp->buffer = NULL;
+		fp->bufferBlock = NULL;
+		fp->bufferBlockSize = 0;
 	}
 	fp->bufferBegin = 0;
 	fp->bufferSize = 0;
@@ -861,18 +2199,40 @@ static FRESULT free_buffer(IO_FileDescriptor* fp, uint8_t ignoreWriteErrors)
   * @param fp[IN] Pointer to the file IO_FileDescriptor* object structure
   * @param ofs[in] New read/write pointer
   * @retval FRESULT
+  * @note f_lseek isn't called if FatFs pointer is already at the right place
   */
 static FRESULT seek(IO_FileDescriptor* fp, FSIZE_t ofs)
 {
+	FRESULT res;
+
 	if ((fp == NULL)|| (fp->isOpen == 0))
 	{
 		return FR_INVALID_OBJECT;
 	}
+
+	if ((fp->fatfsPointerValid != 0) && (fp->fatfsPointer == ofs))
+	{
+		// Nothing to do, and f_lseek may have to walk the cluster chain
+		fp->seeksAvoided += 1;
+		return FR_OK;
+	}
+
 	if (_FS_MINIMIZE > 2)
 	{
 		return FR_DENIED;
 	}
-	return f_lseek(fp->file, ofs);
+
+	res = f_lseek(fp->file, ofs);
+	if (res != FR_OK)
+	{
+		fp->fatfsPointerValid = 0;
+		return res;
+	}
+
+	// FatFs may stop before ofs when expanding the file (when the disk is full for example)
+	fp->fatfsPointer = (ofs <= fp->diskFileSize) ? ofs : f_tell(fp->file);
+	fp->fatfsPointerValid = 1;
+	return FR_OK;
 }
 
 /**
@@ -884,32 +2244,200 @@ static IO_FileDescriptor* allocFileDescriptor()
 	IO_FileDescriptor* fp = NULL;
 	
 	// Allocate file object structures :
-	fp = malloc(sizeof(IO_FileDescriptor));
+	fp = allocator.descriptorAlloc(sizeof(IO_FileDescriptor));
 	if (fp == NULL)
 	{
 		return NULL;
 	}
 	
-	fp->file = malloc(sizeof(FIL));
+	fp->file = allocator.descriptorAlloc(sizeof(FIL));
 	if (fp->file == NULL)
 	{
-		free(fp);
+		allocator.descriptorFree(fp);
 		return NULL;
 	}
+#if _USE_FASTSEEK
+	fp->file->cltbl = NULL;
+#endif
 	
 	// Initialize everything:
 	fp->buffer = NULL;
+	fp->bufferBlock = NULL;
+	fp->bufferBlockSize = 0;
+	fp->lruPrev = NULL;
+	fp->lruNext = NULL;
 	fp->bufferBegin = 0;
 	fp->bufferSize = 0;
 	fp->unsavedData = 0;
 	fp->actualSize = 0;
 	fp->actualFileSize = 0;
+	fp->diskFileSize = 0;
+	fp->allocatedSize = 0;
+	fp->clusterSize = 0;
+	fp->directSector = 0;
+	fp->directSize = 0;
 	fp->rwPointer = 0;
+	fp->fatfsPointer = 0;
+	fp->fatfsPointerValid = 0;
+	fp->seeksAvoided = 0;
+	fp->ssize = 0;
+	fp->ssizeShift = 0;
+	fp->sectorShift = 0;
+	fp->readAhead = 0;
+	fp->writeBack = IO_WRITE_BACK;
+	fp->writeUnit = 0;
+	fp->autoTune = 0;
+	fp->advice = IO_ADVICE_NORMAL;
+	fp->targetShift = 0;
+	fp->minShift = 0;
+	fp->periodRequests = 0;
+	fp->periodSequential = 0;
+	fp->periodHits = 0;
+	fp->periodBytes = 0;
+	memset(&fp->stats, 0, sizeof(IO_Stats));
+	fp->linkMap = NULL;
+	fp->linkMapSize = 0;
 	fp->isOpen = 0;
 	
 	return fp;
 }
 
+/**
+  * @brief Default buffer allocation hook
+  * @param size[IN] Size of the memory block (in bytes)
+  * @retval Pointer to the memory block, NULL in case of error
+  */
+static void* default_buffer_alloc(size_t size)
+{
+	return IO_BUFFER_MALLOC(size);
+}
+
+/**
+  * @brief Default buffer free hook
+  * @param ptr[IN] Pointer to the memory block
+  * @retval None
+  */
+static void default_buffer_free(void* ptr)
+{
+	IO_BUFFER_FREE(ptr);
+}
+
+/**
+  * @brief Adds a buffer at the beginning of the list of buffers (most recently used one)
+  * @param fp[IN] Pointer to the file IO_FileDescriptor* object structure
+  * @retval None
+  */
+static void lru_insert(IO_FileDescriptor* fp)
+{
+	fp->lruPrev = NULL;
+	fp->lruNext = lruHead;
+	if (lruHead != NULL)
+	{
+		lruHead->lruPrev = fp;
+	}
+	lruHead = fp;
+	if (lruTail == NULL)
+	{
+		lruTail = fp;
+	}
+}
+
+/**
+  * @brief Adds a buffer at the end of the list of buffers (least recently used one)
+  * @param fp[IN] Pointer to the file IO_FileDescriptor* object structure
+  * @retval None
+  */
+static void lru_append(IO_FileDescriptor* fp)
+{
+	fp->lruPrev = lruTail;
+	fp->lruNext = NULL;
+	if (lruTail != NULL)
+	{
+		lruTail->lruNext = fp;
+	}
+	lruTail = fp;
+	if (lruHead == NULL)
+	{
+		lruHead = fp;
+	}
+}
+
+/**
+  * @brief Removes a buffer from the list of buffers
+  * @param fp[IN] Pointer to the file IO_FileDescriptor* object structure
+  * @retval None
+  */
+static void lru_remove(IO_FileDescriptor* fp)
+{
+	if (fp->lruPrev != NULL)
+	{
+		fp->lruPrev->lruNext = fp->lruNext;
+	}
+	else if (lruHead == fp)
+	{
+		lruHead = fp->lruNext;
+	}
+	if (fp->lruNext != NULL)
+	{
+		fp->lruNext->lruPrev = fp->lruPrev;
+	}
+	else if (lruTail == fp)
+	{
+		lruTail = fp->lruPrev;
+	}
+	fp->lruPrev = NULL;
+	fp->lruNext = NULL;
+}
+
+/**
+  * @brief Marks a buffer as the most recently used one
+  * @param fp[IN] Pointer to the file IO_FileDescriptor* object structure
+  * @retval None
+  * @note With IO_ADVICE_NOREUSE, the buffer becomes the least recently used one, so that it's evicted first
+  */
+static void lru_touch(IO_FileDescriptor* fp)
+{
+	if (fp->buffer == NULL)
+	{
+		return;
+	}
+	if (fp->advice == IO_ADVICE_NOREUSE)
+	{
+		if (lruTail != fp)
+		{
+			lru_remove(fp);
+			lru_append(fp);
+		}
+	}
+	else if (lruHead != fp)
+	{
+		lru_remove(fp);
+		lru_insert(fp);
+	}
+}
+
+/**
+  * @brief Evicts least recently used buffers until a new buffer fits in the memory budget
+  * @param size[IN] Size of the new buffer (in bytes)
+  * @retval FRESULT: FR_NOT_ENOUGH_CORE if the new buffer can't fit in the budget
+  */
+static FRESULT memory_reserve(size_t size)
+{
+	if (memoryBudget == 0)
+	{
+		return FR_OK;
+	}
+	if (size > memoryBudget)
+	{
+		return FR_NOT_ENOUGH_CORE;
+	}
+	if (memoryUsed + size > memoryBudget)
+	{
+		io_trim_memory(memoryBudget - size);
+	}
+	return (memoryUsed + size <= memoryBudget) ? FR_OK : FR_NOT_ENOUGH_CORE;
+}
+
 /**
   * @brief Preallocates space for the file
   * @param fp[IN] Pointer to the file IO_FileDescriptor* object structure
@@ -925,18 +2453,705 @@ static FRESULT preallocate(IO_FileDescriptor* fp, FSIZE_t size)
 		return FR_INVALID_OBJECT;
 	}
 
-	if (size <= f_size(fp->file))
+	if (size <= fp->diskFileSize)
 	{
 		return FR_OK;
 	}
 	
+	// FatFs can't expand a file in fast seek mode
+#if _USE_FASTSEEK
+	fp->file->cltbl = NULL;
+#endif
+
 	// FatFs pre-allocates space thanks to this line :
 	res = seek(fp, size);
-	if (res != FR_OK)
+	if (res == FR_OK)
 	{
-		return res;
+		// Update file size (use FatFs pointer instead of size argument in case disk if full):
+		set_disk_size(fp, fp->fatfsPointer);
+		fp->actualFileSize = fp->fatfsPointer;
+	}
+
+	// New clusters must be added to the cluster link map table
+	if (fp->linkMap != NULL)
+	{
+		linkmap_build(fp);
+	}
+	return res;
+}
+
+/**
+  * @brief Updates file size known by FatFs, and the size of allocated clusters
+  * @param fp[IN] Pointer to the file IO_FileDescriptor* object structure
+  * @param size[in] File size on the disk
+  * @retval None
+  */
+static void set_disk_size(IO_FileDescriptor* fp, FSIZE_t size)
+{
+	uint64_t allocated = size;
+
+	fp->diskFileSize = size;
+
+	// FatFs allocates whole clusters
+	if (fp->clusterSize != 0)
+	{
+		allocated = ((allocated + fp->clusterSize - 1) / fp->clusterSize) * fp->clusterSize;
+	}
+	if (allocated > (FSIZE_t)-1)
+	{
+		allocated = (FSIZE_t)-1;
+	}
+	fp->allocatedSize = (FSIZE_t)allocated;
+}
+
+/**
+  * @brief Builds the cluster link map table used by FatFs fast seek, and enables fast seek
+  * @param fp[IN] Pointer to the file IO_FileDescriptor* object structure
+  * @retval FRESULT
+  * @note The table is enlarged as much as needed. If it fails, fast seek is disabled.
+  */
+static FRESULT linkmap_build(IO_FileDescriptor* fp)
+{
+#if _USE_FASTSEEK
+	FRESULT res;
+	UINT size;
+
+	if ((fp == NULL)|| (fp->isOpen == 0))
+	{
+		return FR_INVALID_OBJECT;
+	}
+
+	fp->file->cltbl = NULL;
+	size = (fp->linkMap != NULL) ? fp->linkMapSize : IO_LINKMAP_SIZE;
+
+	for (;;)
+	{
+		if ((fp->linkMap == NULL) || (size > fp->linkMapSize))
+		{
+			// Contents of the old table are useless
+			allocator.descriptorFree(fp->linkMap);
+			fp->linkMapSize = 0;
+			fp->linkMap = allocator.descriptorAlloc(size * sizeof(DWORD));
+			if (fp->linkMap == NULL)
+			{
+				return FR_NOT_ENOUGH_CORE;
+			}
+			fp->linkMapSize = size;
+		}
+
+		fp->linkMap[0] = fp->linkMapSize;
+		fp->file->cltbl = fp->linkMap;
+		res = f_lseek(fp->file, CREATE_LINKMAP);
+		if (res != FR_NOT_ENOUGH_CORE)
+		{
+			break;
+		}
+
+		// The table is too small, FatFs gave the required size
+		fp->file->cltbl = NULL;
+		if (fp->linkMap[0] <= fp->linkMapSize)
+		{
+			break;
+		}
+		size = fp->linkMap[0];
+	}
+
+	if (res != FR_OK)
+	{
+		linkmap_free(fp);
+	}
+	return res;
+#else
+	(void)fp;
+	return FR_DENIED;
+#endif
+}
+
+/**
+  * @brief Disables fast seek and frees the cluster link map table
+  * @param fp[IN] Pointer to the file IO_FileDescriptor* object structure
+  * @retval None
+  */
+static void linkmap_free(IO_FileDescriptor* fp)
+{
+#if _USE_FASTSEEK
+	fp->file->cltbl = NULL;
+#endif
+	allocator.descriptorFree(fp->linkMap);
+	fp->linkMap = NULL;
+	fp->linkMapSize = 0;
+}
+
+/**
+  * @brief Tells if data sectors are found with the cluster link map table (see IO_TINY_CACHE)
+  * @param fp[IN] Pointer to the file IO_FileDescriptor* object structure
+  * @retval 1 if disk functions are used for the whole file, 0 else
+  */
+static uint8_t direct_mapped(IO_FileDescriptor* fp)
+{
+#if IO_MAPPED_LBA
+	return (fp->linkMap != NULL) && (fp->file->cltbl == fp->linkMap);
+#else
+	(void)fp;
+	return 0;
+#endif
+}
+
+#if IO_USE_DIRECT_LBA
+/**
+  * @brief Computes the first sector of a contiguous file, so that disk functions can be used directly
+  * @param fp[IN] Pointer to the file IO_FileDescriptor* object structure
+  * @param check[IN] Bool telling if the function must check that the file is contiguous
+  * @retval None
+  * @note Nothing is done if the file is empty or fragmented
+  */
+static void direct_enable(IO_FileDescriptor* fp, uint8_t check)
+{
+	FATFS* fs;
+
+	fp->directSector = 0;
+	fp->directSize = 0;
+
+	if (fp->file->obj.sclust < 2)
+	{
+		// No cluster allocated
+		return;
+	}
+
+	if (check != 0)
+	{
+#if _USE_FASTSEEK
+		// A contiguous file only needs one fragment in its cluster link map table
+		DWORD table[4];
+		DWORD* saved = fp->file->cltbl;
+		FRESULT res;
+
+		table[0] = sizeof(table) / sizeof(DWORD);
+		fp->file->cltbl = table;
+		res = f_lseek(fp->file, CREATE_LINKMAP);
+		fp->file->cltbl = saved;
+		if (res != FR_OK)
+		{
+			return;
+		}
+#else
+		return;
+#endif
+	}
+
+	fs = fp->file->obj.fs;
+	fp->directSector = fs->database + (fp->file->obj.sclust - 2) * fs->csize;
+	fp->directSize = fp->allocatedSize;
+}
+
+/**
+  * @brief Tells if the buffer is in the contiguous area of the file, or if the file is mapped
+  * @param fp[IN] Pointer to the file IO_FileDescriptor* object structure
+  * @retval 1 if disk functions can be used to read/write the buffer, 0 else
+  */
+static uint8_t direct_window(IO_FileDescriptor* fp)
+{
+	if ((fp->directSector != 0) && (((FSIZE_t)fp->bufferBegin << WIN_SHIFT(fp)) + fp->bufferSize <= fp->directSize))
+	{
+		return 1;
+	}
+
+	// Clusters allocated to the file can be found anywhere
+	return direct_mapped(fp);
+}
+
+/**
+  * @brief Tells if disk functions are used to read/write the file
+  * @param fp[IN] Pointer to the file IO_FileDescriptor* object structure
+  * @retval 1 if the file is contiguous or mapped, 0 else
+  */
+static uint8_t direct_active(IO_FileDescriptor* fp)
+{
+	return (fp->directSector != 0) || direct_mapped(fp);
+}
+
+/**
+  * @brief Tells if the buffer must be filled before writing data in it
+  * @param fp[IN] Pointer to the file IO_FileDescriptor* object structure
+  * @param position[IN] Position of the first byte to write in the file
+  * @param btw[IN] Number of bytes to write
+  * @retval 1 if the buffer must be filled, 0 else
+  * @note Whole sectors are written on the disk, so the end of the last sector must be known
+  */
+static uint8_t direct_needs_fill(IO_FileDescriptor* fp, UINT position, UINT btw)
+{
+	FSIZE_t validEnd;
+	FSIZE_t writeEnd = (FSIZE_t)position + btw;
+
+	if (!direct_active(fp))
+	{
+		return 0;
+	}
+
+	validEnd = ((FSIZE_t)fp->bufferBegin << WIN_SHIFT(fp)) + fp->actualSize;
+	if ((writeEnd <= validEnd) || (validEnd >= fp->diskFileSize))
+	{
+		// Nothing unknown in the file
+		return 0;
+	}
+	if (position > validEnd)
+	{
+		// File data between validEnd and position
+		return 1;
+	}
+	return ((writeEnd & SECTOR_MASK(fp)) != 0) && (writeEnd < fp->diskFileSize);
+}
+
+/**
+  * @brief Finds the disk sectors holding data of the file
+  * @param fp[IN] Pointer to the file IO_FileDescriptor* object structure
+  * @param position[IN] Position of the first sector in the file (in bytes)
+  * @param count[IN] Number of sectors
+  * @param sector[OUT] First sector on the disk
+  * @retval Number of consecutive sectors on the disk (at most count), 0 if the sector isn't allocated
+  */
+static UINT direct_map(IO_FileDescriptor* fp, FSIZE_t position, UINT count, DWORD* sector)
+{
+	FSIZE_t run;
+
+	if ((fp->directSector != 0) && (position < fp->directSize))
+	{
+		*sector = fp->directSector + (DWORD)(position >> SECTOR_SHIFT(fp));
+		run = (fp->directSize - position) >> SECTOR_SHIFT(fp);
+		return (run < count) ? (UINT)run : count;
+	}
+
+#if IO_MAPPED_LBA
+	if (direct_mapped(fp) && (position < fp->allocatedSize))
+	{
+		// Same walk as FatFs clmt_clust(): the table is a list of (number of clusters, first cluster) pairs
+		FATFS* fs = fp->file->obj.fs;
+		DWORD* tbl = fp->linkMap + 1;
+		DWORD fileSector = (DWORD)(position >> SECTOR_SHIFT(fp));
+		DWORD cl = fileSector / fs->csize;
+		DWORD ncl;
+
+		for (;;)
+		{
+			ncl = *tbl++;
+			if (ncl == 0)
+			{
+				return 0;
+			}
+			if (cl < ncl)
+			{
+				break;
+			}
+			cl -= ncl;
+			tbl++;
+		}
+
+		*sector = fs->database + (*tbl + cl - 2) * fs->csize + fileSector % fs->csize;
+		run = (FSIZE_t)(ncl - cl) * fs->csize - fileSector % fs->csize;
+		return (run < count) ? (UINT)run : count;
+	}
+#endif
+
+	return 0;
+}
+
+/**
+  * @brief Reads sectors of a contiguous or mapped file with disk_read
+  * @param fp[IN] Pointer to the file IO_FileDescriptor* object structure
+  * @param position[IN] Position of the first sector in the file (in bytes)
+  * @param data[OUT] Data read
+  * @param count[IN] Number of sectors
+  * @retval FRESULT
+  */
+static FRESULT direct_read(IO_FileDescriptor* fp, FSIZE_t position, BYTE* data, UINT count)
+{
+	DWORD sector;
+	UINT run;
+
+	while (count > 0)
+	{
+		run = direct_map(fp, position, count, &sector);
+		if (run == 0)
+		{
+			return FR_INT_ERR;
+		}
+		if (disk_read(fp->file->obj.fs->drv, data, sector, run) != RES_OK)
+		{
+			return FR_DISK_ERR;
+		}
+
+#if _FS_TINY
+		{
+			// FatFs window may hold unsaved data of one of these sectors (written by f_write)
+			FATFS* fs = fp->file->obj.fs;
+			if ((fs->wflag != 0) && (fs->winsect >= sector) && (fs->winsect - sector < run))
+			{
+				memcpy(data + ((fs->winsect - sector) << SECTOR_SHIFT(fp)), fs->win, (size_t)1 << SECTOR_SHIFT(fp));
+			}
+		}
+#endif
+
+		position += (FSIZE_t)run << SECTOR_SHIFT(fp);
+		data += (size_t)run << SECTOR_SHIFT(fp);
+		count -= run;
 	}
-	// Update file size (use f_tell instead of size argument in case disk if full):
-	fp->actualFileSize = f_tell(fp->file);
 	return FR_OK;
 }
+
+/**
+  * @brief Writes sectors of a contiguous or mapped file with disk_write
+  * @param fp[IN] Pointer to the file IO_FileDescriptor* object structure
+  * @param position[IN] Position of the first sector in the file (in bytes)
+  * @param data[IN] Data to write
+  * @param count[IN] Number of sectors
+  * @retval FRESULT
+  * @note If FatFs has a copy of one of these sectors, the copy is updated (it stays clean)
+  * @note The file is marked as modified, as f_write would do, so that f_sync updates its directory entry
+  */
+static FRESULT direct_write(IO_FileDescriptor* fp, FSIZE_t position, const BYTE* data, UINT count)
+{
+	DWORD sector;
+	DWORD cached;
+	BYTE* copy;
+	UINT run;
+
+	if (_FS_READONLY != 0)
+	{
+		return FR_DENIED;
+	}
+
+	while (count > 0)
+	{
+		run = direct_map(fp, position, count, &sector);
+		if (run == 0)
+		{
+			// Clusters couldn't be allocated (disk full)
+			return FR_DENIED;
+		}
+		if (disk_write(fp->file->obj.fs->drv, data, sector, run) != RES_OK)
+		{
+			return FR_DISK_ERR;
+		}
+
+#if _FS_TINY
+		cached = fp->file->obj.fs->winsect;
+		copy = fp->file->obj.fs->win;
+#else
+		cached = fp->file->sect;
+		copy = fp->file->buf;
+#endif
+		if ((cached >= sector) && (cached - sector < run))
+		{
+			memcpy(copy, data + ((cached - sector) << SECTOR_SHIFT(fp)), (size_t)1 << SECTOR_SHIFT(fp));
+		}
+
+		position += (FSIZE_t)run << SECTOR_SHIFT(fp);
+		data += (size_t)run << SECTOR_SHIFT(fp);
+		count -= run;
+		fp->file->flag |= FA_MODIFIED;
+	}
+	return FR_OK;
+}
+
+/**
+  * @brief Writes whole sectors of a contiguous or mapped file, without copying them in the buffer
+  * @param fp[IN] Pointer to the file IO_FileDescriptor* object structure
+  * @param buff[IN] Pointer to the data to be written
+  * @param position[IN] Position of the first byte to write in the file (sector aligned)
+  * @param btw[IN] Number of bytes to write (multiple of sector size)
+  * @param bw[OUT] Number of bytes written
+  * @retval FRESULT
+  */
+static FRESULT write_user_buffer(IO_FileDescriptor* fp, const void* buff, UINT position, UINT btw, UINT* bw)
+{
+	FRESULT res;
+	FSIZE_t start = (FSIZE_t)fp->bufferBegin << WIN_SHIFT(fp);
+	FSIZE_t end = (FSIZE_t)position + btw;
+
+	// The buffer must not keep old data, and it must be saved before changing file size
+	if ((fp->buffer != NULL) && (((start < end) && (start + fp->bufferSize > position)) || (end > fp->diskFileSize)))
+	{
+		res = free_buffer(fp, 0);
+		if (res != FR_OK)
+		{
+			return res;
+		}
+	}
+
+	if (end > fp->diskFileSize)
+	{
+		res = preallocate(fp, end);
+		if (res != FR_OK)
+		{
+			return res;
+		}
+		if (fp->diskFileSize < end)
+		{
+			return FR_DENIED;
+		}
+	}
+
+	res = direct_write(fp, position, (const BYTE*)buff, btw >> SECTOR_SHIFT(fp));
+	if (res != FR_OK)
+	{
+		return res;
+	}
+
+	*bw = btw;
+	fp->rwPointer = end;
+	return FR_OK;
+}
+#endif
+
+#if IO_DISCARD_AVAILABLE
+/**
+  * @brief Tells if the clusters freed on a volume must be known (to discard them, or to update the free-extent index)
+  * @param fs[IN] File system object, NULL for any volume
+  * @retval Bool
+  */
+static uint8_t release_tracked(FATFS* fs)
+{
+	if (discardEnabled != 0)
+	{
+		return 1;
+	}
+#if IO_EXTENT_INDEX_AVAILABLE
+	if ((extentState == EXTENT_VALID) && ((fs == NULL) || extent_valid(fs)))
+	{
+		return 1;
+	}
+#else
+	(void)fs;
+#endif
+	return 0;
+}
+
+/**
+  * @brief Tells the disk that freed clusters of a file are no longer used, and adds them to the free-extent index
+  * @param fs[IN] File system object
+  * @param linkMap[IN] Cluster link map table of the file, built before the clusters were freed
+  * @param first[IN] Index of the first freed cluster in the file
+  * @retval FRESULT: FR_DISK_ERR if the disk refused a request
+  * @note Consecutive fragments are merged, so that each contiguous range is discarded by one CTRL_TRIM request
+  */
+static FRESULT release_clusters(FATFS* fs, const DWORD* linkMap, DWORD first)
+{
+	const DWORD* tbl = linkMap + 1;
+	DWORD range[2] = {0, 0}; // First and last sectors, as expected by CTRL_TRIM
+	DWORD ncl;
+	DWORD clst;
+	DWORD sector;
+	uint8_t pending = 0;
+	FRESULT res = FR_OK;
+
+	for (ncl = *tbl++; ncl != 0; ncl = *tbl++)
+	{
+		clst = *tbl++;
+		if (first >= ncl)
+		{
+			// Fragment still used by the file
+			first -= ncl;
+			continue;
+		}
+		clst += first;
+		ncl -= first;
+		first = 0;
+#if IO_EXTENT_INDEX_AVAILABLE
+		if (extent_valid(fs))
+		{
+			extent_insert(clst, ncl);
+		}
+#endif
+		if (discardEnabled == 0)
+		{
+			continue;
+		}
+		sector = fs->database + (clst - 2) * fs->csize;
+
+		if ((pending != 0) && (range[1] + 1 == sector))
+		{
+			range[1] += ncl * fs->csize;
+			continue;
+		}
+		if ((pending != 0) && (disk_ioctl(fs->drv, CTRL_TRIM, range) != RES_OK))
+		{
+			res = FR_DISK_ERR;
+		}
+		range[0] = sector;
+		range[1] = sector + ncl * fs->csize - 1;
+		pending = 1;
+	}
+	if ((pending != 0) && (disk_ioctl(fs->drv, CTRL_TRIM, range) != RES_OK))
+	{
+		res = FR_DISK_ERR;
+	}
+	return res;
+}
+#endif
+
+#if IO_EXTENT_INDEX_AVAILABLE
+/**
+  * @brief Tells if the free-extent index describes a volume
+  * @param fs[IN] File system object
+  * @retval Bool
+  * @note The index of a volume that was mounted again is obsolete (FatFs gives a new mount ID)
+  */
+static uint8_t extent_valid(FATFS* fs)
+{
+	return (fs != NULL) && (extentState == EXTENT_VALID) && (extentFs == fs) && (extentFsId == fs->id);
+}
+
+/**
+  * @brief Reads a sector of the FAT or of the allocation bitmap
+  * @param fs[IN] File system object
+  * @param sector[IN] Sector number
+  * @param data[OUT] Sector contents
+  * @retval FRESULT: FR_DISK_ERR if the sector can't be read
+  * @note FatFs window may hold a modified sector that isn't written yet
+  */
+static FRESULT extent_read(FATFS* fs, DWORD sector, BYTE* data)
+{
+#if (_MAX_SS == _MIN_SS)
+	UINT sectorSize = _MAX_SS;
+#else
+	UINT sectorSize = fs->ssize;
+#endif
+
+	if (sector == fs->winsect)
+	{
+		memcpy(data, fs->win, sectorSize);
+		return FR_OK;
+	}
+	if (disk_read(fs->drv, data, sector, 1) != RES_OK)
+	{
+		return FR_DISK_ERR;
+	}
+	return FR_OK;
+}
+
+/**
+  * @brief Finds the first extent of the index holding a number of clusters
+  * @param length[IN] Number of clusters
+  * @retval Index of the extent, extentCount if all extents are shorter
+  */
+static UINT extent_search(DWORD length)
+{
+	UINT low = 0;
+	UINT high = extentCount;
+	UINT middle;
+
+	while (low < high)
+	{
+		middle = (low + high) / 2;
+		if (extentLength[middle] < length)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+	return low;
+}
+
+/**
+  * @brief Removes an extent from the index
+  * @param index[IN] Index of the extent
+  * @retval None
+  */
+static void extent_remove(UINT index)
+{
+	memmove(&extentStart[index], &extentStart[index + 1], (extentCount - index - 1) * sizeof(DWORD));
+	memmove(&extentLength[index], &extentLength[index + 1], (extentCount - index - 1) * sizeof(DWORD));
+	extentCount--;
+}
+
+/**
+  * @brief Adds free clusters to the index
+  * @param start[IN] First cluster
+  * @param length[IN] Number of clusters
+  * @retval None
+  * @note Extents next to the new one are merged with it. When the index is full, the shortest extent is forgotten
+  */
+static void extent_insert(DWORD start, DWORD length)
+{
+	UINT i = 0;
+	UINT index;
+
+	if (length == 0)
+	{
+		return;
+	}
+
+	while (i < extentCount)
+	{
+		if (extentStart[i] + extentLength[i] == start)
+		{
+			start = extentStart[i];
+			length += extentLength[i];
+			extent_remove(i);
+		}
+		else if (start + length == extentStart[i])
+		{
+			length += extentLength[i];
+			extent_remove(i);
+		}
+		else
+		{
+			i++;
+		}
+	}
+
+	if (extentCount == IO_EXTENT_INDEX_SIZE)
+	{
+		if (length <= extentLength[0])
+		{
+			return;
+		}
+		extent_remove(0);
+	}
+
+	index = extent_search(length);
+	memmove(&extentStart[index + 1], &extentStart[index], (extentCount - index) * sizeof(DWORD));
+	memmove(&extentLength[index + 1], &extentLength[index], (extentCount - index) * sizeof(DWORD));
+	extentStart[index] = start;
+	extentLength[index] = length;
+	extentCount++;
+}
+
+/**
+  * @brief Removes allocated clusters from the index
+  * @param start[IN] First cluster
+  * @param length[IN] Number of clusters
+  * @retval None
+  * @note Free clusters before and after the allocated ones stay in the index
+  */
+static void extent_allocated(DWORD start, DWORD length)
+{
+	UINT i = 0;
+	DWORD first;
+	DWORD end;
+
+	while (i < extentCount)
+	{
+		first = extentStart[i];
+		end = first + extentLength[i];
+		if ((first >= start + length) || (end <= start))
+		{
+			i++;
+			continue;
+		}
+		extent_remove(i);
+		if (first < start)
+		{
+			extent_insert(first, start - first);
+		}
+		if (end > start + length)
+		{
+			extent_insert(start + length, end - start - length);
+		}
+		i = 0;
+	}
+}
+#endif
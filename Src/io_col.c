@@ -0,0 +1,329 @@
+/** @file io_col.c
+ *
+ * @brief This file contains source codes of the columnar storage of multi-channel samples
+ */
+
+#include "io_col.h"
+#include <string.h>
+
+static FRESULT col_flush_chunk(IO_ColumnWriter* writer, UINT channel);
+
+/**
+  * @brief Creates a columnar data file and its directory file
+  * @param writer[OUT] Writer
+  * @param path[IN] Name of the data file (an existing file is replaced)
+  * @param directoryPath[IN] Name of the directory file (an existing file is replaced)
+  * @param channels[IN] Number of channels (1 to IO_COL_MAX_CHANNELS)
+  * @param sampleSize[IN] Size of a sample of each channel (1 to _MAX_SS bytes)
+  * @retval FRESULT: FR_INVALID_PARAMETER if channels or a sample size aren't valid
+  */
+FRESULT io_col_create(IO_ColumnWriter* writer, const TCHAR* path, const TCHAR* directoryPath, UINT channels, const uint8_t* sampleSize)
+{
+	FRESULT res;
+	uint8_t header[IO_COL_HEADER_SIZE];
+	UINT i;
+
+	if ((writer == NULL) || (path == NULL) || (directoryPath == NULL) || (sampleSize == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+	if ((channels == 0) || (channels > IO_COL_MAX_CHANNELS))
+	{
+		return FR_INVALID_PARAMETER;
+	}
+
+	memset(header, 0, sizeof(header));
+	for (i = 0; i < channels; i++)
+	{
+		if ((sampleSize[i] == 0) || (sampleSize[i] > _MAX_SS))
+		{
+			return FR_INVALID_PARAMETER;
+		}
+		writer->sampleSize[i] = sampleSize[i];
+		writer->fill[i] = 0;
+		header[8 + i] = sampleSize[i];
+	}
+	writer->channels = channels;
+	writer->chunks = 0;
+	writer->rows = 0;
+
+	writer->data = io_open(path, FA_READ | FA_WRITE | FA_CREATE_ALWAYS);
+	writer->directory = io_open(directoryPath, FA_READ | FA_WRITE | FA_CREATE_ALWAYS);
+	if ((writer->data == NULL) || (writer->directory == NULL))
+	{
+		io_close(writer->data);
+		io_close(writer->directory);
+		writer->data = NULL;
+		writer->directory = NULL;
+		return FR_DENIED;
+	}
+
+	io_store_le32(&header[0], IO_COL_MAGIC);
+	io_store_le16(&header[4], (uint16_t)channels);
+	res = io_write_exact(writer->directory, header, 0, IO_COL_HEADER_SIZE);
+	if (res != FR_OK)
+	{
+		io_close(writer->data);
+		io_close(writer->directory);
+		writer->data = NULL;
+		writer->directory = NULL;
+	}
+	return res;
+}
+
+/**
+  * @brief Appends a row: a sample of each channel
+  * @param writer[IN] Writer
+  * @param row[IN] Samples of channel 0, 1... without padding between them
+  * @retval FRESULT
+  * @note The sample is added to the buffer of its channel, a full buffer is written as a chunk of one sector
+  */
+FRESULT io_col_append(IO_ColumnWriter* writer, const void* row)
+{
+	FRESULT res;
+	const uint8_t* ptr = (const uint8_t*)row;
+	UINT i;
+
+	if ((writer == NULL) || (writer->data == NULL) || (row == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+
+	for (i = 0; i < writer->channels; i++)
+	{
+		memcpy(&writer->buffer[i][writer->fill[i] * writer->sampleSize[i]], ptr, writer->sampleSize[i]);
+		writer->fill[i]++;
+		ptr += writer->sampleSize[i];
+	}
+	writer->rows++;
+
+	for (i = 0; i < writer->channels; i++)
+	{
+		if ((writer->fill[i] + 1) * writer->sampleSize[i] > _MAX_SS)
+		{
+			res = col_flush_chunk(writer, i);
+			if (res != FR_OK)
+			{
+				return res;
+			}
+		}
+	}
+	return FR_OK;
+}
+
+/**
+  * @brief Writes the last chunks and closes the files
+  * @param writer[IN] Writer
+  * @retval FRESULT
+  */
+FRESULT io_col_close(IO_ColumnWriter* writer)
+{
+	FRESULT res = FR_OK;
+	FRESULT resClose;
+	UINT i;
+
+	if ((writer == NULL) || (writer->data == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+
+	for (i = 0; (i < writer->channels) && (res == FR_OK); i++)
+	{
+		if (writer->fill[i] != 0)
+		{
+			res = col_flush_chunk(writer, i);
+		}
+	}
+	resClose = io_close(writer->data);
+	if (res == FR_OK)
+	{
+		res = resClose;
+	}
+	resClose = io_close(writer->directory);
+	if (res == FR_OK)
+	{
+		res = resClose;
+	}
+	writer->data = NULL;
+	writer->directory = NULL;
+	return res;
+}
+
+/**
+  * @brief Opens a columnar data file and its directory file to read them
+  * @param reader[OUT] Reader
+  * @param path[IN] Name of the data file
+  * @param directoryPath[IN] Name of the directory file
+  * @retval FRESULT: FR_NO_FILE if a file can't be opened, FR_INVALID_OBJECT if the directory isn't valid
+  */
+FRESULT io_col_open(IO_ColumnReader* reader, const TCHAR* path, const TCHAR* directoryPath)
+{
+	FRESULT res;
+	FSIZE_t size;
+	uint8_t header[IO_COL_HEADER_SIZE];
+	UINT i;
+
+	if ((reader == NULL) || (path == NULL) || (directoryPath == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+
+	reader->data = io_open(path, FA_READ | FA_OPEN_EXISTING);
+	reader->directory = io_open(directoryPath, FA_READ | FA_OPEN_EXISTING);
+	res = ((reader->data != NULL) && (reader->directory != NULL)) ? FR_OK : FR_NO_FILE;
+	if (res == FR_OK)
+	{
+		res = io_size(reader->directory, &size);
+	}
+	if ((res == FR_OK) && (size < IO_COL_HEADER_SIZE))
+	{
+		res = FR_INVALID_OBJECT;
+	}
+	if (res == FR_OK)
+	{
+		res = io_read_exact(reader->directory, header, 0, IO_COL_HEADER_SIZE);
+	}
+	if (res == FR_OK)
+	{
+		reader->channels = io_load_le16(&header[4]);
+		reader->chunks = (UINT)((size - IO_COL_HEADER_SIZE) / IO_COL_ENTRY_SIZE);
+		if ((io_load_le32(header) != IO_COL_MAGIC) || (reader->channels == 0) || (reader->channels > IO_COL_MAX_CHANNELS))
+		{
+			res = FR_INVALID_OBJECT;
+		}
+		for (i = 0; (res == FR_OK) && (i < reader->channels); i++)
+		{
+			reader->sampleSize[i] = header[8 + i];
+			if (reader->sampleSize[i] == 0)
+			{
+				res = FR_INVALID_OBJECT;
+			}
+		}
+	}
+	if (res != FR_OK)
+	{
+		io_close(reader->data);
+		io_close(reader->directory);
+		reader->data = NULL;
+		reader->directory = NULL;
+	}
+	return res;
+}
+
+/**
+  * @brief Reads samples of a channel
+  * @param reader[IN] Reader
+  * @param channel[IN] Channel
+  * @param firstRow[IN] Row of the first sample
+  * @param buff[OUT] Samples (rows * sample size bytes)
+  * @param rows[IN] Number of samples to read
+  * @param read[OUT] Number of samples read, less than rows at the end of the file
+  * @retval FRESULT: FR_INVALID_PARAMETER if the channel doesn't exist
+  * @note The directory is read to find the chunks of the channel: chunks of the other channels aren't read
+  */
+FRESULT io_col_read(IO_ColumnReader* reader, UINT channel, uint32_t firstRow, void* buff, UINT rows, UINT* read)
+{
+	FRESULT res;
+	uint8_t entry[IO_COL_ENTRY_SIZE];
+	uint8_t* ptr = (uint8_t*)buff;
+	uint32_t row;
+	uint32_t first;
+	UINT count;
+	UINT part;
+	UINT size;
+	UINT i;
+
+	if ((reader == NULL) || (reader->data == NULL) || (buff == NULL) || (read == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+	if (channel >= reader->channels)
+	{
+		return FR_INVALID_PARAMETER;
+	}
+
+	*read = 0;
+	size = reader->sampleSize[channel];
+	for (i = 0; (i < reader->chunks) && (*read < rows); i++)
+	{
+		res = io_read_exact(reader->directory, entry, IO_COL_HEADER_SIZE + i * IO_COL_ENTRY_SIZE, IO_COL_ENTRY_SIZE);
+		if (res != FR_OK)
+		{
+			return res;
+		}
+		count = io_load_le16(&entry[2]);
+		first = io_load_le32(&entry[4]);
+		row = firstRow + *read;
+		if ((io_load_le16(&entry[0]) != channel) || (row >= first + count) || (row < first))
+		{
+			continue;
+		}
+
+		part = first + count - row;
+		if (part > rows - *read)
+		{
+			part = rows - *read;
+		}
+		res = io_read_exact(reader->data, ptr, i * _MAX_SS + (row - first) * size, part * size);
+		if (res != FR_OK)
+		{
+			return res;
+		}
+		ptr += part * size;
+		*read += part;
+	}
+	return FR_OK;
+}
+
+/**
+  * @brief Closes the files of a reader
+  * @param reader[IN] Reader
+  * @retval FRESULT
+  */
+FRESULT io_col_reader_close(IO_ColumnReader* reader)
+{
+	FRESULT res;
+	FRESULT resDirectory;
+
+	if ((reader == NULL) || (reader->data == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+	res = io_close(reader->data);
+	resDirectory = io_close(reader->directory);
+	reader->data = NULL;
+	reader->directory = NULL;
+	return (res != FR_OK) ? res : resDirectory;
+}
+
+/**
+  * @brief Writes the buffer of a channel as a chunk, and its directory entry
+  * @param writer[IN] Writer
+  * @param channel[IN] Channel
+  * @retval FRESULT
+  */
+static FRESULT col_flush_chunk(IO_ColumnWriter* writer, UINT channel)
+{
+	FRESULT res;
+	uint8_t entry[IO_COL_ENTRY_SIZE];
+	uint32_t first = writer->rows - writer->fill[channel];
+	UINT used = writer->fill[channel] * writer->sampleSize[channel];
+
+	memset(&writer->buffer[channel][used], 0, _MAX_SS - used);
+	res = io_write_exact(writer->data, writer->buffer[channel], writer->chunks * _MAX_SS, _MAX_SS);
+	if (res != FR_OK)
+	{
+		return res;
+	}
+
+	io_store_le16(&entry[0], (uint16_t)channel);
+	io_store_le16(&entry[2], (uint16_t)writer->fill[channel]);
+	io_store_le32(&entry[4], first);
+	res = io_write_exact(writer->directory, entry, IO_COL_HEADER_SIZE + writer->chunks * IO_COL_ENTRY_SIZE, IO_COL_ENTRY_SIZE);
+	if (res == FR_OK)
+	{
+		writer->chunks++;
+		writer->fill[channel] = 0;
+	}
+	return res;
+}
@@ -0,0 +1,467 @@
+/** @file io_log.c
+ *
+ * @brief This file contains source codes of the crash-recoverable append logs
+ */
+
+#include "io_log.h"
+#include <string.h>
+
+#define PAYLOAD_SIZE (_MAX_SS - IO_LOG_SECTOR_HEADER)
+
+static FRESULT log_read_header(IO_Log* log);
+static FRESULT log_check(IO_Log* log, UINT index, UINT* length);
+static FRESULT log_seal(IO_Log* log);
+static void fletcher_update(UINT* sum1, UINT* sum2, const uint8_t* data, UINT length);
+
+/**
+  * @brief Creates an empty log
+  * @param log[OUT] Log
+  * @param path[IN] File name (an existing file is deleted)
+  * @param size[IN] Size of the file (in bytes), the first sector holds the header
+  * @retval FRESULT: FR_INVALID_PARAMETER if size is under 2 sectors, FR_DENIED if the file couldn't be created
+  * @note The file is created with io_create_contiguous. Its sectors aren't erased: they are ignored thanks to the log id
+  */
+FRESULT io_log_create(IO_Log* log, const TCHAR* path, FSIZE_t size)
+{
+	FRESULT res;
+	uint32_t oldId = 0;
+	UINT sum1 = 0;
+	UINT sum2 = 0;
+	uint8_t header[16];
+
+	if ((log == NULL) || (path == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+	if (size < 2 * _MAX_SS)
+	{
+		return FR_INVALID_PARAMETER;
+	}
+
+	// The id of the replaced log is changed, so that its sectors are never valid again
+	log->fp = io_open(path, FA_READ | FA_OPEN_EXISTING);
+	if (log->fp != NULL)
+	{
+		if (log_read_header(log) == FR_OK)
+		{
+			oldId = log->logId;
+		}
+		io_close(log->fp);
+	}
+
+	log->sectors = (UINT)(size / _MAX_SS) - 1;
+	log->next = 0;
+	log->fill = 0;
+	log->readSector = 0;
+	log->readOffset = 0;
+	log->fp = io_create_contiguous(path, FA_READ, (FSIZE_t)(log->sectors + 1) * _MAX_SS);
+	if (log->fp == NULL)
+	{
+		return FR_DENIED;
+	}
+
+	if (oldId != 0)
+	{
+		log->logId = oldId + 1;
+	}
+	else
+	{
+		// New file: the id comes from what the first sector held before, and where it is
+		res = io_read_exact(log->fp, header, 0, sizeof(header));
+		if (res == FR_OK)
+		{
+			fletcher_update(&sum1, &sum2, header, sizeof(header));
+		}
+		log->logId = (((uint32_t)sum2 << 8) | sum1) ^ ((uint32_t)log->fp->directSector << 16) ^ io_load_le32(&header[4]);
+	}
+	if (log->logId == 0)
+	{
+		log->logId = 1;
+	}
+
+	io_store_le32(&header[0], IO_LOG_MAGIC);
+	io_store_le32(&header[4], log->logId);
+	io_store_le32(&header[8], log->sectors);
+	io_store_le32(&header[12], ~(IO_LOG_MAGIC ^ log->logId ^ log->sectors));
+	res = io_write_exact(log->fp, header, 0, sizeof(header));
+	if (res == FR_OK)
+	{
+		res = io_sync(log->fp);
+	}
+	if (res != FR_OK)
+	{
+		io_close(log->fp);
+		log->fp = NULL;
+	}
+	return res;
+}
+
+/**
+  * @brief Opens an existing log, and finds where data ends
+  * @param log[OUT] Log
+  * @param path[IN] File name
+  * @retval FRESULT: FR_NO_FILE if the file doesn't exist, FR_INVALID_OBJECT if its header isn't valid
+  * @note Valid sectors are followed by invalid ones, so the end of the log is found with a binary search:
+  * about log2(number of sectors) sectors are read, whatever the size of the log
+  * @note Appended data continues in a new sector
+  */
+FRESULT io_log_open(IO_Log* log, const TCHAR* path)
+{
+	FRESULT res;
+	UINT low = 0;
+	UINT high;
+	UINT middle;
+	UINT length;
+
+	if ((log == NULL) || (path == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+
+	log->fp = io_open(path, FA_READ | FA_WRITE | FA_OPEN_EXISTING | IO_FA_CONTIGUOUS);
+	if (log->fp == NULL)
+	{
+		return FR_NO_FILE;
+	}
+
+	res = log_read_header(log);
+	high = log->sectors;
+	while ((res == FR_OK) && (low < high))
+	{
+		middle = low + (high - low) / 2;
+		res = log_check(log, middle, &length);
+		if (length != 0)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+	if (res != FR_OK)
+	{
+		io_close(log->fp);
+		log->fp = NULL;
+		return res;
+	}
+
+	log->next = low;
+	log->fill = 0;
+	log->readSector = 0;
+	log->readOffset = 0;
+	return FR_OK;
+}
+
+/**
+  * @brief Appends data to the log
+  * @param log[IN] Log
+  * @param data[IN] Data
+  * @param length[IN] Number of bytes
+  * @retval FRESULT: FR_DENIED if the log is full (data that fits is appended)
+  * @note Full sectors are written with io_write, the last one stays in RAM until io_log_commit
+  */
+FRESULT io_log_append(IO_Log* log, const void* data, UINT length)
+{
+	FRESULT res;
+	UINT part;
+	const uint8_t* ptr = (const uint8_t*)data;
+
+	if ((log == NULL) || (log->fp == NULL) || ((data == NULL) && (length != 0)))
+	{
+		return FR_INVALID_OBJECT;
+	}
+
+	while (length != 0)
+	{
+		if (log->next >= log->sectors)
+		{
+			return FR_DENIED;
+		}
+		part = PAYLOAD_SIZE - log->fill;
+		if (part > length)
+		{
+			part = length;
+		}
+		memcpy(&log->sector[IO_LOG_SECTOR_HEADER + log->fill], ptr, part);
+		log->fill += part;
+		ptr += part;
+		length -= part;
+		if (log->fill == PAYLOAD_SIZE)
+		{
+			res = log_seal(log);
+			if (res != FR_OK)
+			{
+				return res;
+			}
+		}
+	}
+	return FR_OK;
+}
+
+/**
+  * @brief Writes the sector being filled and saves the log
+  * @param log[IN] Log
+  * @retval FRESULT
+  * @note A sector is never written again once committed: the next data starts a new sector.
+  * Committing often wastes the end of the sectors.
+  */
+FRESULT io_log_commit(IO_Log* log)
+{
+	FRESULT res = FR_OK;
+
+	if ((log == NULL) || (log->fp == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+	if (log->fill != 0)
+	{
+		res = log_seal(log);
+	}
+	if (res == FR_OK)
+	{
+		res = io_sync(log->fp);
+	}
+	return res;
+}
+
+/**
+  * @brief Reads data from the beginning to the end of the log
+  * @param log[IN] Log
+  * @param buff[OUT] Buffer
+  * @param btr[IN] Number of bytes to read
+  * @param br[OUT] Number of bytes read, less than btr at the end of the log
+  * @retval FRESULT
+  * @note Each call continues where the previous one stopped. Data that isn't committed yet is read too.
+  */
+FRESULT io_log_read(IO_Log* log, void* buff, UINT btr, UINT* br)
+{
+	FRESULT res;
+	uint8_t header[IO_LOG_SECTOR_HEADER];
+	uint8_t* ptr = (uint8_t*)buff;
+	UINT length;
+	UINT part;
+
+	if ((log == NULL) || (log->fp == NULL) || (buff == NULL) || (br == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+
+	*br = 0;
+	while ((btr != 0) && (log->readSector <= log->next))
+	{
+		if (log->readSector < log->next)
+		{
+			res = io_read_exact(log->fp, header, (log->readSector + 1) * _MAX_SS, IO_LOG_SECTOR_HEADER);
+			if (res != FR_OK)
+			{
+				return res;
+			}
+			length = io_load_le16(&header[4]);
+		}
+		else
+		{
+			length = log->fill;
+		}
+
+		if (log->readOffset >= length)
+		{
+			if (log->readSector == log->next)
+			{
+				break;
+			}
+			log->readSector++;
+			log->readOffset = 0;
+			continue;
+		}
+
+		part = length - log->readOffset;
+		if (part > btr)
+		{
+			part = btr;
+		}
+		if (log->readSector < log->next)
+		{
+			res = io_read_exact(log->fp, ptr, (log->readSector + 1) * _MAX_SS + IO_LOG_SECTOR_HEADER + log->readOffset, part);
+			if (res != FR_OK)
+			{
+				return res;
+			}
+		}
+		else
+		{
+			memcpy(ptr, &log->sector[IO_LOG_SECTOR_HEADER + log->readOffset], part);
+		}
+		log->readOffset += part;
+		ptr += part;
+		btr -= part;
+		*br += part;
+	}
+	return FR_OK;
+}
+
+/**
+  * @brief Moves the reading position back to the beginning of the log
+  * @param log[IN] Log
+  * @retval FRESULT
+  */
+FRESULT io_log_rewind(IO_Log* log)
+{
+	if ((log == NULL) || (log->fp == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+	log->readSector = 0;
+	log->readOffset = 0;
+	return FR_OK;
+}
+
+/**
+  * @brief Commits the log and closes its file
+  * @param log[IN] Log
+  * @retval FRESULT
+  */
+FRESULT io_log_close(IO_Log* log)
+{
+	FRESULT res;
+	FRESULT resClose;
+
+	if ((log == NULL) || (log->fp == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+
+	res = io_log_commit(log);
+	resClose = io_close(log->fp);
+	log->fp = NULL;
+	return (res != FR_OK) ? res : resClose;
+}
+
+/**
+  * @brief Reads and checks the header sector
+  * @param log[IN] Log, logId and sectors are set
+  * @retval FRESULT: FR_INVALID_OBJECT if the header isn't valid
+  */
+static FRESULT log_read_header(IO_Log* log)
+{
+	FRESULT res;
+	FSIZE_t size;
+	uint8_t header[16];
+
+	res = io_read_exact(log->fp, header, 0, sizeof(header));
+	if (res == FR_OK)
+	{
+		res = io_size(log->fp, &size);
+	}
+	if (res != FR_OK)
+	{
+		return res;
+	}
+
+	log->logId = io_load_le32(&header[4]);
+	log->sectors = io_load_le32(&header[8]);
+	if ((io_load_le32(&header[0]) != IO_LOG_MAGIC) || (io_load_le32(&header[12]) != ~(IO_LOG_MAGIC ^ log->logId ^ log->sectors))
+			|| ((FSIZE_t)(log->sectors + 1) * _MAX_SS != size))
+	{
+		return FR_INVALID_OBJECT;
+	}
+	return FR_OK;
+}
+
+/**
+  * @brief Checks that a data sector was written by this log
+  * @param log[IN] Log
+  * @param index[IN] Data sector
+  * @param length[OUT] Payload length, 0 if the sector isn't valid
+  * @retval FRESULT
+  * @note The payload is checksummed in the buffer of IO API, without being copied
+  */
+static FRESULT log_check(IO_Log* log, UINT index, UINT* length)
+{
+	FRESULT res;
+	uint8_t header[IO_LOG_SECTOR_HEADER];
+	const uint8_t* data;
+	UINT position = (index + 1) * _MAX_SS;
+	UINT remaining;
+	UINT sum1 = 0;
+	UINT sum2 = 0;
+	UINT br;
+
+	*length = 0;
+	res = io_read_exact(log->fp, header, position, IO_LOG_SECTOR_HEADER);
+	if (res != FR_OK)
+	{
+		return res;
+	}
+	remaining = io_load_le16(&header[4]);
+	if (((io_load_le32(&header[0]) ^ log->logId) != index + 1) || (remaining == 0) || (remaining > PAYLOAD_SIZE))
+	{
+		return FR_OK;
+	}
+
+	fletcher_update(&sum1, &sum2, header, 6);
+	position += IO_LOG_SECTOR_HEADER;
+	while (remaining != 0)
+	{
+		data = (const uint8_t*)io_read(log->fp, position, remaining, &br);
+		if ((data == NULL) || (br == 0))
+		{
+			return FR_DISK_ERR;
+		}
+		fletcher_update(&sum1, &sum2, data, br);
+		position += br;
+		remaining -= br;
+	}
+	if ((header[6] == sum1) && (header[7] == sum2))
+	{
+		*length = io_load_le16(&header[4]);
+	}
+	return FR_OK;
+}
+
+/**
+  * @brief Writes the sector being filled, with its header
+  * @param log[IN] Log
+  * @retval FRESULT
+  */
+static FRESULT log_seal(IO_Log* log)
+{
+	FRESULT res;
+	UINT sum1 = 0;
+	UINT sum2 = 0;
+
+	io_store_le32(&log->sector[0], (log->next + 1) ^ log->logId);
+	io_store_le16(&log->sector[4], (uint16_t)log->fill);
+	fletcher_update(&sum1, &sum2, log->sector, 6);
+	fletcher_update(&sum1, &sum2, &log->sector[IO_LOG_SECTOR_HEADER], log->fill);
+	log->sector[6] = (uint8_t)sum1;
+	log->sector[7] = (uint8_t)sum2;
+	memset(&log->sector[IO_LOG_SECTOR_HEADER + log->fill], 0, PAYLOAD_SIZE - log->fill);
+
+	res = io_write_exact(log->fp, log->sector, (log->next + 1) * _MAX_SS, _MAX_SS);
+	if (res == FR_OK)
+	{
+		log->next++;
+		log->fill = 0;
+	}
+	return res;
+}
+
+/**
+  * @brief Adds bytes to a Fletcher-16 checksum
+  * @param sum1[IN/OUT] Sum of the bytes (modulo 255)
+  * @param sum2[IN/OUT] Sum of sum1 (modulo 255)
+  * @param data[IN] Bytes
+  * @param length[IN] Number of bytes
+  * @retval None
+  */
+static void fletcher_update(UINT* sum1, UINT* sum2, const uint8_t* data, UINT length)
+{
+	UINT i;
+
+	for (i = 0; i < length; i++)
+	{
+		*sum1 = (*sum1 + data[i]) % 255;
+		*sum2 = (*sum2 + *sum1) % 255;
+	}
+}
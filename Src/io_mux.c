@@ -0,0 +1,428 @@
+/** @file io_mux.c
+ *
+ * @brief This file contains source codes of the stream multiplexer
+ */
+
+#include "io_mux.h"
+#include <string.h>
+
+#define PAYLOAD_SIZE (_MAX_SS - IO_MUX_CHUNK_HEADER)
+#define CHUNK_POSITION(mux, chunk) ((1 + (mux)->indexSectors + (chunk)) * _MAX_SS)
+#define INDEX_POSITION(sector) ((1 + (sector)) * _MAX_SS)
+
+static FRESULT mux_emit(IO_Mux* mux, UINT stream);
+static FRESULT mux_write_header(IO_Mux* mux);
+static FRESULT mux_tag(IO_MuxReader* reader, UINT chunk, uint8_t* tag);
+
+/**
+  * @brief Creates an empty multiplexed file
+  * @param mux[OUT] Multiplexer
+  * @param path[IN] File name (an existing file is deleted)
+  * @param streams[IN] Number of streams (1 to IO_MUX_MAX_STREAMS)
+  * @param size[IN] File size (in bytes), allocated once with io_create_contiguous
+  * @retval FRESULT: FR_INVALID_PARAMETER if streams or size aren't valid, FR_DENIED if the file couldn't be created
+  */
+FRESULT io_mux_create(IO_Mux* mux, const TCHAR* path, UINT streams, FSIZE_t size)
+{
+	FRESULT res;
+	UINT total;
+	UINT i;
+
+	if ((mux == NULL) || (path == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+	if ((streams == 0) || (streams > IO_MUX_MAX_STREAMS) || (size < 3 * _MAX_SS))
+	{
+		return FR_INVALID_PARAMETER;
+	}
+
+	// An index sector describes _MAX_SS chunks
+	total = (UINT)(size / _MAX_SS) - 1;
+	mux->indexSectors = (total + _MAX_SS) / (_MAX_SS + 1);
+	mux->capacity = total - mux->indexSectors;
+	mux->streams = streams;
+	mux->count = 0;
+	memset(mux->index, 0, _MAX_SS);
+	for (i = 0; i < streams; i++)
+	{
+		mux->fill[i] = 0;
+	}
+
+	mux->fp = io_create_contiguous(path, FA_READ, (FSIZE_t)(1 + total) * _MAX_SS);
+	if (mux->fp == NULL)
+	{
+		return FR_DENIED;
+	}
+	res = mux_write_header(mux);
+	if (res == FR_OK)
+	{
+		res = io_sync(mux->fp);
+	}
+	if (res != FR_OK)
+	{
+		io_close(mux->fp);
+		mux->fp = NULL;
+	}
+	return res;
+}
+
+/**
+  * @brief Opens an existing multiplexed file, to read it or append data
+  * @param mux[OUT] Multiplexer
+  * @param path[IN] File name
+  * @retval FRESULT: FR_NO_FILE if the file can't be opened, FR_INVALID_OBJECT if its header isn't valid
+  * @note Chunks written after the last io_mux_sync are lost
+  */
+FRESULT io_mux_open(IO_Mux* mux, const TCHAR* path)
+{
+	FRESULT res;
+	FSIZE_t size;
+	uint8_t header[16];
+	UINT i;
+
+	if ((mux == NULL) || (path == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+
+	mux->fp = io_open(path, FA_READ | FA_WRITE | FA_OPEN_EXISTING | IO_FA_CONTIGUOUS);
+	if (mux->fp == NULL)
+	{
+		return FR_NO_FILE;
+	}
+
+	res = io_read_exact(mux->fp, header, 0, sizeof(header));
+	if (res == FR_OK)
+	{
+		res = io_size(mux->fp, &size);
+	}
+	if (res == FR_OK)
+	{
+		mux->streams = io_load_le16(&header[4]);
+		mux->capacity = io_load_le32(&header[8]);
+		mux->count = io_load_le32(&header[12]);
+		mux->indexSectors = ((UINT)(size / _MAX_SS) - 1 + _MAX_SS) / (_MAX_SS + 1);
+		if ((io_load_le32(&header[0]) != IO_MUX_MAGIC) || (mux->streams == 0) || (mux->streams > IO_MUX_MAX_STREAMS)
+				|| (mux->count > mux->capacity) || (size < 3 * _MAX_SS) || ((FSIZE_t)CHUNK_POSITION(mux, mux->capacity) != size))
+		{
+			res = FR_INVALID_OBJECT;
+		}
+	}
+
+	// Entries of the last index sector that isn't full
+	memset(mux->index, 0, _MAX_SS);
+	if ((res == FR_OK) && (mux->count % _MAX_SS != 0))
+	{
+		res = io_read_exact(mux->fp, mux->index, INDEX_POSITION(mux->count / _MAX_SS), mux->count % _MAX_SS);
+	}
+	if (res != FR_OK)
+	{
+		io_close(mux->fp);
+		mux->fp = NULL;
+		return res;
+	}
+
+	for (i = 0; i < mux->streams; i++)
+	{
+		mux->fill[i] = 0;
+	}
+	return FR_OK;
+}
+
+/**
+  * @brief Appends data to a stream
+  * @param mux[IN] Multiplexer
+  * @param stream[IN] Stream number
+  * @param data[IN] Data
+  * @param length[IN] Number of bytes
+  * @retval FRESULT: FR_INVALID_PARAMETER if the stream doesn't exist, FR_DENIED if the file is full
+  * @note Data is gathered in the buffer of the stream, a full buffer is written as the next chunk of the file
+  */
+FRESULT io_mux_write(IO_Mux* mux, UINT stream, const void* data, UINT length)
+{
+	FRESULT res;
+	const uint8_t* ptr = (const uint8_t*)data;
+	UINT part;
+
+	if ((mux == NULL) || (mux->fp == NULL) || ((data == NULL) && (length != 0)))
+	{
+		return FR_INVALID_OBJECT;
+	}
+	if (stream >= mux->streams)
+	{
+		return FR_INVALID_PARAMETER;
+	}
+
+	while (length != 0)
+	{
+		part = PAYLOAD_SIZE - mux->fill[stream];
+		if (part > length)
+		{
+			part = length;
+		}
+		memcpy(&mux->buffer[stream][IO_MUX_CHUNK_HEADER + mux->fill[stream]], ptr, part);
+		mux->fill[stream] += part;
+		ptr += part;
+		length -= part;
+		if (mux->fill[stream] == PAYLOAD_SIZE)
+		{
+			res = mux_emit(mux, stream);
+			if (res != FR_OK)
+			{
+				return res;
+			}
+		}
+	}
+	return FR_OK;
+}
+
+/**
+  * @brief Writes the chunks being filled, the index and the header, and saves the file
+  * @param mux[IN] Multiplexer
+  * @retval FRESULT
+  * @note Chunks that aren't full are written: syncing often wastes space
+  */
+FRESULT io_mux_sync(IO_Mux* mux)
+{
+	FRESULT res = FR_OK;
+	UINT i;
+
+	if ((mux == NULL) || (mux->fp == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+
+	for (i = 0; (i < mux->streams) && (res == FR_OK); i++)
+	{
+		if (mux->fill[i] != 0)
+		{
+			res = mux_emit(mux, i);
+		}
+	}
+	if ((res == FR_OK) && (mux->count % _MAX_SS != 0))
+	{
+		res = io_write_exact(mux->fp, mux->index, INDEX_POSITION(mux->count / _MAX_SS), _MAX_SS);
+	}
+	if (res == FR_OK)
+	{
+		res = mux_write_header(mux);
+	}
+	if (res == FR_OK)
+	{
+		res = io_sync(mux->fp);
+	}
+	return res;
+}
+
+/**
+  * @brief Syncs the multiplexer and closes its file
+  * @param mux[IN] Multiplexer
+  * @retval FRESULT
+  */
+FRESULT io_mux_close(IO_Mux* mux)
+{
+	FRESULT res;
+	FRESULT resClose;
+
+	if ((mux == NULL) || (mux->fp == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+
+	res = io_mux_sync(mux);
+	resClose = io_close(mux->fp);
+	mux->fp = NULL;
+	return (res != FR_OK) ? res : resClose;
+}
+
+/**
+  * @brief Prepares a reader to read a stream from its beginning
+  * @param reader[OUT] Reader
+  * @param mux[IN] Multiplexer
+  * @param stream[IN] Stream number
+  * @retval FRESULT: FR_INVALID_PARAMETER if the stream doesn't exist
+  */
+FRESULT io_mux_reader_init(IO_MuxReader* reader, IO_Mux* mux, UINT stream)
+{
+	if ((reader == NULL) || (mux == NULL) || (mux->fp == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+	if (stream >= mux->streams)
+	{
+		return FR_INVALID_PARAMETER;
+	}
+
+	reader->mux = mux;
+	reader->stream = stream;
+	reader->chunk = 0;
+	reader->offset = 0;
+	reader->indexSector = 0;
+	return FR_OK;
+}
+
+/**
+  * @brief Reads data of a stream
+  * @param reader[IN] Reader
+  * @param buff[OUT] Buffer
+  * @param btr[IN] Number of bytes to read
+  * @param br[OUT] Number of bytes read, less than btr at the end of the stream
+  * @retval FRESULT
+  * @note The index gives the chunks of the stream: chunks of the other streams aren't read.
+  * Data still in the buffer of the stream is read once its chunk is written.
+  */
+FRESULT io_mux_read(IO_MuxReader* reader, void* buff, UINT btr, UINT* br)
+{
+	FRESULT res;
+	IO_Mux* mux;
+	uint8_t header[IO_MUX_CHUNK_HEADER];
+	uint8_t* ptr = (uint8_t*)buff;
+	uint8_t tag;
+	UINT length;
+	UINT part;
+
+	if ((reader == NULL) || (reader->mux == NULL) || (reader->mux->fp == NULL) || (buff == NULL) || (br == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+
+	mux = reader->mux;
+	*br = 0;
+	while ((btr != 0) && (reader->chunk < mux->count))
+	{
+		// Skip chunks of the other streams
+		res = mux_tag(reader, reader->chunk, &tag);
+		if (res != FR_OK)
+		{
+			return res;
+		}
+		if (tag != reader->stream + 1)
+		{
+			reader->chunk++;
+			reader->offset = 0;
+			continue;
+		}
+
+		res = io_read_exact(mux->fp, header, CHUNK_POSITION(mux, reader->chunk), IO_MUX_CHUNK_HEADER);
+		if (res != FR_OK)
+		{
+			return res;
+		}
+		length = io_load_le16(&header[2]);
+		if ((header[0] != tag) || (length > PAYLOAD_SIZE))
+		{
+			return FR_INT_ERR;
+		}
+		if (reader->offset >= length)
+		{
+			reader->chunk++;
+			reader->offset = 0;
+			continue;
+		}
+
+		part = length - reader->offset;
+		if (part > btr)
+		{
+			part = btr;
+		}
+		res = io_read_exact(mux->fp, ptr, CHUNK_POSITION(mux, reader->chunk) + IO_MUX_CHUNK_HEADER + reader->offset, part);
+		if (res != FR_OK)
+		{
+			return res;
+		}
+		reader->offset += part;
+		ptr += part;
+		btr -= part;
+		*br += part;
+	}
+	return FR_OK;
+}
+
+/**
+  * @brief Writes the buffer of a stream as the next chunk, and adds it to the index
+  * @param mux[IN] Multiplexer
+  * @param stream[IN] Stream number
+  * @retval FRESULT: FR_DENIED if the file is full
+  */
+static FRESULT mux_emit(IO_Mux* mux, UINT stream)
+{
+	FRESULT res;
+	uint8_t* chunk = mux->buffer[stream];
+
+	if (mux->count >= mux->capacity)
+	{
+		return FR_DENIED;
+	}
+
+	chunk[0] = (uint8_t)(stream + 1);
+	chunk[1] = 0;
+	io_store_le16(&chunk[2], (uint16_t)mux->fill[stream]);
+	memset(&chunk[IO_MUX_CHUNK_HEADER + mux->fill[stream]], 0, PAYLOAD_SIZE - mux->fill[stream]);
+	res = io_write_exact(mux->fp, chunk, CHUNK_POSITION(mux, mux->count), _MAX_SS);
+	if (res != FR_OK)
+	{
+		return res;
+	}
+
+	// A full index sector is written once, between two chunks
+	mux->index[mux->count % _MAX_SS] = (uint8_t)(stream + 1);
+	mux->count++;
+	mux->fill[stream] = 0;
+	if (mux->count % _MAX_SS == 0)
+	{
+		res = io_write_exact(mux->fp, mux->index, INDEX_POSITION(mux->count / _MAX_SS - 1), _MAX_SS);
+		memset(mux->index, 0, _MAX_SS);
+	}
+	return res;
+}
+
+/**
+  * @brief Writes the header sector
+  * @param mux[IN] Multiplexer
+  * @retval FRESULT
+  */
+static FRESULT mux_write_header(IO_Mux* mux)
+{
+	uint8_t header[16];
+
+	io_store_le32(&header[0], IO_MUX_MAGIC);
+	io_store_le16(&header[4], (uint16_t)mux->streams);
+	io_store_le16(&header[6], 0);
+	io_store_le32(&header[8], mux->capacity);
+	io_store_le32(&header[12], mux->count);
+	return io_write_exact(mux->fp, header, 0, sizeof(header));
+}
+
+/**
+  * @brief Gives the index entry of a chunk
+  * @param reader[IN] Reader, holding a copy of the last index sector read
+  * @param chunk[IN] Chunk number
+  * @param tag[OUT] Stream number + 1
+  * @retval FRESULT
+  */
+static FRESULT mux_tag(IO_MuxReader* reader, UINT chunk, uint8_t* tag)
+{
+	FRESULT res;
+	IO_Mux* mux = reader->mux;
+	UINT sector = chunk / _MAX_SS;
+
+	// The last index sector may only be in the multiplexer
+	if (sector == mux->count / _MAX_SS)
+	{
+		*tag = mux->index[chunk % _MAX_SS];
+		return FR_OK;
+	}
+	if (reader->indexSector != sector + 1)
+	{
+		res = io_read_exact(mux->fp, reader->index, INDEX_POSITION(sector), _MAX_SS);
+		if (res != FR_OK)
+		{
+			reader->indexSector = 0;
+			return res;
+		}
+		reader->indexSector = sector + 1;
+	}
+	*tag = reader->index[chunk % _MAX_SS];
+	return FR_OK;
+}
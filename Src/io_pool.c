@@ -0,0 +1,198 @@
+/** @file io_pool.c
+ *
+ * @brief This file contains source codes of the pool of contiguous files
+ */
+
+#include "io_pool.h"
+
+static void pool_name(const IO_Pool* pool, UINT slot, TCHAR* name);
+
+/**
+  * @brief Initializes a pool of spare contiguous files, and finds the spare files that already exist
+  * @param pool[OUT] Pool
+  * @param prefix[IN] Path of the spare files, without their number (e.g. "0:/spare")
+  * @param count[IN] Number of spare files to keep in reserve (at most IO_POOL_MAX_FILES)
+  * @param size[IN] Size of each spare file (in bytes)
+  * @retval FRESULT: FR_INVALID_PARAMETER if count or the prefix are too big
+  * @note No file is created: call io_pool_refill when the application is idle
+  */
+FRESULT io_pool_init(IO_Pool* pool, const TCHAR* prefix, UINT count, FSIZE_t size)
+{
+	TCHAR name[IO_POOL_PATH_LENGTH];
+	FILINFO info;
+	UINT i;
+
+	if ((pool == NULL) || (prefix == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+	if ((count > IO_POOL_MAX_FILES) || (size == 0))
+	{
+		return FR_INVALID_PARAMETER;
+	}
+	for (i = 0; prefix[i] != 0; i++)
+	{
+		// Room is left for 2 digits and the null character
+		if (i + 3 >= IO_POOL_PATH_LENGTH)
+		{
+			return FR_INVALID_PARAMETER;
+		}
+		pool->prefix[i] = prefix[i];
+	}
+	pool->prefix[i] = 0;
+	pool->count = count;
+	pool->size = size;
+
+	// Spare files created before a reset can still be used
+	for (i = 0; i < IO_POOL_MAX_FILES; i++)
+	{
+		pool->ready[i] = 0;
+		if (i < count)
+		{
+			pool_name(pool, i, name);
+			if ((f_stat(name, &info) == FR_OK) && (info.fsize == size))
+			{
+				pool->ready[i] = 1;
+			}
+		}
+	}
+	return FR_OK;
+}
+
+/**
+  * @brief Creates missing spare files
+  * @param pool[IN] Pool
+  * @param maxFiles[IN] Maximum number of files to create during this call, 0 for no limit
+  * @retval FRESULT: FR_DENIED if a file couldn't be created (no free contiguous space)
+  * @note Each file is created with io_create_contiguous, which takes time: call it when the application is idle
+  */
+FRESULT io_pool_refill(IO_Pool* pool, UINT maxFiles)
+{
+	TCHAR name[IO_POOL_PATH_LENGTH];
+	IO_FileDescriptor* fp;
+	UINT created = 0;
+	UINT i;
+
+	if (pool == NULL)
+	{
+		return FR_INVALID_OBJECT;
+	}
+
+	for (i = 0; i < pool->count; i++)
+	{
+		if (pool->ready[i] != 0)
+		{
+			continue;
+		}
+		if ((maxFiles != 0) && (created >= maxFiles))
+		{
+			break;
+		}
+		pool_name(pool, i, name);
+		fp = io_create_contiguous(name, FA_READ, pool->size);
+		if (fp == NULL)
+		{
+			return FR_DENIED;
+		}
+		if (io_close(fp) != FR_OK)
+		{
+			return FR_DISK_ERR;
+		}
+		pool->ready[i] = 1;
+		created++;
+	}
+	return FR_OK;
+}
+
+/**
+  * @brief Gives a spare file a new name, and opens it
+  * @param pool[IN] Pool
+  * @param path[IN] File name (an existing file is deleted)
+  * @param mode[IN] FA_READ and IO_FA_FASTSEEK mode flags, FA_WRITE and IO_FA_CONTIGUOUS are added
+  * @retval Pointer to a IO_FileDescriptor structure, or NULL in case of error
+  * @note Without spare file, the file is created with io_create_contiguous
+  * @note Like io_create_contiguous, the file size is the size of the pool files
+  */
+IO_FileDescriptor* io_pool_acquire(IO_Pool* pool, const TCHAR* path, BYTE mode)
+{
+	TCHAR name[IO_POOL_PATH_LENGTH];
+	FRESULT res;
+	UINT i;
+
+	if ((pool == NULL) || (path == NULL))
+	{
+		return NULL;
+	}
+
+	for (i = 0; (i < pool->count) && (pool->ready[i] == 0); i++);
+	if (i == pool->count)
+	{
+		// Pool is empty: slow path
+		return io_create_contiguous(path, mode, pool->size);
+	}
+
+	pool_name(pool, i, name);
+	res = f_rename(name, path);
+	if (res == FR_EXIST)
+	{
+		// FatFs doesn't replace a file when renaming
+		res = io_unlink(path);
+		if (res == FR_OK)
+		{
+			res = f_rename(name, path);
+		}
+	}
+	if (res != FR_OK)
+	{
+		// The spare file still has its name: it stays in the pool
+		return NULL;
+	}
+	pool->ready[i] = 0;
+
+	mode &= FA_READ | IO_FA_FASTSEEK;
+	return io_open(path, mode | FA_WRITE | FA_OPEN_EXISTING | IO_FA_CONTIGUOUS);
+}
+
+/**
+  * @brief Counts spare files
+  * @param pool[IN] Pool
+  * @retval Number of spare files ready to be acquired
+  */
+UINT io_pool_available(const IO_Pool* pool)
+{
+	UINT available = 0;
+	UINT i;
+
+	if (pool == NULL)
+	{
+		return 0;
+	}
+	for (i = 0; i < pool->count; i++)
+	{
+		available += pool->ready[i];
+	}
+	return available;
+}
+
+/**
+  * @brief Computes the path of a spare file
+  * @param pool[IN] Pool
+  * @param slot[IN] Number of the spare file
+  * @param name[OUT] Path (IO_POOL_PATH_LENGTH TCHAR)
+  * @retval None
+  */
+static void pool_name(const IO_Pool* pool, UINT slot, TCHAR* name)
+{
+	UINT i;
+
+	for (i = 0; pool->prefix[i] != 0; i++)
+	{
+		name[i] = pool->prefix[i];
+	}
+	if (slot >= 10)
+	{
+		name[i++] = (TCHAR)('0' + slot / 10);
+	}
+	name[i++] = (TCHAR)('0' + slot % 10);
+	name[i] = 0;
+}
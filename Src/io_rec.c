@@ -0,0 +1,225 @@
+/** @file io_rec.c
+ *
+ * @brief This file contains source codes of the fixed-size record files
+ */
+
+#include "io_rec.h"
+
+static uint8_t rec_position(const IO_RecordFile* rf, UINT index, UINT* position);
+
+/**
+  * @brief Opens/creates a record file
+  * @param rf[OUT] Record file
+  * @param path[IN] File name
+  * @param mode[IN] Same as io_open
+  * @param recordSize[IN] Size of a record (in bytes)
+  * @param layout[IN] IO_REC_PACKED or IO_REC_PADDED
+  * @retval FRESULT: FR_INVALID_PARAMETER if recordSize is 0, or over _MAX_SS with IO_REC_PADDED, or IO_REC_PADDED with a variable sector size
+  * @note With IO_REC_PADDED, a record is always read from a single buffer window
+  */
+FRESULT io_rec_open(IO_RecordFile* rf, const TCHAR* path, BYTE mode, UINT recordSize, uint8_t layout)
+{
+	if ((rf == NULL) || (path == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+	if ((recordSize == 0) || ((layout == IO_REC_PADDED) && (recordSize > _MAX_SS)))
+	{
+		return FR_INVALID_PARAMETER;
+	}
+#if (_MAX_SS != _MIN_SS)
+	// Padding is computed with _MAX_SS: a padded sector must be a sector of the volume
+	if (layout == IO_REC_PADDED)
+	{
+		return FR_INVALID_PARAMETER;
+	}
+#endif
+
+	rf->recordSize = recordSize;
+	rf->perSector = (layout == IO_REC_PADDED) ? _MAX_SS / recordSize : 0;
+	rf->fp = io_open(path, mode);
+	if (rf->fp == NULL)
+	{
+		return FR_NO_FILE;
+	}
+	return FR_OK;
+}
+
+/**
+  * @brief Reads a record
+  * @param rf[IN] Record file
+  * @param index[IN] Record number
+  * @retval Record, in the buffer of IO API (valid until the next call on this file), NULL if it doesn't exist
+  */
+const void* io_rec_get(IO_RecordFile* rf, UINT index)
+{
+	const void* record;
+	UINT position;
+	UINT br;
+
+	if ((rf == NULL) || (rf->fp == NULL) || !rec_position(rf, index, &position))
+	{
+		return NULL;
+	}
+
+	record = io_read(rf->fp, position, rf->recordSize, &br);
+	if (br != rf->recordSize)
+	{
+		return NULL;
+	}
+	return record;
+}
+
+/**
+  * @brief Writes a record
+  * @param rf[IN] Record file
+  * @param index[IN] Record number, records between the end of the file and index are filled with zeroes
+  * @param record[IN] Record (recordSize bytes)
+  * @retval FRESULT, same as io_write_exact, FR_INVALID_PARAMETER if the record would end beyond the positions of IO API
+  */
+FRESULT io_rec_put(IO_RecordFile* rf, UINT index, const void* record)
+{
+	UINT position;
+
+	if ((rf == NULL) || (rf->fp == NULL) || (record == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+	if (!rec_position(rf, index, &position))
+	{
+		return FR_INVALID_PARAMETER;
+	}
+
+	return io_write_exact(rf->fp, record, position, rf->recordSize);
+}
+
+/**
+  * @brief Counts the records of the file
+  * @param rf[IN] Record file
+  * @param count[OUT] Number of records
+  * @retval FRESULT
+  */
+FRESULT io_rec_count(IO_RecordFile* rf, UINT* count)
+{
+	FRESULT res;
+	FSIZE_t size;
+	UINT last;
+
+	if ((rf == NULL) || (rf->fp == NULL) || (count == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+
+	res = io_size(rf->fp, &size);
+	if (res != FR_OK)
+	{
+		return res;
+	}
+
+	if (rf->perSector == 0)
+	{
+		*count = (UINT)(size / rf->recordSize);
+	}
+	else
+	{
+		last = (UINT)(size % _MAX_SS) / rf->recordSize;
+		*count = (UINT)(size / _MAX_SS) * rf->perSector + ((last < rf->perSector) ? last : rf->perSector);
+	}
+	return FR_OK;
+}
+
+/**
+  * @brief Finds a record in a file sorted in ascending order
+  * @param rf[IN] Record file
+  * @param compare[IN] Returns a negative value if the record is lower than the key, 0 if it matches, a positive value else
+  * @param key[IN] Key given to compare
+  * @param index[OUT] First record that isn't lower than the key (number of records if there is none)
+  * @retval FRESULT
+  * @note About log2(number of records) records are read
+  */
+FRESULT io_rec_bsearch(IO_RecordFile* rf, int (*compare)(const void* record, const void* key), const void* key, UINT* index)
+{
+	FRESULT res;
+	const void* record;
+	UINT low = 0;
+	UINT high;
+	UINT middle;
+
+	if ((compare == NULL) || (index == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+
+	res = io_rec_count(rf, &high);
+	if (res != FR_OK)
+	{
+		return res;
+	}
+
+	while (low < high)
+	{
+		middle = low + (high - low) / 2;
+		record = io_rec_get(rf, middle);
+		if (record == NULL)
+		{
+			return FR_DISK_ERR;
+		}
+		if (compare(record, key) < 0)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+	*index = low;
+	return FR_OK;
+}
+
+/**
+  * @brief Closes a record file
+  * @param rf[IN] Record file
+  * @retval FRESULT, same as io_close
+  */
+FRESULT io_rec_close(IO_RecordFile* rf)
+{
+	FRESULT res;
+
+	if ((rf == NULL) || (rf->fp == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+	res = io_close(rf->fp);
+	rf->fp = NULL;
+	return res;
+}
+
+/**
+  * @brief Computes the position of a record in the file
+  * @param rf[IN] Record file
+  * @param index[IN] Record number
+  * @param position[OUT] Position (in bytes)
+  * @retval 1 if the whole record can be reached with a UINT position, 0 else
+  */
+static uint8_t rec_position(const IO_RecordFile* rf, UINT index, UINT* position)
+{
+	uint64_t begin;
+
+	if (rf->perSector == 0)
+	{
+		begin = (uint64_t)index * rf->recordSize;
+	}
+	else
+	{
+		begin = (uint64_t)(index / rf->perSector) * _MAX_SS + (uint64_t)(index % rf->perSector) * rf->recordSize;
+	}
+
+	// The computation in UINT would wrap and give the position of an earlier record
+	if (begin + rf->recordSize - 1 > (UINT)~(UINT)0)
+	{
+		return 0;
+	}
+	*position = (UINT)begin;
+	return 1;
+}
@@ -0,0 +1,326 @@
+/** @file io_ring.c
+ *
+ * @brief This file contains source codes of the circular log files
+ */
+
+#include "io_ring.h"
+
+static FRESULT ring_write_header(IO_Ring* ring);
+
+/**
+  * @brief Creates an empty ring file
+  * @param ring[OUT] Ring
+  * @param path[IN] File name (an existing file is deleted)
+  * @param capacity[IN] Size of the data area (in bytes), rounded up to a multiple of _MAX_SS
+  * @retval FRESULT: FR_DENIED if the contiguous file couldn't be created
+  * @note The file is created with io_create_contiguous: appending data never allocates clusters
+  */
+FRESULT io_ring_create(IO_Ring* ring, const TCHAR* path, UINT capacity)
+{
+	FRESULT res;
+
+	if ((ring == NULL) || (path == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+	if (capacity == 0)
+	{
+		return FR_INVALID_PARAMETER;
+	}
+
+	ring->dataOffset = _MAX_SS;
+	ring->capacity = (capacity + _MAX_SS - 1) & ~((UINT)_MAX_SS - 1);
+	ring->head = 0;
+	ring->used = 0;
+	ring->cursor = 0;
+	ring->fp = io_create_contiguous(path, FA_READ, (FSIZE_t)ring->dataOffset + ring->capacity);
+	if (ring->fp == NULL)
+	{
+		return FR_DENIED;
+	}
+
+	res = ring_write_header(ring);
+	if (res == FR_OK)
+	{
+		res = io_sync(ring->fp);
+	}
+	if (res != FR_OK)
+	{
+		io_close(ring->fp);
+		ring->fp = NULL;
+	}
+	return res;
+}
+
+/**
+  * @brief Opens an existing ring file
+  * @param ring[OUT] Ring
+  * @param path[IN] File name
+  * @retval FRESULT: FR_NO_FILE if the file doesn't exist, FR_INVALID_OBJECT if its header isn't valid
+  * @note Data appended after the last io_ring_sync or io_ring_close is lost
+  */
+FRESULT io_ring_open(IO_Ring* ring, const TCHAR* path)
+{
+	FRESULT res;
+	FSIZE_t size;
+	uint8_t header[IO_RING_HEADER_SIZE];
+
+	if ((ring == NULL) || (path == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+
+	ring->fp = io_open(path, FA_READ | FA_WRITE | FA_OPEN_EXISTING | IO_FA_CONTIGUOUS);
+	if (ring->fp == NULL)
+	{
+		return FR_NO_FILE;
+	}
+
+	ring->dataOffset = _MAX_SS;
+	ring->capacity = 0;
+	res = io_read_exact(ring->fp, header, 0, IO_RING_HEADER_SIZE);
+	if (res == FR_OK)
+	{
+		res = io_size(ring->fp, &size);
+	}
+	if (res == FR_OK)
+	{
+		ring->capacity = io_load_le32(&header[4]);
+		ring->head = io_load_le32(&header[8]);
+		ring->used = io_load_le32(&header[12]);
+		if ((io_load_le32(&header[0]) != IO_RING_MAGIC) || (ring->capacity == 0) || (ring->capacity % _MAX_SS != 0)
+				|| ((FSIZE_t)ring->dataOffset + ring->capacity != size)
+				|| (ring->head >= ring->capacity) || (ring->used > ring->capacity))
+		{
+			res = FR_INVALID_OBJECT;
+		}
+	}
+	if (res != FR_OK)
+	{
+		io_close(ring->fp);
+		ring->fp = NULL;
+		return res;
+	}
+
+	ring->cursor = 0;
+	ring->headerDirty = 0;
+	return FR_OK;
+}
+
+/**
+  * @brief Appends data after the newest byte, and drops the oldest data if the ring is full
+  * @param ring[IN] Ring
+  * @param data[IN] Data to append
+  * @param length[IN] Number of bytes (at most the capacity)
+  * @retval FRESULT: FR_INVALID_PARAMETER if length is over the capacity
+  * @note Old data is dropped by whole sectors, so the oldest byte always starts a sector
+  * @note The header is written by io_ring_sync and io_ring_close, and when old data is dropped: the ring is synced
+  * before the dropped sectors are overwritten, so that the header never covers them after a power loss
+  */
+FRESULT io_ring_append(IO_Ring* ring, const void* data, UINT length)
+{
+	FRESULT res;
+	UINT drop;
+	UINT tail;
+	UINT first;
+
+	if ((ring == NULL) || (ring->fp == NULL) || ((data == NULL) && (length != 0)))
+	{
+		return FR_INVALID_OBJECT;
+	}
+	if (length > ring->capacity)
+	{
+		return FR_INVALID_PARAMETER;
+	}
+	if (length == 0)
+	{
+		return FR_OK;
+	}
+
+	// Make room by dropping the oldest sectors
+	if (ring->used + length > ring->capacity)
+	{
+		drop = (ring->used + length - ring->capacity + _MAX_SS - 1) & ~((UINT)_MAX_SS - 1);
+		if (drop >= ring->used)
+		{
+			// Everything is dropped: the ring starts again at the beginning of the sector holding the newest byte
+			ring->head = ((ring->head + ring->used) % ring->capacity) & ~((UINT)_MAX_SS - 1);
+			ring->used = 0;
+			ring->cursor = 0;
+		}
+		else
+		{
+			ring->head = (ring->head + drop) % ring->capacity;
+			ring->used -= drop;
+			ring->cursor = (ring->cursor > drop) ? ring->cursor - drop : 0;
+		}
+		ring->headerDirty = 1;
+
+		res = io_ring_sync(ring);
+		if (res != FR_OK)
+		{
+			return res;
+		}
+	}
+
+	// Write at the tail, in two parts if the end of the data area is reached
+	tail = (ring->head + ring->used) % ring->capacity;
+	first = ring->capacity - tail;
+	if (first > length)
+	{
+		first = length;
+	}
+	res = io_write_exact(ring->fp, (const uint8_t*)data, ring->dataOffset + tail, first);
+	if ((res == FR_OK) && (first < length))
+	{
+		res = io_write_exact(ring->fp, (const uint8_t*)data + first, ring->dataOffset, length - first);
+	}
+	if (res != FR_OK)
+	{
+		return res;
+	}
+
+	ring->used += length;
+	ring->headerDirty = 1;
+	return FR_OK;
+}
+
+/**
+  * @brief Reads data from the oldest to the newest byte
+  * @param ring[IN] Ring
+  * @param buff[OUT] Buffer
+  * @param btr[IN] Number of bytes to read
+  * @param br[OUT] Number of bytes read, less than btr when the newest byte is reached
+  * @retval FRESULT
+  * @note Each call continues where the previous one stopped, io_ring_rewind goes back to the oldest byte
+  */
+FRESULT io_ring_read(IO_Ring* ring, void* buff, UINT btr, UINT* br)
+{
+	FRESULT res;
+	UINT start;
+	UINT first;
+
+	if ((ring == NULL) || (ring->fp == NULL) || (buff == NULL) || (br == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+
+	*br = 0;
+	if (btr > ring->used - ring->cursor)
+	{
+		btr = ring->used - ring->cursor;
+	}
+	if (btr == 0)
+	{
+		return FR_OK;
+	}
+
+	start = (ring->head + ring->cursor) % ring->capacity;
+	first = ring->capacity - start;
+	if (first > btr)
+	{
+		first = btr;
+	}
+	res = io_read_exact(ring->fp, (uint8_t*)buff, ring->dataOffset + start, first);
+	if ((res == FR_OK) && (first < btr))
+	{
+		res = io_read_exact(ring->fp, (uint8_t*)buff + first, ring->dataOffset, btr - first);
+	}
+	if (res != FR_OK)
+	{
+		return res;
+	}
+
+	ring->cursor += btr;
+	*br = btr;
+	return FR_OK;
+}
+
+/**
+  * @brief Moves the reading position back to the oldest byte
+  * @param ring[IN] Ring
+  * @retval FRESULT
+  */
+FRESULT io_ring_rewind(IO_Ring* ring)
+{
+	if ((ring == NULL) || (ring->fp == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+	ring->cursor = 0;
+	return FR_OK;
+}
+
+/**
+  * @brief Saves appended data, then the header
+  * @param ring[IN] Ring
+  * @retval FRESULT
+  * @note Data is saved before the header, so the header never covers data that isn't on the disk
+  */
+FRESULT io_ring_sync(IO_Ring* ring)
+{
+	FRESULT res;
+
+	if ((ring == NULL) || (ring->fp == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+	if (ring->headerDirty == 0)
+	{
+		return io_sync(ring->fp);
+	}
+
+	res = io_sync(ring->fp);
+	if (res == FR_OK)
+	{
+		res = ring_write_header(ring);
+	}
+	if (res == FR_OK)
+	{
+		res = io_sync(ring->fp);
+	}
+	return res;
+}
+
+/**
+  * @brief Saves the ring and closes its file
+  * @param ring[IN] Ring
+  * @retval FRESULT
+  */
+FRESULT io_ring_close(IO_Ring* ring)
+{
+	FRESULT res;
+	FRESULT resClose;
+
+	if ((ring == NULL) || (ring->fp == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+
+	res = io_ring_sync(ring);
+	resClose = io_close(ring->fp);
+	ring->fp = NULL;
+	return (res != FR_OK) ? res : resClose;
+}
+
+/**
+  * @brief Writes the header at the beginning of the file
+  * @param ring[IN] Ring
+  * @retval FRESULT
+  */
+static FRESULT ring_write_header(IO_Ring* ring)
+{
+	uint8_t header[IO_RING_HEADER_SIZE];
+	FRESULT res;
+
+	io_store_le32(&header[0], IO_RING_MAGIC);
+	io_store_le32(&header[4], ring->capacity);
+	io_store_le32(&header[8], ring->head);
+	io_store_le32(&header[12], ring->used);
+	res = io_write_exact(ring->fp, header, 0, IO_RING_HEADER_SIZE);
+	if (res == FR_OK)
+	{
+		ring->headerDirty = 0;
+	}
+	return res;
+}
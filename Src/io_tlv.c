@@ -0,0 +1,316 @@
+/** @file io_tlv.c
+ *
+ * @brief This file contains source codes of the sector-framed TLV logs
+ */
+
+#include "io_tlv.h"
+#include <string.h>
+
+static FRESULT tlv_emit(IO_TlvWriter* writer, uint8_t next);
+static FRESULT tlv_resync(IO_TlvReader* reader);
+static FRESULT tlv_frames(IO_FileDescriptor* fp, UINT* frames);
+
+/**
+  * @brief Prepares a writer to append records to a file
+  * @param writer[OUT] Writer
+  * @param fp[IN] File opened with FA_WRITE
+  * @retval FRESULT
+  * @note Records are appended from the next frame boundary: a partial frame at the end of the file isn't completed
+  */
+FRESULT io_tlv_writer_init(IO_TlvWriter* writer, IO_FileDescriptor* fp)
+{
+	FRESULT res;
+
+	if ((writer == NULL) || (fp == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+
+	writer->fp = fp;
+	res = tlv_frames(fp, &writer->frame);
+	writer->fill = IO_TLV_FRAME_HEADER;
+	writer->first = IO_TLV_NO_RECORD;
+	writer->count = 0;
+	memset(writer->buffer, 0, _MAX_SS);
+	return res;
+}
+
+/**
+  * @brief Appends a record
+  * @param writer[IN] Writer
+  * @param type[IN] Record type (1 to 255)
+  * @param value[IN] Value
+  * @param length[IN] Length of the value (in bytes, at most 65535)
+  * @retval FRESULT: FR_INVALID_PARAMETER if type or length aren't valid
+  * @note Full frames are written with io_write, the frame being filled stays in the writer until io_tlv_flush
+  */
+FRESULT io_tlv_write(IO_TlvWriter* writer, uint8_t type, const void* value, UINT length)
+{
+	FRESULT res;
+	const uint8_t* ptr = (const uint8_t*)value;
+	UINT part;
+
+	if ((writer == NULL) || (writer->fp == NULL) || ((value == NULL) && (length != 0)))
+	{
+		return FR_INVALID_OBJECT;
+	}
+	if ((type == IO_TLV_END) || (length > 0xFFFF))
+	{
+		return FR_INVALID_PARAMETER;
+	}
+
+	// Record headers are never split: the end of the frame is left as padding
+	if (writer->fill + IO_TLV_RECORD_HEADER > _MAX_SS)
+	{
+		res = tlv_emit(writer, 1);
+		if (res != FR_OK)
+		{
+			return res;
+		}
+	}
+
+	if (writer->first == IO_TLV_NO_RECORD)
+	{
+		writer->first = (uint16_t)writer->fill;
+	}
+	writer->count++;
+	writer->buffer[writer->fill] = type;
+	io_store_le16(&writer->buffer[writer->fill + 1], (uint16_t)length);
+	writer->fill += IO_TLV_RECORD_HEADER;
+
+	// The value continues in the next frames, after their header
+	do
+	{
+		part = _MAX_SS - writer->fill;
+		if (part > length)
+		{
+			part = length;
+		}
+		memcpy(&writer->buffer[writer->fill], ptr, part);
+		writer->fill += part;
+		ptr += part;
+		length -= part;
+		if (writer->fill == _MAX_SS)
+		{
+			res = tlv_emit(writer, 1);
+			if (res != FR_OK)
+			{
+				return res;
+			}
+		}
+	} while (length != 0);
+	return FR_OK;
+}
+
+/**
+  * @brief Writes the frame being filled and saves the file
+  * @param writer[IN] Writer
+  * @retval FRESULT
+  * @note Next records are added to the same frame, which is written again
+  */
+FRESULT io_tlv_flush(IO_TlvWriter* writer)
+{
+	FRESULT res = FR_OK;
+
+	if ((writer == NULL) || (writer->fp == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+	if (writer->fill != IO_TLV_FRAME_HEADER)
+	{
+		res = tlv_emit(writer, 0);
+	}
+	if (res == FR_OK)
+	{
+		res = io_sync(writer->fp);
+	}
+	return res;
+}
+
+/**
+  * @brief Prepares a reader to read records from a frame
+  * @param reader[OUT] Reader
+  * @param fp[IN] File
+  * @param frame[IN] Frame number (position in the file / _MAX_SS)
+  * @retval FRESULT
+  * @note Reading starts at the first record starting in this frame, or in the next frames
+  */
+FRESULT io_tlv_seek(IO_TlvReader* reader, IO_FileDescriptor* fp, UINT frame)
+{
+	if ((reader == NULL) || (fp == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+
+	reader->fp = fp;
+	reader->frame = frame;
+	return tlv_resync(reader);
+}
+
+/**
+  * @brief Reads the next record
+  * @param reader[IN] Reader
+  * @param type[OUT] Record type, IO_TLV_END at the end of the file
+  * @param buff[OUT] Value, only the first size bytes are copied
+  * @param size[IN] Size of buff (in bytes)
+  * @param length[OUT] Length of the value (may be over size)
+  * @retval FRESULT
+  */
+FRESULT io_tlv_read(IO_TlvReader* reader, uint8_t* type, void* buff, UINT size, UINT* length)
+{
+	FRESULT res;
+	uint8_t header[IO_TLV_RECORD_HEADER];
+	uint8_t* ptr = (uint8_t*)buff;
+	UINT frames;
+	UINT remaining;
+	UINT part;
+
+	if ((reader == NULL) || (reader->fp == NULL) || (type == NULL) || (length == NULL) || ((buff == NULL) && (size != 0)))
+	{
+		return FR_INVALID_OBJECT;
+	}
+
+	*type = IO_TLV_END;
+	*length = 0;
+	res = tlv_frames(reader->fp, &frames);
+	while (res == FR_OK)
+	{
+		if (reader->frame >= frames)
+		{
+			return FR_OK;
+		}
+		if (reader->offset + IO_TLV_RECORD_HEADER <= _MAX_SS)
+		{
+			res = io_read_exact(reader->fp, header, reader->frame * _MAX_SS + reader->offset, IO_TLV_RECORD_HEADER);
+			if ((res != FR_OK) || (header[0] != IO_TLV_END))
+			{
+				break;
+			}
+		}
+		// Padding: the next record is in the next frame
+		reader->frame++;
+		res = tlv_resync(reader);
+	}
+	if (res != FR_OK)
+	{
+		return res;
+	}
+
+	*type = header[0];
+	*length = io_load_le16(&header[1]);
+	reader->offset += IO_TLV_RECORD_HEADER;
+	remaining = *length;
+	while (remaining != 0)
+	{
+		if (reader->offset == _MAX_SS)
+		{
+			reader->frame++;
+			reader->offset = IO_TLV_FRAME_HEADER;
+		}
+		part = _MAX_SS - reader->offset;
+		if (part > remaining)
+		{
+			part = remaining;
+		}
+		if (size != 0)
+		{
+			res = io_read_exact(reader->fp, ptr, reader->frame * _MAX_SS + reader->offset, (part < size) ? part : size);
+			if (res != FR_OK)
+			{
+				return res;
+			}
+			ptr += (part < size) ? part : size;
+			size -= (part < size) ? part : size;
+		}
+		reader->offset += part;
+		remaining -= part;
+	}
+	if (reader->offset == _MAX_SS)
+	{
+		reader->frame++;
+		reader->offset = IO_TLV_FRAME_HEADER;
+	}
+	return FR_OK;
+}
+
+/**
+  * @brief Writes the frame being filled, with its header
+  * @param writer[IN] Writer
+  * @param next[IN] Bool telling if the frame is complete: the writer then starts the next frame
+  * @retval FRESULT
+  */
+static FRESULT tlv_emit(IO_TlvWriter* writer, uint8_t next)
+{
+	FRESULT res;
+
+	io_store_le16(&writer->buffer[0], writer->first);
+	io_store_le16(&writer->buffer[2], writer->count);
+	res = io_write_exact(writer->fp, writer->buffer, writer->frame * _MAX_SS, _MAX_SS);
+	if ((res == FR_OK) && next)
+	{
+		writer->frame++;
+		writer->fill = IO_TLV_FRAME_HEADER;
+		writer->first = IO_TLV_NO_RECORD;
+		writer->count = 0;
+		memset(writer->buffer, 0, _MAX_SS);
+	}
+	return res;
+}
+
+/**
+  * @brief Finds the first record starting in the current frame or in the next frames
+  * @param reader[IN] Reader
+  * @retval FRESULT
+  * @note At the end of the file, frame is the number of frames
+  */
+static FRESULT tlv_resync(IO_TlvReader* reader)
+{
+	FRESULT res;
+	uint8_t header[IO_TLV_FRAME_HEADER];
+	UINT frames;
+	UINT first;
+
+	reader->offset = IO_TLV_FRAME_HEADER;
+	res = tlv_frames(reader->fp, &frames);
+	while ((res == FR_OK) && (reader->frame < frames))
+	{
+		res = io_read_exact(reader->fp, header, reader->frame * _MAX_SS, IO_TLV_FRAME_HEADER);
+		if (res != FR_OK)
+		{
+			break;
+		}
+		first = io_load_le16(&header[0]);
+		if (first != IO_TLV_NO_RECORD)
+		{
+			if ((first < IO_TLV_FRAME_HEADER) || (first > _MAX_SS - IO_TLV_RECORD_HEADER))
+			{
+				// Not a frame
+				return FR_INVALID_OBJECT;
+			}
+			reader->offset = first;
+			break;
+		}
+		reader->frame++;
+	}
+	if (reader->frame > frames)
+	{
+		reader->frame = frames;
+	}
+	return res;
+}
+
+/**
+  * @brief Computes the number of frames of a file
+  * @param fp[IN] File
+  * @param frames[OUT] Number of frames, a partial frame counts as a whole one
+  * @retval FRESULT
+  */
+static FRESULT tlv_frames(IO_FileDescriptor* fp, UINT* frames)
+{
+	FRESULT res;
+	FSIZE_t size;
+
+	res = io_size(fp, &size);
+	*frames = (res == FR_OK) ? (UINT)((size + _MAX_SS - 1) / _MAX_SS) : 0;
+	return res;
+}
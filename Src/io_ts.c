@@ -0,0 +1,265 @@
+/** @file io_ts.c
+ *
+ * @brief This file contains source codes of the time-indexed logs
+ */
+
+#include "io_ts.h"
+
+static FRESULT ts_add_entry(IO_TimeLog* log, UINT record, uint32_t timestamp);
+static int ts_compare(const void* entry, const void* key);
+
+/**
+  * @brief Opens/creates a time-indexed log and its index file
+  * @param log[OUT] Log
+  * @param path[IN] Name of the data file
+  * @param indexPath[IN] Name of the index file
+  * @param recordSize[IN] Size of a record (4 to _MAX_SS bytes), starting with its timestamp
+  * @param interval[IN] Number of data sectors between two index entries
+  * @retval FRESULT: FR_INVALID_PARAMETER if recordSize or interval aren't valid
+  * @note Index entries missing after a power loss are added, extra entries are removed
+  */
+FRESULT io_ts_open(IO_TimeLog* log, const TCHAR* path, const TCHAR* indexPath, UINT recordSize, UINT interval)
+{
+	FRESULT res;
+	const uint8_t* record;
+	UINT group;
+	UINT entries;
+	UINT expected;
+
+	if ((log == NULL) || (path == NULL) || (indexPath == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+	if ((recordSize < 4) || (interval == 0))
+	{
+		return FR_INVALID_PARAMETER;
+	}
+
+	res = io_rec_open(&log->data, path, FA_READ | FA_WRITE | FA_OPEN_ALWAYS, recordSize, IO_REC_PADDED);
+	if (res != FR_OK)
+	{
+		return res;
+	}
+	res = io_rec_open(&log->index, indexPath, FA_READ | FA_WRITE | FA_OPEN_ALWAYS, IO_TS_INDEX_ENTRY, IO_REC_PACKED);
+	if (res != FR_OK)
+	{
+		io_rec_close(&log->data);
+		return res;
+	}
+
+	log->interval = interval;
+	log->lastTime = 0;
+	log->endTime = 0;
+	group = log->data.perSector * interval;
+	res = io_rec_count(&log->data, &log->count);
+	if (res == FR_OK)
+	{
+		res = io_rec_count(&log->index, &entries);
+	}
+
+	// The index must have an entry per group of records
+	expected = (log->count + group - 1) / group;
+	if ((res == FR_OK) && (entries > expected))
+	{
+		res = io_truncate(log->index.fp, (FSIZE_t)expected * IO_TS_INDEX_ENTRY);
+	}
+	for (; (res == FR_OK) && (entries < expected); entries++)
+	{
+		record = (const uint8_t*)io_rec_get(&log->data, entries * group);
+		res = (record != NULL) ? ts_add_entry(log, entries * group, io_load_le32(record)) : FR_DISK_ERR;
+	}
+
+	if ((res == FR_OK) && (log->count != 0))
+	{
+		record = (const uint8_t*)io_rec_get(&log->data, log->count - 1);
+		if (record == NULL)
+		{
+			res = FR_DISK_ERR;
+		}
+		else
+		{
+			log->lastTime = io_load_le32(record);
+		}
+	}
+	if (res != FR_OK)
+	{
+		io_rec_close(&log->index);
+		io_rec_close(&log->data);
+		return res;
+	}
+
+	log->cursor = log->count;
+	return FR_OK;
+}
+
+/**
+  * @brief Appends a record
+  * @param log[IN] Log
+  * @param record[IN] Record (recordSize bytes), starting with its timestamp (little-endian 32-bit word)
+  * @retval FRESULT: FR_INVALID_PARAMETER if the timestamp is lower than the previous one
+  */
+FRESULT io_ts_append(IO_TimeLog* log, const void* record)
+{
+	FRESULT res;
+	uint32_t timestamp;
+
+	if ((log == NULL) || (log->data.fp == NULL) || (record == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+
+	timestamp = io_load_le32((const uint8_t*)record);
+	if ((log->count != 0) && (timestamp < log->lastTime))
+	{
+		return FR_INVALID_PARAMETER;
+	}
+
+	res = io_rec_put(&log->data, log->count, record);
+	if ((res == FR_OK) && (log->count % (log->data.perSector * log->interval) == 0))
+	{
+		res = ts_add_entry(log, log->count, timestamp);
+	}
+	if (res != FR_OK)
+	{
+		return res;
+	}
+
+	log->count++;
+	log->lastTime = timestamp;
+	return FR_OK;
+}
+
+/**
+  * @brief Selects the records of a time range, read with io_ts_next
+  * @param log[IN] Log
+  * @param begin[IN] First timestamp of the range
+  * @param end[IN] Last timestamp of the range
+  * @retval FRESULT: FR_INVALID_PARAMETER if begin is over end
+  * @note The index is searched with a binary search, then at most interval sectors of records are read before the range
+  */
+FRESULT io_ts_query(IO_TimeLog* log, uint32_t begin, uint32_t end)
+{
+	FRESULT res;
+	const uint8_t* ptr;
+	UINT entry;
+
+	if ((log == NULL) || (log->data.fp == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+	if (begin > end)
+	{
+		return FR_INVALID_PARAMETER;
+	}
+
+	log->cursor = 0;
+	log->endTime = end;
+	if (log->count == 0)
+	{
+		return FR_OK;
+	}
+
+	// Records equal to begin may be in the group before the first entry that isn't lower than begin
+	res = io_rec_bsearch(&log->index, ts_compare, &begin, &entry);
+	if (res != FR_OK)
+	{
+		return res;
+	}
+	if (entry != 0)
+	{
+		ptr = (const uint8_t*)io_rec_get(&log->index, entry - 1);
+		if (ptr == NULL)
+		{
+			return FR_DISK_ERR;
+		}
+		log->cursor = io_load_le32(&ptr[4]) * log->data.perSector;
+	}
+
+	for (; log->cursor < log->count; log->cursor++)
+	{
+		ptr = (const uint8_t*)io_rec_get(&log->data, log->cursor);
+		if (ptr == NULL)
+		{
+			return FR_DISK_ERR;
+		}
+		if (io_load_le32(ptr) >= begin)
+		{
+			break;
+		}
+	}
+	return FR_OK;
+}
+
+/**
+  * @brief Gives the next record of the range selected by io_ts_query
+  * @param log[IN] Log
+  * @retval Record, in the buffer of IO API (valid until the next call on this log), NULL at the end of the range
+  */
+const void* io_ts_next(IO_TimeLog* log)
+{
+	const uint8_t* record;
+
+	if ((log == NULL) || (log->data.fp == NULL) || (log->cursor >= log->count))
+	{
+		return NULL;
+	}
+
+	record = (const uint8_t*)io_rec_get(&log->data, log->cursor);
+	if ((record == NULL) || (io_load_le32(record) > log->endTime))
+	{
+		log->cursor = log->count;
+		return NULL;
+	}
+	log->cursor++;
+	return record;
+}
+
+/**
+  * @brief Closes the data and index files
+  * @param log[IN] Log
+  * @retval FRESULT
+  */
+FRESULT io_ts_close(IO_TimeLog* log)
+{
+	FRESULT res;
+	FRESULT resIndex;
+
+	if ((log == NULL) || (log->data.fp == NULL))
+	{
+		return FR_INVALID_OBJECT;
+	}
+	res = io_rec_close(&log->data);
+	resIndex = io_rec_close(&log->index);
+	return (res != FR_OK) ? res : resIndex;
+}
+
+/**
+  * @brief Writes the index entry of a group of records
+  * @param log[IN] Log
+  * @param record[IN] First record of the group
+  * @param timestamp[IN] Timestamp of this record
+  * @retval FRESULT
+  */
+static FRESULT ts_add_entry(IO_TimeLog* log, UINT record, uint32_t timestamp)
+{
+	uint8_t entry[IO_TS_INDEX_ENTRY];
+	UINT group = log->data.perSector * log->interval;
+
+	io_store_le32(&entry[0], timestamp);
+	io_store_le32(&entry[4], record / log->data.perSector);
+	return io_rec_put(&log->index, record / group, entry);
+}
+
+/**
+  * @brief Compares the timestamp of an index entry to a timestamp, for io_rec_bsearch
+  * @param entry[IN] Index entry
+  * @param key[IN] Timestamp (uint32_t)
+  * @retval Negative value if the entry is lower, 0 if it matches, positive value else
+  */
+static int ts_compare(const void* entry, const void* key)
+{
+	uint32_t timestamp = io_load_le32((const uint8_t*)entry);
+	uint32_t target = *(const uint32_t*)key;
+
+	return (timestamp < target) ? -1 : ((timestamp > target) ? 1 : 0);
+}
@@ -0,0 +1,119 @@
+#include "diskio.h"
+#include "ff.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string.h>
+
+/* Each file opened by the fake f_open has its own area of the fake disk (see fake_disk_map in ff.c) */
+extern int fake_disk_map(DWORD sector, off_t* offset);
+
+unsigned int fakeTrimCount = 0;   /* Number of CTRL_TRIM requests */
+unsigned int fakeTrimSectors = 0; /* Number of sectors discarded by CTRL_TRIM requests */
+const BYTE* fakeFatImage = NULL;  /* Contents of the FAT sectors (fs->fatbase to fs->fatbase + fs->fsize), NULL if there is no FAT */
+extern FATFS* fs;
+
+DSTATUS disk_initialize (BYTE pdrv)
+{
+	(void)(pdrv);
+	return 0;
+}
+
+DSTATUS disk_status (BYTE pdrv)
+{
+	(void)(pdrv);
+	return 0;
+}
+
+DRESULT disk_read (BYTE pdrv, BYTE* buff, DWORD sector, UINT count)
+{
+	ssize_t res;
+	off_t offset;
+	int fd = fake_disk_map(sector, &offset);
+	(void)(pdrv);
+	
+	if ((fakeFatImage != NULL) && (sector >= fs->fatbase) && (sector + count <= fs->fatbase + fs->fsize))
+	{
+		memcpy(buff, fakeFatImage + (sector - fs->fatbase) * _MAX_SS, count * _MAX_SS);
+		return RES_OK;
+	}
+	if (fd == -1)
+	{
+		return RES_PARERR;
+	}
+	
+	res = pread(fd, buff, count * _MAX_SS, offset);
+	if (res == -1)
+	{
+		return RES_ERROR;
+	}
+	
+	// Sectors after the end of the file contain garbage
+	memset(buff + res, 0xA5, count * _MAX_SS - (size_t)res);
+	return RES_OK;
+}
+
+DRESULT disk_write (BYTE pdrv, const BYTE* buff, DWORD sector, UINT count)
+{
+	struct stat statbuf;
+	struct timespec times[2];
+	off_t size;
+	off_t offset;
+	size_t length = count * _MAX_SS;
+	int fd = fake_disk_map(sector, &offset);
+	(void)(pdrv);
+	
+	if (fd == -1)
+	{
+		return RES_PARERR;
+	}
+	
+	// Writing sectors doesn't change the size of the file
+	if (fstat(fd, &statbuf) != 0)
+	{
+		return RES_ERROR;
+	}
+	size = statbuf.st_size;
+	if (offset >= size)
+	{
+		return RES_OK;
+	}
+	if ((off_t)(offset + length) > size)
+	{
+		length = (size_t)(size - offset);
+	}
+	
+	if (pwrite(fd, buff, length, offset) != (ssize_t)length)
+	{
+		return RES_ERROR;
+	}
+	
+	// Writing sectors doesn't change the directory entry of the file either (f_sync does it)
+	times[0].tv_nsec = UTIME_OMIT;
+	times[1] = statbuf.st_mtim;
+	futimens(fd, times);
+	return RES_OK;
+}
+
+DRESULT disk_ioctl (BYTE pdrv, BYTE cmd, void* buff)
+{
+	(void)(pdrv);
+	
+	if (cmd == CTRL_SYNC)
+	{
+		sync();
+		return RES_OK;
+	}
+	if (cmd == CTRL_TRIM)
+	{
+		DWORD* range = (DWORD*)buff;
+		if (range[1] < range[0])
+		{
+			return RES_PARERR;
+		}
+		fakeTrimCount++;
+		fakeTrimSectors += range[1] - range[0] + 1;
+		return RES_OK;
+	}
+	return RES_PARERR;
+}
@@ -7,6 +7,9 @@
 #include <stdio.h>
 #include "fatfs.h"
 #include <sys/vfs.h>
+#include <sys/time.h>
+#include <time.h>
+#include <string.h>
 
 FIL* file;
 int fileDescriptor;
@@ -15,10 +18,51 @@ FATFS fsvar;
 FATFS *fs = &fsvar;
 _FDID obj;
 const TCHAR* pathvar;
+unsigned int fakeLseekCount = 0;    /* Number of f_lseek calls */
+unsigned int fakeTransferCount = 0; /* Number of f_read, f_write and f_forward calls */
+DWORD fakeExpandStart = 0;          /* Value of fs->last_clst (where FatFs starts looking for free clusters) at the last f_expand call */
+
+#define FAKE_CLUSTER 32 /* Cluster size (in bytes) */
+#define FAKE_MAX_FILES 4 /* Number of files that can be opened at the same time */
+#define FAKE_FILE_CLUSTERS 0x10000 /* Number of clusters reserved for each open file on the fake disk */
+#define FA_MODIFIED 0x40 /* Same value as in FatFs ff.c: the timestamp of the file is updated by f_sync */
+
+FIL* fakeFiles[FAKE_MAX_FILES];
+int fakeFileDescriptors[FAKE_MAX_FILES];
+
+/* Makes fileDescriptor refer to the file opened with the fp object */
+static void select_file(FIL* fp)
+{
+	UINT i;
+	file = fp;
+	for (i = 0; i < FAKE_MAX_FILES; i++)
+	{
+		if (fakeFiles[i] == fp)
+		{
+			fileDescriptor = fakeFileDescriptors[i];
+			return;
+		}
+	}
+	fileDescriptor = -1;
+}
+
+/* Finds the file and the offset of a sector of the fake disk (used by diskio.c), returns -1 if there is no file */
+int fake_disk_map(DWORD sector, off_t* offset)
+{
+	DWORD index = (sector - fs->database) / (FAKE_FILE_CLUSTERS * fs->csize);
+	
+	if ((sector < fs->database) || (index >= FAKE_MAX_FILES) || (fakeFiles[index] == NULL))
+	{
+		return -1;
+	}
+	*offset = (off_t)((sector - fs->database) % (FAKE_FILE_CLUSTERS * fs->csize)) * _MAX_SS;
+	return fakeFileDescriptors[index];
+}
 
 FRESULT f_open (FIL* fp, const TCHAR* path, BYTE mode)
 {
 	int flags;
+	UINT slot;
 	
 	if ((mode & FA_WRITE) && !(mode & FA_READ))
 	{
@@ -34,9 +78,32 @@ FRESULT f_open (FIL* fp, const TCHAR* path, BYTE mode)
 	}
 	flags |= O_CREAT;
 	
+	// Each open file gets its own area of the fake disk (see diskio.c)
+	for (slot = 0; (slot < FAKE_MAX_FILES) && (fakeFiles[slot] != NULL) && (fakeFiles[slot] != fp); slot++);
+	if (slot == FAKE_MAX_FILES)
+	{
+		return FR_TOO_MANY_OPEN_FILES;
+	}
+	
 	file = fp;
 	fileDescriptor = open((const char *)path, flags, S_IRUSR | S_IWUSR | S_IXUSR);
 	
+	// Initializing file system object:
+	fp->obj.fs = fs;
+	fp->obj.sclust = 2 + slot * FAKE_FILE_CLUSTERS;
+	fp->flag = mode & (FA_READ | FA_WRITE);
+	fs->csize = FAKE_CLUSTER / _MAX_SS;
+	fs->database = 100;
+	fs->drv = 0;
+#if _FS_TINY
+	fs->winsect = 0;
+#else
+	fp->sect = 0;
+#endif
+#if _USE_FASTSEEK
+	fp->cltbl = 0;
+#endif
+	
 	// Initializing sector size :
 	#if (_MAX_SS != _MIN_SS)
 		fp->obj.fs->ssize = FAKE_SSIZE;
@@ -44,6 +111,8 @@ FRESULT f_open (FIL* fp, const TCHAR* path, BYTE mode)
 	
 	if (fileDescriptor != -1)
 	{
+		fakeFiles[slot] = fp;
+		fakeFileDescriptors[slot] = fileDescriptor;
 		return FR_OK;
 	}
 	return FR_INT_ERR;
@@ -51,7 +120,21 @@ FRESULT f_open (FIL* fp, const TCHAR* path, BYTE mode)
 
 FRESULT f_close (FIL* fp)
 {
-	file = fp;
+	UINT i;
+	select_file(fp);
+	
+	// Like FatFs f_close (f_sync), the timestamp of a modified file is updated
+	if (fp->flag & FA_MODIFIED)
+	{
+		futimens(fileDescriptor, NULL);
+	}
+	for (i = 0; i < FAKE_MAX_FILES; i++)
+	{
+		if (fakeFiles[i] == fp)
+		{
+			fakeFiles[i] = NULL;
+		}
+	}
 	fileDescriptor = close(fileDescriptor);
 	
 	if (fileDescriptor != -1)
@@ -64,7 +147,8 @@ FRESULT f_close (FIL* fp)
 FRESULT f_read (FIL* fp, void* buff, UINT btr, UINT* br)
 {
 	long int res;
-	file = fp;
+	select_file(fp);
+	fakeTransferCount++;
 	res = read(fileDescriptor, buff, btr);
 		
 	if (res != -1)
@@ -78,11 +162,13 @@ FRESULT f_read (FIL* fp, void* buff, UINT btr, UINT* br)
 FRESULT f_write (FIL* fp, const void* buff, UINT btw, UINT* bw)
 {
 	ssize_t res;
-	file = fp;
+	select_file(fp);
+	fakeTransferCount++;
 	res = write(fileDescriptor, buff, btw);
 	
 	if (res != -1)
 	{
+		fp->flag |= FA_MODIFIED;
 		*bw = (UINT)res;
 		return FR_OK;
 	}
@@ -92,7 +178,40 @@ FRESULT f_write (FIL* fp, const void* buff, UINT btw, UINT* bw)
 FRESULT f_lseek (FIL* fp, FSIZE_t ofs)
 {
 	off_t res;
-	file = fp;
+	select_file(fp);
+	fakeLseekCount++;
+	
+#if _USE_FASTSEEK
+	if (fp->cltbl)
+	{
+		// Files are always contiguous on the fake file system (one fragment)
+		DWORD ulen = (f_size(fp) != 0) ? 4 : 2;
+		
+		if (ofs == CREATE_LINKMAP)
+		{
+			if (fp->cltbl[0] < ulen)
+			{
+				fp->cltbl[0] = ulen;
+				return FR_NOT_ENOUGH_CORE;
+			}
+			fp->cltbl[0] = ulen;
+			fp->cltbl[1] = 0;
+			if (ulen == 4)
+			{
+				fp->cltbl[1] = (f_size(fp) + FAKE_CLUSTER - 1) / FAKE_CLUSTER;
+				fp->cltbl[2] = fp->obj.sclust;
+				fp->cltbl[3] = 0;
+			}
+			return FR_OK;
+		}
+		
+		// Fast seek mode can't expand the file
+		if (ofs > f_size(fp))
+		{
+			ofs = f_size(fp);
+		}
+	}
+#endif
 	
 	res = lseek(fileDescriptor, (off_t)ofs, SEEK_SET);
 	
@@ -110,7 +229,14 @@ FRESULT f_lseek (FIL* fp, FSIZE_t ofs)
 
 FRESULT f_sync (FIL* fp)
 {
-	file = fp;
+	select_file(fp);
+	
+	// Like FatFs, the timestamp of the file is only updated if it was modified
+	if (fp->flag & FA_MODIFIED)
+	{
+		futimens(fileDescriptor, NULL);
+		fp->flag &= (BYTE)~FA_MODIFIED;
+	}
 	sync();
 	return FR_OK;
 }
@@ -131,9 +257,31 @@ FRESULT f_stat (const TCHAR* path, FILINFO* fno)
 {
 	struct stat statbuf;
 	int res;
-	(void)(fno);
 	res = stat(path, &statbuf);
 	if (res == 0)
+	{
+		if (fno != NULL)
+		{
+			struct tm* tm = localtime(&statbuf.st_mtime);
+			fno->fsize = (FSIZE_t)statbuf.st_size;
+			fno->fdate = (WORD)(((tm->tm_year - 80) << 9) | ((tm->tm_mon + 1) << 5) | tm->tm_mday);
+			fno->ftime = (WORD)((tm->tm_hour << 11) | (tm->tm_min << 5) | (tm->tm_sec / 2));
+		}
+		return FR_OK;
+	}
+	return FR_NO_FILE;
+}
+
+FRESULT f_rename (const TCHAR* path_old, const TCHAR* path_new)
+{
+	struct stat statbuf;
+	
+	// Like FatFs, an existing file isn't replaced
+	if (stat(path_new, &statbuf) == 0)
+	{
+		return FR_EXIST;
+	}
+	if (rename(path_old, path_new) == 0)
 	{
 		return FR_OK;
 	}
@@ -145,7 +293,7 @@ UINT f_size(FIL* fp)
 	off_t current;
 	off_t new;
 	off_t size;
-	file = fp;
+	select_file(fp);
 	current = lseek(fileDescriptor, 0, SEEK_CUR);
 	if (current == -1)
 	{
@@ -167,17 +315,57 @@ UINT f_size(FIL* fp)
 	return (UINT)size;
 }
 
+FRESULT f_utime (const TCHAR* path, const FILINFO* fno)
+{
+	struct tm tm;
+	struct timeval times[2];
+	
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_year = (fno->fdate >> 9) + 80;
+	tm.tm_mon = ((fno->fdate >> 5) & 15) - 1;
+	tm.tm_mday = fno->fdate & 31;
+	tm.tm_hour = fno->ftime >> 11;
+	tm.tm_min = (fno->ftime >> 5) & 63;
+	tm.tm_sec = (fno->ftime & 31) * 2;
+	tm.tm_isdst = -1;
+	times[0].tv_sec = mktime(&tm);
+	times[0].tv_usec = 0;
+	times[1] = times[0];
+	
+	if (utimes(path, times) == 0)
+	{
+		return FR_OK;
+	}
+	return FR_NO_FILE;
+}
+
 FRESULT f_expand (FIL* fp, FSIZE_t fsz, BYTE opt)
 {
-	file = fp;
+	FRESULT res;
+	select_file(fp);
 	foo = opt;
+	fakeExpandStart = fs->last_clst;
+	if (opt == 0)
+	{
+		// Only looks for a contiguous area: the file isn't changed
+		return FR_OK;
+	}
+#if _USE_FASTSEEK
+	// f_expand doesn't depend on fast seek mode
+	DWORD* cltbl = fp->cltbl;
+	fp->cltbl = 0;
+#endif
 	f_lseek(file, fsz);
-	return f_truncate(file);
+	res = f_truncate(file);
+#if _USE_FASTSEEK
+	fp->cltbl = cltbl;
+#endif
+	return res;
 }
 
 FRESULT f_truncate (FIL* fp)
 {
-	file = fp;
+	select_file(fp);
 	off_t size = (off_t)(f_tell(file));
 	
 	if (ftruncate(fileDescriptor, size) == 0)
@@ -189,7 +377,7 @@ FRESULT f_truncate (FIL* fp)
 
 int f_error(FIL* fp)
 {
-	file = fp;
+	select_file(fp);
 	return 0;
 } 
 
@@ -197,7 +385,7 @@ int f_error(FIL* fp)
 FSIZE_t f_tell(FIL* fp)
 {
 	off_t res;
-	file = fp;
+	select_file(fp);
 	res = lseek(fileDescriptor, 0, SEEK_CUR);
 	return (FSIZE_t)res;
 }
@@ -219,3 +407,42 @@ FRESULT f_getfree (const TCHAR* path, DWORD* nclst, FATFS** fatfs)
 	return FR_OK;
 	
 }
+
+FRESULT f_forward (FIL* fp, UINT(*func)(const BYTE*,UINT), UINT btf, UINT* bf)
+{
+	BYTE sector[_MAX_SS];
+	ssize_t res;
+	UINT rcnt;
+	UINT sent;
+	select_file(fp);
+	fakeTransferCount++;
+	*bf = 0;
+	
+	while ((btf > 0) && (*func)(0, 0))
+	{
+		// Give data one sector at a time, like FatFs
+		rcnt = _MAX_SS - (UINT)(f_tell(fp) % _MAX_SS);
+		if (rcnt > btf)
+		{
+			rcnt = btf;
+		}
+		res = read(fileDescriptor, sector, rcnt);
+		if (res == -1)
+		{
+			return FR_INT_ERR;
+		}
+		if (res == 0)
+		{
+			break;
+		}
+		sent = (*func)(sector, (UINT)res);
+		if (sent == 0)
+		{
+			return FR_INT_ERR;
+		}
+		lseek(fileDescriptor, (off_t)sent - res, SEEK_CUR);
+		*bf += sent;
+		btf -= sent;
+	}
+	return FR_OK;
+}
@@ -6,6 +6,14 @@
 extern "C"
 {
     #include "io.h"
+    #include "io_pool.h"
+    #include "io_ring.h"
+    #include "io_log.h"
+    #include "io_rec.h"
+    #include "io_tlv.h"
+    #include "io_ts.h"
+    #include "io_col.h"
+    #include "io_mux.h"
     #include "fatfs.h"
     #include "ffconf.h"
     #include <stdio.h>
@@ -13,6 +21,7 @@ extern "C"
     #include <sys/stat.h>
     #include <unistd.h>
     #include <string.h>
+    #include <stdlib.h>
 	#include <fcntl.h>
 	#include <stdint.h>
 }
@@ -20,6 +29,29 @@ extern "C"
 static void randomString(size_t length, char * str);
 static void deleteTempFile(uint8_t * filename, uint8_t size);
 static off_t getFileSize(uint8_t * filename);
+static UINT forwardSink(const BYTE* data, UINT btf);
+static void* countingDescriptorAlloc(size_t size);
+static void countingDescriptorFree(void* ptr);
+static void* countingBufferAlloc(size_t size);
+static void countingBufferFree(void* ptr);
+static void* failingBufferAlloc(size_t size);
+static int compareRecordKey(const void* record, const void* key);
+
+static char forwardedData[FILE_SIZE];
+static UINT forwardedSize;
+static int descriptorBlocks;
+static int bufferBlocks;
+static size_t bufferBytes;
+
+// Call counters of the FatFs fake (Tests/src/ff.c)
+extern "C" unsigned int fakeLseekCount;
+extern "C" unsigned int fakeTransferCount;
+extern "C" unsigned int fakeTrimCount;
+extern "C" unsigned int fakeTrimSectors;
+extern "C" DWORD fakeExpandStart; // Where f_expand was asked to look for free clusters
+extern "C" const BYTE* fakeFatImage;
+extern "C" FATFS fsvar; // Volume of the FatFs fake
+extern "C" int foo; // Last opt argument of f_expand
 
 TEST_GROUP(TestOpen)
 {
@@ -89,6 +121,197 @@ TEST_GROUP(ChangeFileSize)
     }
 };
 
+TEST_GROUP(Contiguous)
+{
+    void setup()
+    {
+		// Be sure that no file named "testTmpFile" exists
+		uint8_t filename[] = "testTmpFile";
+		deleteTempFile(filename, (uint8_t)strlen((const char*)filename));
+    }
+
+    void teardown()
+    {
+		// Delete "testTmpFile"
+		uint8_t filename[] = "testTmpFile";
+		deleteTempFile(filename, (uint8_t)strlen((const char*)filename));
+    }
+};
+
+TEST_GROUP(Pool)
+{
+    void setup()
+    {
+		// Be sure that no file named "testTmpFile", "testSpare0" or "testSpare1" exists
+		uint8_t filename[] = "testTmpFile";
+		uint8_t spare0[] = "testSpare0";
+		uint8_t spare1[] = "testSpare1";
+		deleteTempFile(filename, sizeof(filename));
+		deleteTempFile(spare0, sizeof(spare0));
+		deleteTempFile(spare1, sizeof(spare1));
+    }
+
+    void teardown()
+    {
+		// Delete "testTmpFile", "testSpare0" and "testSpare1"
+		uint8_t filename[] = "testTmpFile";
+		uint8_t spare0[] = "testSpare0";
+		uint8_t spare1[] = "testSpare1";
+		deleteTempFile(filename, sizeof(filename));
+		deleteTempFile(spare0, sizeof(spare0));
+		deleteTempFile(spare1, sizeof(spare1));
+    }
+};
+
+TEST_GROUP(Ring)
+{
+    void setup()
+    {
+		// Be sure that no file named "testTmpFile" exists
+		uint8_t filename[] = "testTmpFile";
+		deleteTempFile(filename, sizeof(filename));
+    }
+
+    void teardown()
+    {
+		// Delete "testTmpFile"
+		uint8_t filename[] = "testTmpFile";
+		deleteTempFile(filename, sizeof(filename));
+    }
+};
+
+TEST_GROUP(Log)
+{
+    void setup()
+    {
+		// Be sure that no file named "testTmpFile" exists
+		uint8_t filename[] = "testTmpFile";
+		deleteTempFile(filename, sizeof(filename));
+    }
+
+    void teardown()
+    {
+		// Delete "testTmpFile"
+		uint8_t filename[] = "testTmpFile";
+		deleteTempFile(filename, sizeof(filename));
+    }
+};
+
+TEST_GROUP(Records)
+{
+    void setup()
+    {
+		// Be sure that no file named "testTmpFile" exists
+		uint8_t filename[] = "testTmpFile";
+		deleteTempFile(filename, sizeof(filename));
+    }
+
+    void teardown()
+    {
+		// Delete "testTmpFile"
+		uint8_t filename[] = "testTmpFile";
+		deleteTempFile(filename, sizeof(filename));
+    }
+};
+
+TEST_GROUP(Tlv)
+{
+    void setup()
+    {
+		// Be sure that no file named "testTmpFile" exists
+		uint8_t filename[] = "testTmpFile";
+		deleteTempFile(filename, sizeof(filename));
+    }
+
+    void teardown()
+    {
+		// Delete "testTmpFile"
+		uint8_t filename[] = "testTmpFile";
+		deleteTempFile(filename, sizeof(filename));
+    }
+};
+
+TEST_GROUP(TimeLog)
+{
+    void setup()
+    {
+		// Be sure that no file named "testTmpFile" or "testIndexFile" exists
+		uint8_t filename[] = "testTmpFile";
+		uint8_t indexname[] = "testIndexFile";
+		deleteTempFile(filename, sizeof(filename));
+		deleteTempFile(indexname, sizeof(indexname));
+    }
+
+    void teardown()
+    {
+		// Delete "testTmpFile" and "testIndexFile"
+		uint8_t filename[] = "testTmpFile";
+		uint8_t indexname[] = "testIndexFile";
+		deleteTempFile(filename, sizeof(filename));
+		deleteTempFile(indexname, sizeof(indexname));
+    }
+};
+
+TEST_GROUP(Columns)
+{
+    void setup()
+    {
+		// Be sure that no file named "testTmpFile" or "testIndexFile" exists
+		uint8_t filename[] = "testTmpFile";
+		uint8_t indexname[] = "testIndexFile";
+		deleteTempFile(filename, sizeof(filename));
+		deleteTempFile(indexname, sizeof(indexname));
+    }
+
+    void teardown()
+    {
+		// Delete "testTmpFile" and "testIndexFile"
+		uint8_t filename[] = "testTmpFile";
+		uint8_t indexname[] = "testIndexFile";
+		deleteTempFile(filename, sizeof(filename));
+		deleteTempFile(indexname, sizeof(indexname));
+    }
+};
+
+TEST_GROUP(Mux)
+{
+    void setup()
+    {
+		// Be sure that no file named "testTmpFile" exists
+		uint8_t filename[] = "testTmpFile";
+		deleteTempFile(filename, sizeof(filename));
+    }
+
+    void teardown()
+    {
+		// Delete "testTmpFile"
+		uint8_t filename[] = "testTmpFile";
+		deleteTempFile(filename, sizeof(filename));
+    }
+};
+
+TEST_GROUP(Memory)
+{
+    void setup()
+    {
+		// Be sure that no file named "testTmpFile" exists
+		uint8_t filename[] = "testTmpFile";
+		deleteTempFile(filename, (uint8_t)strlen((const char*)filename));
+		descriptorBlocks = 0;
+		bufferBlocks = 0;
+		bufferBytes = 0;
+    }
+
+    void teardown()
+    {
+		// Restore default allocator and budget, and delete "testTmpFile"
+		uint8_t filename[] = "testTmpFile";
+		io_set_allocator(NULL);
+		io_set_memory_budget(IO_MEMORY_BUDGET);
+		deleteTempFile(filename, (uint8_t)strlen((const char*)filename));
+    }
+};
+
 /**
  * Test: TestOpen CreateFile
  * Test case: io_open successfully creates a file
@@ -182,6 +405,118 @@ TEST(TestOpen, CheckSectorSize)
     io_close(io_file);
 }
 
+/**
+ * Test: TestOpen OpenWithOptions
+ * Test case: io_open_ex chooses the buffer size of each file, and gives the preallocation hint to FatFs
+ * Preconditions: no file named "testTmpFile" exists
+ * Test steps: 
+ *  - Initialize data structures
+ *  - Call io_open_ex with a buffer of 4 sectors and a preallocation hint
+ *  - Write and read data
+ *  - Call io_close to close the file
+ *  - Call io_open_ex with a buffer of 3 sectors
+ *  - Delete the file
+ * Expected result:
+ *  - the buffer must be 4 sectors long
+ *  - f_expand must be called with opt 0, and the file must stay empty
+ *  - io_read must return the data previously written
+ *  - io_open_ex must fail with a buffer size that isn't a power of two
+ */
+TEST(TestOpen, OpenWithOptions)
+{
+	IO_FileDescriptor* io_file;
+	const char filename[] = "testTmpFile";
+	IO_OpenOptions options;
+	char data_write[FILE_SIZE];
+	UINT bytesrw;
+	FRESULT res;
+	void * buffer;
+	
+	memset(&options, 0, sizeof(options));
+	options.windowSectors = 4;
+	options.writeBack = IO_WRITE_BACK;
+	options.preallocHint = 1024;
+	
+	foo = -1;
+	io_file = io_open_ex(filename, FA_READ | FA_WRITE, &options);
+	CHECK(io_file != NULL);
+	CHECK_EQUAL(4 * FAKE_SSIZE, io_file->ssize);
+	CHECK_EQUAL(0, foo);
+	CHECK_EQUAL(0, getFileSize((uint8_t*)filename));
+	
+	randomString(FILE_SIZE, data_write);
+	res = io_write(io_file, data_write, 1, 5, &bytesrw);
+	CHECK_EQUAL(FR_OK, res);
+	CHECK_EQUAL(4 * FAKE_SSIZE, io_file->bufferSize);
+	buffer = io_read(io_file, 1, 5, &bytesrw);
+	CHECK(buffer != NULL);
+	MEMCMP_EQUAL(data_write, buffer, 5);
+	
+	res = io_close(io_file);
+	CHECK_EQUAL(FR_OK, res);
+	
+	options.windowSectors = 3;
+	io_file = io_open_ex(filename, FA_READ | FA_WRITE, &options);
+	CHECK(io_file == NULL);
+	CHECK(remove(filename) == 0);
+}
+
+/**
+ * Test: TestOpen OpenWithClusterWindows
+ * Test case: io_open_ex aligns and sizes windows to whole clusters
+ * Preconditions: io_read and io_close must work
+ * Test steps: 
+ *  - Initialize data structures
+ *  - Create a file with random data in it
+ *  - Call io_open_ex with a buffer of 1 sector and cluster windows
+ *  - Call io_read on the second sector
+ *  - Call io_close to close the file
+ *  - Delete the file
+ * Expected result:
+ *  - the window must be one cluster long (2 sectors)
+ *  - the buffer must start at the beginning of the cluster
+ *  - io_read must read the expected data
+ */
+TEST(TestOpen, OpenWithClusterWindows)
+{
+	IO_FileDescriptor* io_file;
+	const char filename[] = "testTmpFile";
+	IO_OpenOptions options;
+	int fd; // File descriptor
+	char data_file[FILE_SIZE];
+	ssize_t bytes;
+	UINT bytesrw;
+	void * buffer;
+	
+	memset(&options, 0, sizeof(options));
+	options.windowSectors = 1;
+	options.writeBack = IO_WRITE_BACK;
+	options.clusterWindows = 1;
+	
+	// Create and fill the file
+	fd = open(filename, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IXUSR);
+	CHECK(fd != -1);
+	randomString(FILE_SIZE, data_file);
+	bytes = write(fd, data_file, FILE_SIZE);
+	CHECK(bytes == FILE_SIZE);
+	close(fd);
+	
+	io_file = io_open_ex(filename, FA_READ, &options);
+	CHECK(io_file != NULL);
+	CHECK_EQUAL(2 * FAKE_SSIZE, io_file->clusterSize);
+	CHECK_EQUAL(io_file->clusterSize, io_file->ssize);
+	
+	buffer = io_read(io_file, FAKE_SSIZE + 1, 4, &bytesrw);
+	CHECK(buffer != NULL);
+	CHECK_EQUAL(4, bytesrw);
+	MEMCMP_EQUAL(data_file + FAKE_SSIZE + 1, buffer, 4);
+	CHECK_EQUAL(0, io_file->bufferBegin);
+	CHECK_EQUAL(io_file->clusterSize, io_file->bufferSize);
+	
+	CHECK_EQUAL(FR_OK, io_close(io_file));
+	CHECK(remove(filename) == 0);
+}
+
 /**
  * Test: TestOpen OpenInvalidFile
  * Test case: io_open fails opening an invalid file
@@ -525,88 +860,298 @@ TEST(TestWrite, WriteRandom)
 	}
 }
 
+#if IO_TINY_CACHE
 /**
- * Test: TestRead ReadTooSmallFile1
- * Test case: io_read tries to read a file, starting after eof
- * Preconditions: io_open and io_close must work (TestOpen)
+ * Test: TestWrite TinyCacheNoFatfsTransfer
+ * Test case: with _FS_TINY, data never goes through f_read/f_write (IO_TINY_CACHE)
+ * Preconditions: io_open, io_read and io_close must work (TestOpen, TestRead)
  * Test steps: 
  *  - Initialize data structures
- *  - Call io_open to open/create a file
- *  - Call io_read with position <= size
+ *  - Call io_open to create a file
+ *  - Call io_write to write random data at random places, growing the file
+ *  - Call io_read to read random parts of the file
  *  - Close the file with io_close
  *  - Delete the file
+ *  - Loop
  * Expected result:
- *  - io_read must return NULL
- *  - io_read must read 0 bytes
+ *  - the file must be opened with a cluster link map table
+ *  - f_read and f_write must never be called
+ *  - io_read must return the data previously written
+ *  - the file must have the correct size and contents (after closing it)
  */
-TEST(TestRead, ReadTooSmallFile1)
+TEST(TestWrite, TinyCacheNoFatfsTransfer)
 {
 	IO_FileDescriptor* io_file;
 	const char filename[] = "testTmpFile";
 	int fd; // File descriptor
+	FRESULT res;
 	
-	char data_file[FILE_SIZE];
 	ssize_t bytes;
+	char data_file[FILE_SIZE];
+	char data_write[FILE_SIZE];
+	char data_read[FILE_SIZE];
+	UINT fileSize;
 	UINT bytesrw;
-	void * buffer;
-	UINT file_size;
 	UINT position;
-
-	for (file_size = 0; file_size <= FILE_SIZE; file_size++)
+	UINT length;
+	UINT loop;
+	UINT step;
+	void * buffer;
+	
+	for (loop = 0; loop < 50; loop++)
 	{
-		for (position = file_size; position <= FILE_SIZE+1; position++)
+		io_file = io_open(filename, FA_READ | FA_WRITE);
+		CHECK(io_file != NULL);
+		CHECK(io_file->linkMap != NULL);
+		fakeTransferCount = 0;
+		fileSize = 0;
+		
+		for (step = 0; step < 20; step++)
 		{
-			// Create and fill the file
-			fd = open(filename, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IXUSR);
-			CHECK(fd != -1);
-			randomString(file_size, data_file);
-			bytes = write(fd, data_file, file_size);
-			CHECK(bytes == file_size);
-			close(fd);
-			
-			// Open the file
-			io_file = io_open(filename, FA_WRITE | FA_READ);
-			CHECK(io_file != NULL);
-			
-			// Read
-			buffer = io_read(io_file, position, 1, &bytesrw);
-			CHECK(buffer == NULL);
-			CHECK(bytesrw == 0);
+			// Write after the end of the file, or overwrite existing data (unaligned)
+			position = rand() % (fileSize + 1);
+			if (position == FILE_SIZE)
+			{
+				position = rand() % FILE_SIZE;
+			}
+			length = 1 + rand() % (FILE_SIZE - position);
+			randomString(length, data_write);
+			res = io_write(io_file, data_write, position, length, &bytesrw);
+			CHECK(res == FR_OK);
+			CHECK_EQUAL(length, bytesrw);
+			memcpy(data_file + position, data_write, length);
+			if (position + length > fileSize)
+			{
+				fileSize = position + length;
+			}
 			
-			// Close the file
-			io_close(io_file);
-			CHECK(remove(filename) == 0);
+			position = rand() % fileSize;
+			length = 1 + rand() % (fileSize - position);
+			if (length > io_file->ssize)
+			{
+				length = io_file->ssize;
+			}
+			buffer = io_read(io_file, position, length, &bytesrw);
+			CHECK(buffer != NULL);
+			CHECK_EQUAL(length, bytesrw);
+			MEMCMP_EQUAL(data_file + position, buffer, length);
 		}
+		CHECK_EQUAL(0, fakeTransferCount);
+		io_close(io_file);
+		
+		// Check file size and contents
+		CHECK_EQUAL(getFileSize((uint8_t*)filename), fileSize);
+		fd = open(filename, O_RDONLY);
+		CHECK(fd != -1);
+		bytes = read(fd, data_read, FILE_SIZE);
+		CHECK(bytes == fileSize);
+		close(fd);
+		MEMCMP_EQUAL(data_file, data_read, fileSize);
+		CHECK(remove(filename) == 0);
 	}
 }
+#endif
 
 /**
- * Test: TestRead ReadTooSmallFile2
- * Test case: io_read tries to read a file, starting before eof and ending before or after eof
- * Preconditions: io_open and io_close must work (TestOpen)
+ * Test: TestWrite WriteThrough
+ * Test case: with IO_WRITE_THROUGH, io_write saves data right away
+ * Preconditions: io_open_ex and io_close must work (TestOpen)
  * Test steps: 
  *  - Initialize data structures
- *  - Call io_open to open/create a file
- *  - Call io_read with position + bytesToRead >= size
+ *  - Call io_open_ex with IO_WRITE_THROUGH
+ *  - Call io_write to write some bytes
+ *  - Read the file without closing it
  *  - Close the file with io_close
  *  - Delete the file
- *  - loop
  * Expected result:
- *  - io_read must not return NULL
- *  - io_read must read the expected number of bytes
- *  - io_read must correctly read the end of the file
+ *  - the file must contain the data without calling io_sync
+ *  - the buffer must not hold unsaved data
  */
-TEST(TestRead, ReadTooSmallFile2)
+TEST(TestWrite, WriteThrough)
 {
 	IO_FileDescriptor* io_file;
 	const char filename[] = "testTmpFile";
+	IO_OpenOptions options;
 	int fd; // File descriptor
 	
-	char data_file[FILE_SIZE];
+	char data_write[FILE_SIZE];
+	char data_read[FILE_SIZE];
 	ssize_t bytes;
 	UINT bytesrw;
-	void * buffer;
-	UINT file_size;
+	FRESULT res;
+	
+	memset(&options, 0, sizeof(options));
+	options.writeBack = IO_WRITE_THROUGH;
+	
+	io_file = io_open_ex(filename, FA_READ | FA_WRITE, &options);
+	CHECK(io_file != NULL);
+	CHECK_EQUAL(BUF_MULTIPLIER * FAKE_SSIZE, io_file->ssize);
+	
+	randomString(FILE_SIZE, data_write);
+	res = io_write(io_file, data_write, 0, 5, &bytesrw);
+	CHECK_EQUAL(FR_OK, res);
+	CHECK_EQUAL(0, io_file->unsavedData);
+	
+	fd = open(filename, O_RDONLY);
+	CHECK(fd != -1);
+	bytes = read(fd, data_read, FILE_SIZE);
+	close(fd);
+	CHECK_EQUAL(5, bytes);
+	MEMCMP_EQUAL(data_write, data_read, 5);
+	
+	io_close(io_file);
+	CHECK(remove(filename) == 0);
+}
+
+/**
+ * Test: TestWrite WriteUnits
+ * Test case: with a write unit, sector writes are gathered and flushed as whole aligned units
+ * Preconditions: io_open_ex and io_close must work (TestOpen)
+ * Test steps: 
+ *  - Initialize data structures
+ *  - Call io_open_ex with a write unit of 4 sectors
+ *  - Call io_write on each sector of the first unit
+ *  - Call io_write on the first sector of the second unit
+ *  - Call io_stats
+ *  - Close the file with io_close
+ *  - Delete the file
+ * Expected result:
+ *  - the first unit must stay in the buffer until the second unit is written
+ *  - the first unit must be saved by one whole aligned flush
+ *  - the file must contain the written data
+ */
+TEST(TestWrite, WriteUnits)
+{
+	IO_FileDescriptor* io_file;
+	const char filename[] = "testTmpFile";
+	IO_OpenOptions options;
+	IO_Stats stats;
+	int fd; // File descriptor
+	
+	char data_write[FILE_SIZE + FAKE_SSIZE];
+	char data_read[FILE_SIZE + FAKE_SSIZE];
+	ssize_t bytes;
+	UINT bytesrw;
+	UINT position;
+	
+	memset(&options, 0, sizeof(options));
+	options.windowSectors = 1;
+	options.writeBack = IO_WRITE_BACK;
+	options.writeUnit = 4 * FAKE_SSIZE;
+	
+	io_file = io_open_ex(filename, FA_READ | FA_WRITE, &options);
+	CHECK(io_file != NULL);
+	CHECK_EQUAL(4 * FAKE_SSIZE, io_file->writeUnit);
+	
+	randomString(FILE_SIZE + FAKE_SSIZE, data_write);
+	for (position = 0; position < 4 * FAKE_SSIZE; position += FAKE_SSIZE)
+	{
+		CHECK_EQUAL(FR_OK, io_write(io_file, data_write + position, position, FAKE_SSIZE, &bytesrw));
+		CHECK_EQUAL(FAKE_SSIZE, bytesrw);
+		CHECK_EQUAL(0, io_file->bufferBegin);
+		CHECK_EQUAL(4 * FAKE_SSIZE, io_file->bufferSize);
+		CHECK_EQUAL(1, io_file->unsavedData);
+	}
+	CHECK_EQUAL(FR_OK, io_stats(io_file, &stats));
+	CHECK_EQUAL(0, stats.flushes);
+	
+	CHECK_EQUAL(FR_OK, io_write(io_file, data_write + position, position, FAKE_SSIZE, &bytesrw));
+	CHECK_EQUAL(FR_OK, io_stats(io_file, &stats));
+	CHECK_EQUAL(1, stats.flushes);
+	CHECK_EQUAL(1, stats.unitFlushes);
+	
+	CHECK_EQUAL(FR_OK, io_close(io_file));
+	fd = open(filename, O_RDONLY);
+	CHECK(fd != -1);
+	bytes = read(fd, data_read, FILE_SIZE + FAKE_SSIZE);
+	close(fd);
+	CHECK_EQUAL(5 * FAKE_SSIZE, bytes);
+	MEMCMP_EQUAL(data_write, data_read, 5 * FAKE_SSIZE);
+	CHECK(remove(filename) == 0);
+}
+
+/**
+ * Test: TestRead ReadTooSmallFile1
+ * Test case: io_read tries to read a file, starting after eof
+ * Preconditions: io_open and io_close must work (TestOpen)
+ * Test steps: 
+ *  - Initialize data structures
+ *  - Call io_open to open/create a file
+ *  - Call io_read with position <= size
+ *  - Close the file with io_close
+ *  - Delete the file
+ * Expected result:
+ *  - io_read must return NULL
+ *  - io_read must read 0 bytes
+ */
+TEST(TestRead, ReadTooSmallFile1)
+{
+	IO_FileDescriptor* io_file;
+	const char filename[] = "testTmpFile";
+	int fd; // File descriptor
+	
+	char data_file[FILE_SIZE];
+	ssize_t bytes;
+	UINT bytesrw;
+	void * buffer;
+	UINT file_size;
+	UINT position;
+
+	for (file_size = 0; file_size <= FILE_SIZE; file_size++)
+	{
+		for (position = file_size; position <= FILE_SIZE+1; position++)
+		{
+			// Create and fill the file
+			fd = open(filename, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IXUSR);
+			CHECK(fd != -1);
+			randomString(file_size, data_file);
+			bytes = write(fd, data_file, file_size);
+			CHECK(bytes == file_size);
+			close(fd);
+			
+			// Open the file
+			io_file = io_open(filename, FA_WRITE | FA_READ);
+			CHECK(io_file != NULL);
+			
+			// Read
+			buffer = io_read(io_file, position, 1, &bytesrw);
+			CHECK(buffer == NULL);
+			CHECK(bytesrw == 0);
+			
+			// Close the file
+			io_close(io_file);
+			CHECK(remove(filename) == 0);
+		}
+	}
+}
+
+/**
+ * Test: TestRead ReadTooSmallFile2
+ * Test case: io_read tries to read a file, starting before eof and ending before or after eof
+ * Preconditions: io_open and io_close must work (TestOpen)
+ * Test steps: 
+ *  - Initialize data structures
+ *  - Call io_open to open/create a file
+ *  - Call io_read with position + bytesToRead >= size
+ *  - Close the file with io_close
+ *  - Delete the file
+ *  - loop
+ * Expected result:
+ *  - io_read must not return NULL
+ *  - io_read must read the expected number of bytes
+ *  - io_read must correctly read the end of the file
+ */
+TEST(TestRead, ReadTooSmallFile2)
+{
+	IO_FileDescriptor* io_file;
+	const char filename[] = "testTmpFile";
+	int fd; // File descriptor
+	
+	char data_file[FILE_SIZE];
+	ssize_t bytes;
+	UINT bytesrw;
+	void * buffer;
+	UINT file_size;
 	UINT positionStart;
 	UINT btr; // Bytes to read
 
@@ -653,113 +1198,1979 @@ TEST(TestRead, ReadTooSmallFile2)
 }
 
 /**
- * Test: ChangeFileSize TruncateExpandFile
- * Test case: io_truncate expands a file's size
- * Preconditions:
+ * Test: TestRead SequentialReadAvoidsSeek
+ * Test case: io_read doesn't move FatFs pointer when it is already at the right place
+ * Preconditions: io_open and io_close must work (TestOpen)
  * Test steps: 
  *  - Initialize data structures
- *  - Create a random file with random data in it
- *  - Call io_truncate to expand file size
+ *  - Create a file with random data in it
+ *  - Call io_read on each sector, in order
  *  - Close the file with io_close
  *  - Delete the file
- *  - loop
  * Expected result:
- *  - the file must have the correct size (after closing it)
- *  - io_truncate must return FR_OK
+ *  - io_read must read the expected data
+ *  - every f_lseek call must be avoided
  */
-TEST(ChangeFileSize, TruncateExpandFile)
+TEST(TestRead, SequentialReadAvoidsSeek)
 {
 	IO_FileDescriptor* io_file;
 	const char filename[] = "testTmpFile";
 	int fd; // File descriptor
-	FRESULT res;
 	
-	ssize_t bytes;
 	char data_file[FILE_SIZE];
-	UINT data_length;
-	UINT expansion;
+	ssize_t bytes;
+	UINT bytesrw;
+	void * buffer;
+	UINT position;
+
+	// Create and fill the file
+	fd = open(filename, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IXUSR);
+	CHECK(fd != -1);
+	randomString(FILE_SIZE, data_file);
+	bytes = write(fd, data_file, FILE_SIZE);
+	CHECK(bytes == FILE_SIZE);
+	close(fd);
 	
-	for (data_length = 0; data_length <= FILE_SIZE; data_length++)
+	// Open the file
+	io_file = io_open(filename, FA_READ);
+	CHECK(io_file != NULL);
+	
+	// Read every sector
+	fakeLseekCount = 0;
+	for (position = 0; position < FILE_SIZE; position += io_file->ssize)
 	{
-		for (expansion = 0; expansion < FILE_SIZE - data_length; expansion++)
-		{
-			// Create and fill the file
-			fd = open(filename, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR | S_IXUSR);
-			CHECK(fd != -1);
-			randomString(data_length, data_file);
-			bytes = write(fd, data_file, data_length);
-			CHECK(bytes == data_length);
-			close(fd);
-			
-			// Expand the file
-			io_file = io_open(filename, FA_WRITE | FA_READ);
-			res = io_truncate(io_file, data_length + expansion);
-			CHECK(res == FR_OK);
-			io_close(io_file);
-			
-			// Check file size
-			CHECK_EQUAL(getFileSize((uint8_t*)filename), data_length + expansion);
-			
-			// Close and delete the file
-			close(fd);
-			CHECK(remove(filename) == 0);
-		}
+		buffer = io_read(io_file, position, io_file->ssize, &bytesrw);
+		CHECK(buffer != NULL);
+		CHECK(bytesrw == io_file->ssize);
+		MEMCMP_EQUAL(data_file + position, buffer, bytesrw);
+	}
+	CHECK_EQUAL(0, fakeLseekCount);
+	if (io_file->linkMap == NULL)
+	{
+		// Data was read with f_read
+		CHECK_EQUAL(FILE_SIZE / io_file->ssize, io_file->seeksAvoided);
 	}
+	
+	// Close the file
+	io_close(io_file);
+	CHECK(remove(filename) == 0);
 }
 
 /**
- * Test: ChangeFileSize TruncateReduceFile
- * Test case: io_truncate reduces a file's size
- * Preconditions:
+ * Test: TestRead ForwardFile
+ * Test case: io_forward gives the whole file to the sink, cached data first
+ * Preconditions: io_open, io_write and io_close must work (TestOpen, TestWrite)
  * Test steps: 
  *  - Initialize data structures
- *  - Create a random file with random data in it
- *  - Call io_truncate to reduce file size
+ *  - Create a file with random data in it
+ *  - Modify one sector with io_write, without saving it
+ *  - Forward the whole file to a sink with io_forward
  *  - Close the file with io_close
  *  - Delete the file
- *  - loop
  * Expected result:
- *  - the file must have the correct size (after closing it)
- *  - io_truncate must return FR_OK
+ *  - io_forward must forward FILE_SIZE bytes
+ *  - the sink must receive the file with the unsaved modification
  */
-TEST(ChangeFileSize, TruncateReduceFile)
+TEST(TestRead, ForwardFile)
 {
 	IO_FileDescriptor* io_file;
 	const char filename[] = "testTmpFile";
 	int fd; // File descriptor
-	FRESULT res;
 	
+	char data_file[FILE_SIZE];
+	char data_write[FAKE_SSIZE];
 	ssize_t bytes;
+	UINT bytesrw;
+	FRESULT res;
+
+	// Create and fill the file
+	fd = open(filename, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IXUSR);
+	CHECK(fd != -1);
+	randomString(FILE_SIZE, data_file);
+	bytes = write(fd, data_file, FILE_SIZE);
+	CHECK(bytes == FILE_SIZE);
+	close(fd);
+	
+	// Open the file
+	io_file = io_open(filename, FA_READ | FA_WRITE);
+	CHECK(io_file != NULL);
+	
+	// Modify the second sector, data stays in the buffer
+	randomString(FAKE_SSIZE, data_write);
+	res = io_write(io_file, data_write, FAKE_SSIZE, FAKE_SSIZE, &bytesrw);
+	CHECK_EQUAL(FR_OK, res);
+	memcpy(data_file + FAKE_SSIZE, data_write, FAKE_SSIZE);
+	
+	// Forward the whole file, asking for more than its size
+	forwardedSize = 0;
+	res = io_forward(io_file, 0, FILE_SIZE * 2, forwardSink, &bytesrw);
+	CHECK_EQUAL(FR_OK, res);
+	CHECK_EQUAL(FILE_SIZE, bytesrw);
+	CHECK_EQUAL(FILE_SIZE, forwardedSize);
+	MEMCMP_EQUAL(data_file, forwardedData, FILE_SIZE);
+	
+	// Close the file
+	io_close(io_file);
+	CHECK(remove(filename) == 0);
+}
+
+/**
+ * Test: TestRead BufferAlignment
+ * Test case: the buffer is aligned for DMA transfers
+ * Preconditions: io_open and io_close must work (TestOpen)
+ * Test steps: 
+ *  - Initialize data structures
+ *  - Create a file with random data in it
+ *  - Call io_read on each sector, in order
+ *  - Close the file with io_close
+ *  - Delete the file
+ * Expected result:
+ *  - io_read must read the expected data
+ *  - the buffer must be aligned on IO_BUFFER_ALIGN bytes
+ */
+TEST(TestRead, BufferAlignment)
+{
+	IO_FileDescriptor* io_file;
+	const char filename[] = "testTmpFile";
+	int fd; // File descriptor
+	
 	char data_file[FILE_SIZE];
-	UINT data_length;
-	UINT reduce;
+	ssize_t bytes;
+	UINT bytesrw;
+	void * buffer;
+	UINT position;
+
+	// Create and fill the file
+	fd = open(filename, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IXUSR);
+	CHECK(fd != -1);
+	randomString(FILE_SIZE, data_file);
+	bytes = write(fd, data_file, FILE_SIZE);
+	CHECK(bytes == FILE_SIZE);
+	close(fd);
 	
-	for (data_length = 0; data_length <= FILE_SIZE; data_length++)
+	// Open the file
+	io_file = io_open(filename, FA_READ);
+	CHECK(io_file != NULL);
+	
+	// Read every sector, a new buffer is allocated each time
+	for (position = 0; position < FILE_SIZE; position += io_file->ssize)
 	{
-		for (reduce = 0; reduce <= data_length; reduce++)
-		{
-			// Create and fill the file
-			fd = open(filename, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR | S_IXUSR);
-			CHECK(fd != -1);
-			randomString(data_length, data_file);
-			bytes = write(fd, data_file, data_length);
-			CHECK(bytes == data_length);
-			close(fd);
-			
-			// Reduce the file size
-			io_file = io_open(filename, FA_WRITE | FA_READ);
-			res = io_truncate(io_file, data_length - reduce);
-			CHECK(res == FR_OK);
-			io_close(io_file);
-			
-			// Check file size
-			CHECK_EQUAL(getFileSize((uint8_t*)filename), data_length - reduce);
-			
-			// Close and delete the file
-			close(fd);
-			CHECK(remove(filename) == 0);
-		}
+		buffer = io_read(io_file, position, io_file->ssize, &bytesrw);
+		CHECK(buffer != NULL);
+		CHECK(buffer == io_file->buffer);
+		CHECK_EQUAL(0, (uintptr_t)buffer & (IO_BUFFER_ALIGN - 1));
+		MEMCMP_EQUAL(data_file + position, buffer, bytesrw);
 	}
+	
+	// Close the file
+	io_close(io_file);
+	CHECK(remove(filename) == 0);
+}
+
+/**
+ * Test: TestRead ReadAhead
+ * Test case: io_read reads windows in advance when a file opened with read-ahead is read sequentially
+ * Preconditions: io_open_ex and io_close must work (TestOpen)
+ * Test steps: 
+ *  - Initialize data structures
+ *  - Create a file with random data in it
+ *  - Call io_open_ex with 2 windows of read-ahead
+ *  - Call io_read on each sector, in order
+ *  - Close the file with io_close
+ *  - Delete the file
+ * Expected result:
+ *  - io_read must read the expected data
+ *  - the buffer must hold 3 windows, so only 2 buffers are read for 4 windows
+ */
+TEST(TestRead, ReadAhead)
+{
+	IO_FileDescriptor* io_file;
+	const char filename[] = "testTmpFile";
+	IO_OpenOptions options;
+	int fd; // File descriptor
+	
+	char data_file[FILE_SIZE];
+	ssize_t bytes;
+	UINT bytesrw;
+	void * buffer;
+	UINT position;
+	UINT buffers = 0;
+	uint8_t* previous = NULL;
+
+	memset(&options, 0, sizeof(options));
+	options.windowSectors = 1;
+	options.readAhead = 2;
+	options.writeBack = IO_WRITE_BACK;
+
+	// Create and fill the file
+	fd = open(filename, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IXUSR);
+	CHECK(fd != -1);
+	randomString(FILE_SIZE, data_file);
+	bytes = write(fd, data_file, FILE_SIZE);
+	CHECK(bytes == FILE_SIZE);
+	close(fd);
+	
+	// Open the file
+	io_file = io_open_ex(filename, FA_READ, &options);
+	CHECK(io_file != NULL);
+	
+	// Read every sector
+	for (position = 0; position < FILE_SIZE; position += io_file->ssize)
+	{
+		buffer = io_read(io_file, position, io_file->ssize, &bytesrw);
+		CHECK(buffer != NULL);
+		CHECK(bytesrw == io_file->ssize);
+		MEMCMP_EQUAL(data_file + position, buffer, bytesrw);
+		if (io_file->buffer != previous)
+		{
+			buffers++;
+			previous = io_file->buffer;
+		}
+		if (position == 0)
+		{
+			CHECK_EQUAL(3 * io_file->ssize, io_file->bufferSize);
+		}
+	}
+	CHECK_EQUAL(2, buffers);
+	
+	// Close the file
+	io_close(io_file);
+	CHECK(remove(filename) == 0);
+}
+
+/**
+ * Test: TestRead AutoTuneWindow
+ * Test case: auto-tuning grows the window when reading sequentially, and shrinks it for random small reads
+ * Preconditions: io_open_ex and io_close must work (TestOpen)
+ * Test steps: 
+ *  - Initialize data structures
+ *  - Create a big file with random data in it
+ *  - Call io_open_ex with auto-tuning
+ *  - Call io_read on each sector of the first quarter of the file, in order
+ *  - Call io_stats
+ *  - Call io_read to read single bytes at random positions
+ *  - Call io_stats
+ *  - Close the file with io_close
+ *  - Delete the file
+ * Expected result:
+ *  - io_read must read the expected data
+ *  - the window must grow while reading sequentially, and shrink while reading randomly
+ *  - io_stats must report every request
+ */
+TEST(TestRead, AutoTuneWindow)
+{
+	IO_FileDescriptor* io_file;
+	const char filename[] = "testTmpFile";
+	IO_OpenOptions options;
+	IO_Stats stats;
+	int fd; // File descriptor
+	const UINT size = FILE_SIZE * 64;
+	
+	char data_file[FILE_SIZE * 64];
+	ssize_t bytes;
+	UINT bytesrw;
+	void * buffer;
+	UINT position;
+	UINT step;
+	UINT window;
+	FRESULT res;
+
+	memset(&options, 0, sizeof(options));
+	options.windowSectors = 1;
+	options.writeBack = IO_WRITE_BACK;
+	options.autoTune = 1;
+
+	// Create and fill the file
+	fd = open(filename, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IXUSR);
+	CHECK(fd != -1);
+	randomString(size, data_file);
+	bytes = write(fd, data_file, size);
+	CHECK(bytes == (ssize_t)size);
+	close(fd);
+	
+	io_file = io_open_ex(filename, FA_READ, &options);
+	CHECK(io_file != NULL);
+	CHECK_EQUAL(FAKE_SSIZE, io_file->ssize);
+	
+	// Sequential reading of the first quarter of the file
+	for (position = 0; position < size / 4; position += FAKE_SSIZE)
+	{
+		buffer = io_read(io_file, position, FAKE_SSIZE, &bytesrw);
+		CHECK(buffer != NULL);
+		CHECK_EQUAL(FAKE_SSIZE, bytesrw);
+		MEMCMP_EQUAL(data_file + position, buffer, bytesrw);
+	}
+	res = io_stats(io_file, &stats);
+	CHECK_EQUAL(FR_OK, res);
+	CHECK_EQUAL(size / 4 / FAKE_SSIZE, stats.requests);
+	CHECK_EQUAL(size / 4 / FAKE_SSIZE, stats.sequential);
+	CHECK_EQUAL(100, stats.sequentialPercent);
+	CHECK(stats.grows >= 2);
+	CHECK(stats.windowSize > FAKE_SSIZE);
+	window = stats.targetWindowSize;
+	
+	// Random reading
+	for (step = 0; step < 8 * IO_AUTOTUNE_PERIOD; step++)
+	{
+		position = ((UINT)rand() % (size / 2)) * 2 + 1;
+		buffer = io_read(io_file, position, 1, &bytesrw);
+		CHECK(buffer != NULL);
+		MEMCMP_EQUAL(data_file + position, buffer, 1);
+	}
+	res = io_stats(io_file, &stats);
+	CHECK_EQUAL(FR_OK, res);
+	CHECK(stats.shrinks >= 1);
+	CHECK(stats.targetWindowSize < window);
+	
+	// Close the file
+	io_close(io_file);
+	CHECK(remove(filename) == 0);
+}
+
+/**
+ * Test: TestRead AdviseHints
+ * Test case: io_advise hints change what the buffer holds, and how it's filled
+ * Preconditions: io_open_ex, io_read, io_write and io_close must work (TestOpen, TestWrite)
+ * Test steps: 
+ *  - Initialize data structures
+ *  - Create a file with random data in it
+ *  - Call io_advise with an unknown hint
+ *  - Call io_advise with IO_ADVICE_WILLNEED on the third sector, then io_read on it
+ *  - Call io_advise with IO_ADVICE_DONTNEED on the first sector, then on the whole file
+ *  - Call io_advise with IO_ADVICE_SEQUENTIAL, then io_read on the first sector
+ *  - Call io_advise with IO_ADVICE_RANDOM, then io_read on the first sector
+ *  - Call io_advise with IO_ADVICE_NOREUSE, then io_write
+ *  - Close the file with io_close
+ *  - Delete the file
+ * Expected result:
+ *  - an unknown hint must return FR_INVALID_PARAMETER
+ *  - the prefetched buffer must hold the third sector, and be used by io_read
+ *  - the buffer must only be freed when the range holds its data
+ *  - 2 windows must be read with IO_ADVICE_SEQUENTIAL, 1 with IO_ADVICE_RANDOM
+ *  - data written with IO_ADVICE_NOREUSE must be saved right away
+ */
+TEST(TestRead, AdviseHints)
+{
+	IO_FileDescriptor* io_file;
+	const char filename[] = "testTmpFile";
+	IO_OpenOptions options;
+	IO_MemoryUsage usage;
+	int fd; // File descriptor
+	
+	char data_file[FILE_SIZE];
+	char data_r[FILE_SIZE];
+	const char data_w[] = "abc";
+	ssize_t bytes;
+	UINT bytesrw;
+	void * buffer;
+	uint8_t* prefetched;
+
+	memset(&options, 0, sizeof(options));
+	options.windowSectors = 1;
+	options.writeBack = IO_WRITE_BACK;
+
+	// Create and fill the file
+	fd = open(filename, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IXUSR);
+	CHECK(fd != -1);
+	randomString(FILE_SIZE, data_file);
+	bytes = write(fd, data_file, FILE_SIZE);
+	CHECK(bytes == FILE_SIZE);
+	close(fd);
+	
+	// Open the file
+	io_file = io_open_ex(filename, FA_READ | FA_WRITE, &options);
+	CHECK(io_file != NULL);
+	CHECK_EQUAL(FR_INVALID_PARAMETER, io_advise(io_file, 0, 0, 42));
+	
+	// Prefetch the third sector
+	CHECK_EQUAL(FR_OK, io_advise(io_file, 2 * FAKE_SSIZE, FAKE_SSIZE, IO_ADVICE_WILLNEED));
+	CHECK(io_file->buffer != NULL);
+	CHECK_EQUAL(2, io_file->bufferBegin);
+	CHECK(io_file->actualSize >= FAKE_SSIZE);
+	MEMCMP_EQUAL(data_file + 2 * FAKE_SSIZE, io_file->buffer, FAKE_SSIZE);
+	CHECK_EQUAL(0, io_file->rwPointer);
+	prefetched = io_file->buffer;
+	buffer = io_read(io_file, 2 * FAKE_SSIZE, FAKE_SSIZE, &bytesrw);
+	CHECK(buffer == prefetched);
+	CHECK_EQUAL(FAKE_SSIZE, bytesrw);
+	
+	// Drop it
+	CHECK_EQUAL(FR_OK, io_advise(io_file, 0, FAKE_SSIZE, IO_ADVICE_DONTNEED));
+	CHECK(io_file->buffer != NULL);
+	CHECK_EQUAL(FR_OK, io_advise(io_file, 0, 0, IO_ADVICE_DONTNEED));
+	CHECK(io_file->buffer == NULL);
+	
+	// Sequential reading reads one more window
+	CHECK_EQUAL(FR_OK, io_advise(io_file, 0, 0, IO_ADVICE_SEQUENTIAL));
+	CHECK_EQUAL(FR_OK, io_lseek(io_file, 0));
+	buffer = io_read(io_file, 0, FAKE_SSIZE, &bytesrw);
+	CHECK(buffer != NULL);
+	MEMCMP_EQUAL(data_file, buffer, FAKE_SSIZE);
+	CHECK_EQUAL(2 * io_file->ssize, io_file->bufferSize);
+	
+	// Random reading only reads the window
+	CHECK_EQUAL(FR_OK, io_advise(io_file, 0, 0, IO_ADVICE_RANDOM));
+	CHECK_EQUAL(FR_OK, io_advise(io_file, 0, 0, IO_ADVICE_DONTNEED));
+	CHECK_EQUAL(FR_OK, io_lseek(io_file, 0));
+	buffer = io_read(io_file, 0, FAKE_SSIZE, &bytesrw);
+	CHECK(buffer != NULL);
+	CHECK_EQUAL(io_file->ssize, io_file->bufferSize);
+	
+	// Data used once isn't kept dirty
+	CHECK_EQUAL(FR_OK, io_advise(io_file, 0, 0, IO_ADVICE_NOREUSE));
+	CHECK_EQUAL(FR_OK, io_write(io_file, data_w, 1, sizeof(data_w) - 1, &bytesrw));
+	CHECK_EQUAL(0, io_file->unsavedData);
+	io_memory_usage(&usage);
+	CHECK_EQUAL(0, usage.dirtyBuffers);
+	memcpy(data_file + 1, data_w, sizeof(data_w) - 1);
+	
+	// Close the file
+	io_close(io_file);
+	fd = open(filename, O_RDONLY);
+	CHECK(fd != -1);
+	bytes = read(fd, data_r, FILE_SIZE);
+	CHECK(bytes == FILE_SIZE);
+	close(fd);
+	MEMCMP_EQUAL(data_file, data_r, FILE_SIZE);
+	CHECK(remove(filename) == 0);
+}
+
+/**
+ * Test: ChangeFileSize TruncateExpandFile
+ * Test case: io_truncate expands a file's size
+ * Preconditions:
+ * Test steps: 
+ *  - Initialize data structures
+ *  - Create a random file with random data in it
+ *  - Call io_truncate to expand file size
+ *  - Close the file with io_close
+ *  - Delete the file
+ *  - loop
+ * Expected result:
+ *  - the file must have the correct size (after closing it)
+ *  - io_truncate must return FR_OK
+ */
+TEST(ChangeFileSize, TruncateExpandFile)
+{
+	IO_FileDescriptor* io_file;
+	const char filename[] = "testTmpFile";
+	int fd; // File descriptor
+	FRESULT res;
+	
+	ssize_t bytes;
+	char data_file[FILE_SIZE];
+	UINT data_length;
+	UINT expansion;
+	
+	for (data_length = 0; data_length <= FILE_SIZE; data_length++)
+	{
+		for (expansion = 0; expansion < FILE_SIZE - data_length; expansion++)
+		{
+			// Create and fill the file
+			fd = open(filename, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR | S_IXUSR);
+			CHECK(fd != -1);
+			randomString(data_length, data_file);
+			bytes = write(fd, data_file, data_length);
+			CHECK(bytes == data_length);
+			close(fd);
+			
+			// Expand the file
+			io_file = io_open(filename, FA_WRITE | FA_READ);
+			res = io_truncate(io_file, data_length + expansion);
+			CHECK(res == FR_OK);
+			io_close(io_file);
+			
+			// Check file size
+			CHECK_EQUAL(getFileSize((uint8_t*)filename), data_length + expansion);
+			
+			// Close and delete the file
+			close(fd);
+			CHECK(remove(filename) == 0);
+		}
+	}
+}
+
+/**
+ * Test: ChangeFileSize DiscardFreedClusters
+ * Test case: with io_set_discard, io_truncate and io_unlink tell the disk which sectors were freed
+ * Preconditions: io_open and io_close must work (TestOpen)
+ * Test steps: 
+ *  - Initialize data structures
+ *  - Call io_set_discard to enable discarding
+ *  - Create a file of 2 clusters
+ *  - Call io_truncate to keep the first cluster
+ *  - Close the file with io_close
+ *  - Call io_unlink to delete the file
+ *  - Call io_set_discard to disable discarding
+ * Expected result:
+ *  - io_truncate must discard the sectors of the second cluster in one request
+ *  - io_unlink must discard the sectors of the first cluster in one request, and delete the file
+ */
+TEST(ChangeFileSize, DiscardFreedClusters)
+{
+	IO_FileDescriptor* io_file;
+	const char filename[] = "testTmpFile";
+	int fd; // File descriptor
+	char data_file[FILE_SIZE];
+	ssize_t bytes;
+	UINT sectors;
+	
+	CHECK_EQUAL(FR_OK, io_set_discard(1));
+	fakeTrimCount = 0;
+	fakeTrimSectors = 0;
+	
+	// Create and fill the file
+	fd = open(filename, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IXUSR);
+	CHECK(fd != -1);
+	randomString(FILE_SIZE, data_file);
+	bytes = write(fd, data_file, FILE_SIZE);
+	CHECK(bytes == FILE_SIZE);
+	close(fd);
+	
+	io_file = io_open(filename, FA_READ | FA_WRITE);
+	CHECK(io_file != NULL);
+	CHECK_EQUAL(FILE_SIZE, 2 * io_file->clusterSize);
+	sectors = io_file->clusterSize / FAKE_SSIZE;
+	
+	CHECK_EQUAL(FR_OK, io_truncate(io_file, io_file->clusterSize - 1));
+	CHECK_EQUAL(1, fakeTrimCount);
+	CHECK_EQUAL(sectors, fakeTrimSectors);
+	CHECK_EQUAL(FR_OK, io_close(io_file));
+	
+	CHECK_EQUAL(FR_OK, io_unlink(filename));
+	CHECK_EQUAL(2, fakeTrimCount);
+	CHECK_EQUAL(2 * sectors, fakeTrimSectors);
+	CHECK(access(filename, F_OK) != 0);
+	
+	CHECK_EQUAL(FR_OK, io_set_discard(IO_DISCARD));
+}
+
+/**
+ * Test: ChangeFileSize TruncateReduceFile
+ * Test case: io_truncate reduces a file's size
+ * Preconditions:
+ * Test steps: 
+ *  - Initialize data structures
+ *  - Create a random file with random data in it
+ *  - Call io_truncate to reduce file size
+ *  - Close the file with io_close
+ *  - Delete the file
+ *  - loop
+ * Expected result:
+ *  - the file must have the correct size (after closing it)
+ *  - io_truncate must return FR_OK
+ */
+TEST(ChangeFileSize, TruncateReduceFile)
+{
+	IO_FileDescriptor* io_file;
+	const char filename[] = "testTmpFile";
+	int fd; // File descriptor
+	FRESULT res;
+	
+	ssize_t bytes;
+	char data_file[FILE_SIZE];
+	UINT data_length;
+	UINT reduce;
+	
+	for (data_length = 0; data_length <= FILE_SIZE; data_length++)
+	{
+		for (reduce = 0; reduce <= data_length; reduce++)
+		{
+			// Create and fill the file
+			fd = open(filename, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR | S_IXUSR);
+			CHECK(fd != -1);
+			randomString(data_length, data_file);
+			bytes = write(fd, data_file, data_length);
+			CHECK(bytes == data_length);
+			close(fd);
+			
+			// Reduce the file size
+			io_file = io_open(filename, FA_WRITE | FA_READ);
+			res = io_truncate(io_file, data_length - reduce);
+			CHECK(res == FR_OK);
+			io_close(io_file);
+			
+			// Check file size
+			CHECK_EQUAL(getFileSize((uint8_t*)filename), data_length - reduce);
+			
+			// Close and delete the file
+			close(fd);
+			CHECK(remove(filename) == 0);
+		}
+	}
+}
+
+/**
+ * Test: ChangeFileSize CachedSizeFollowsTruncate
+ * Test case: file size cached in IO_FileDescriptor stays equal to the size on the disk
+ * Preconditions: io_truncate must work (TruncateExpandFile and TruncateReduceFile)
+ * Test steps: 
+ *  - Initialize data structures
+ *  - Create a random file with random data in it
+ *  - Call io_truncate to change file size
+ *  - Call io_write to write after the end of the file, and io_sync
+ *  - Close the file with io_close
+ *  - Delete the file
+ *  - loop
+ * Expected result:
+ *  - diskFileSize must be equal to the size of the file on the disk
+ *  - allocatedSize must be a multiple of the cluster size, and hold the whole file
+ */
+TEST(ChangeFileSize, CachedSizeFollowsTruncate)
+{
+	IO_FileDescriptor* io_file;
+	const char filename[] = "testTmpFile";
+	int fd; // File descriptor
+	FRESULT res;
+	
+	ssize_t bytes;
+	char data_file[FILE_SIZE];
+	UINT bytesrw;
+	UINT data_length;
+	UINT new_length;
+	
+	for (data_length = 0; data_length <= FILE_SIZE; data_length++)
+	{
+		for (new_length = 0; new_length < FILE_SIZE; new_length++)
+		{
+			// Create and fill the file
+			fd = open(filename, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR | S_IXUSR);
+			CHECK(fd != -1);
+			randomString(data_length, data_file);
+			bytes = write(fd, data_file, data_length);
+			CHECK(bytes == data_length);
+			close(fd);
+			
+			io_file = io_open(filename, FA_WRITE | FA_READ);
+			CHECK(io_file != NULL);
+			CHECK_EQUAL(data_length, io_file->diskFileSize);
+			
+			// Change file size
+			res = io_truncate(io_file, new_length);
+			CHECK(res == FR_OK);
+			CHECK_EQUAL((FSIZE_t)getFileSize((uint8_t*)filename), io_file->diskFileSize);
+			
+			// Append one byte
+			res = io_write(io_file, "a", new_length, 1, &bytesrw);
+			CHECK(res == FR_OK);
+			res = io_sync(io_file);
+			CHECK(res == FR_OK);
+			CHECK_EQUAL(new_length + 1, io_file->diskFileSize);
+			CHECK_EQUAL((FSIZE_t)getFileSize((uint8_t*)filename), io_file->diskFileSize);
+			CHECK(io_file->allocatedSize % io_file->clusterSize == 0);
+			CHECK(io_file->allocatedSize >= io_file->diskFileSize);
+			CHECK(io_file->allocatedSize < io_file->diskFileSize + io_file->clusterSize);
+			
+			io_close(io_file);
+			CHECK(remove(filename) == 0);
+		}
+	}
+}
+
+/**
+ * Test: ChangeFileSize FastSeekExpandFile
+ * Test case: a file opened with IO_FA_FASTSEEK can still be expanded
+ * Preconditions: io_truncate must work (TruncateExpandFile)
+ * Test steps: 
+ *  - Initialize data structures
+ *  - Create a random file with random data in it
+ *  - Call io_open with IO_FA_FASTSEEK flag
+ *  - Call io_truncate to expand file size
+ *  - Call io_write to write after the end of the file
+ *  - Close the file with io_close
+ *  - Delete the file
+ * Expected result:
+ *  - the cluster link map table must be given to FatFs
+ *  - the file must have the correct size and contents (after closing it)
+ */
+TEST(ChangeFileSize, FastSeekExpandFile)
+{
+	IO_FileDescriptor* io_file;
+	const char filename[] = "testTmpFile";
+	int fd; // File descriptor
+	FRESULT res;
+	
+	ssize_t bytes;
+	char data_file[FILE_SIZE];
+	char data_read[FILE_SIZE];
+	UINT bytesrw;
+	
+	// Create and fill the file
+	fd = open(filename, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR | S_IXUSR);
+	CHECK(fd != -1);
+	randomString(FILE_SIZE, data_file);
+	bytes = write(fd, data_file, FILE_SIZE / 2);
+	CHECK(bytes == FILE_SIZE / 2);
+	close(fd);
+	
+	// Open the file in fast seek mode
+	io_file = io_open(filename, FA_WRITE | FA_READ | IO_FA_FASTSEEK);
+	CHECK(io_file != NULL);
+	CHECK(io_file->linkMap != NULL);
+	CHECK(io_file->file->cltbl == io_file->linkMap);
+	
+	// Expand the file, then write after its end
+	res = io_truncate(io_file, FILE_SIZE - 1);
+	CHECK(res == FR_OK);
+	CHECK_EQUAL((FSIZE_t)(FILE_SIZE - 1), io_file->diskFileSize);
+	CHECK(io_file->file->cltbl == io_file->linkMap);
+	res = io_write(io_file, data_file + FILE_SIZE / 2, FILE_SIZE / 2, FILE_SIZE / 2, &bytesrw);
+	CHECK(res == FR_OK);
+	CHECK_EQUAL((UINT)(FILE_SIZE / 2), bytesrw);
+	io_close(io_file);
+	
+	// Check file size and contents
+	CHECK_EQUAL(getFileSize((uint8_t*)filename), FILE_SIZE);
+	fd = open(filename, O_RDONLY);
+	CHECK(fd != -1);
+	bytes = read(fd, data_read, FILE_SIZE);
+	CHECK(bytes == FILE_SIZE);
+	close(fd);
+	MEMCMP_EQUAL(data_file, data_read, FILE_SIZE);
+	
+	CHECK(remove(filename) == 0);
+}
+
+/**
+ * Test: Contiguous WriteDirect
+ * Test case: io_write and io_read work with disk functions on a file created by io_create_contiguous
+ * Preconditions: io_write and io_read must work (TestWrite, TestRead)
+ * Test steps: 
+ *  - Initialize data structures
+ *  - Call io_create_contiguous to create a file
+ *  - Call io_write to write random data at random places (sometimes whole sectors)
+ *  - Call io_read to read random parts of the file
+ *  - Close the file with io_close
+ *  - Delete the file
+ *  - loop
+ * Expected result:
+ *  - the file must be in contiguous mode
+ *  - io_read must return the data previously written
+ *  - the file must have the correct size and contents (after closing it)
+ */
+TEST(Contiguous, WriteDirect)
+{
+	IO_FileDescriptor* io_file;
+	const char filename[] = "testTmpFile";
+	int fd; // File descriptor
+	FRESULT res;
+	
+	ssize_t bytes;
+	char data_file[FILE_SIZE];
+	char data_write[FILE_SIZE];
+	char data_read[FILE_SIZE];
+	UINT bytesrw;
+	UINT position;
+	UINT length;
+	UINT loop;
+	UINT step;
+	void * buffer;
+	
+	for (loop = 0; loop < 50; loop++)
+	{
+		io_file = io_create_contiguous(filename, FA_READ, FILE_SIZE);
+		CHECK(io_file != NULL);
+		CHECK(io_file->directSector != 0);
+		memset(data_file, 0, FILE_SIZE);
+		res = io_write(io_file, data_file, 0, FILE_SIZE, &bytesrw);
+		CHECK(res == FR_OK);
+		
+		for (step = 0; step < 20; step++)
+		{
+			position = rand() % FILE_SIZE;
+			length = 1 + rand() % (FILE_SIZE - position);
+			if (step % 4 == 0)
+			{
+				// Whole sectors
+				position = position & ~(io_file->ssize - 1);
+				length = FILE_SIZE - position;
+			}
+			randomString(length, data_write);
+			res = io_write(io_file, data_write, position, length, &bytesrw);
+			CHECK(res == FR_OK);
+			CHECK_EQUAL(length, bytesrw);
+			memcpy(data_file + position, data_write, length);
+			
+			position = rand() % FILE_SIZE;
+			length = 1 + rand() % (FILE_SIZE - position);
+			if (length > io_file->ssize)
+			{
+				length = io_file->ssize;
+			}
+			buffer = io_read(io_file, position, length, &bytesrw);
+			CHECK(buffer != NULL);
+			CHECK_EQUAL(length, bytesrw);
+			MEMCMP_EQUAL(data_file + position, buffer, length);
+		}
+		CHECK(io_file->directSector != 0);
+		io_close(io_file);
+		
+		// Check file size and contents
+		CHECK_EQUAL(getFileSize((uint8_t*)filename), FILE_SIZE);
+		fd = open(filename, O_RDONLY);
+		CHECK(fd != -1);
+		bytes = read(fd, data_read, FILE_SIZE);
+		CHECK(bytes == FILE_SIZE);
+		close(fd);
+		MEMCMP_EQUAL(data_file, data_read, FILE_SIZE);
+		CHECK(remove(filename) == 0);
+	}
+}
+
+/**
+ * Test: Contiguous OverwriteUpdatesTimestamp
+ * Test case: overwriting a contiguous file with disk functions updates its timestamp when it is closed
+ * Preconditions: io_create_contiguous, io_write and io_close must work (WriteDirect)
+ * Test steps: 
+ *  - Call io_create_contiguous to create a file, write it and close it
+ *  - Set an old timestamp with f_utime
+ *  - Call io_open with IO_FA_CONTIGUOUS flag, overwrite some bytes and close the file
+ *  - Get the timestamp with f_stat
+ *  - Delete the file
+ * Expected result:
+ *  - the file must be written with disk functions, and its timestamp must be updated
+ */
+TEST(Contiguous, OverwriteUpdatesTimestamp)
+{
+	IO_FileDescriptor* io_file;
+	const char filename[] = "testTmpFile";
+	const WORD oldDate = (WORD)((20 << 9) | (1 << 5) | 1); // 2000-01-01
+	char data[FILE_SIZE];
+	FILINFO fno;
+	UINT bytesrw;
+	
+	io_file = io_create_contiguous(filename, FA_READ, FILE_SIZE);
+	CHECK(io_file != NULL);
+	memset(data, 0, FILE_SIZE);
+	CHECK_EQUAL(FR_OK, io_write(io_file, data, 0, FILE_SIZE, &bytesrw));
+	CHECK_EQUAL(FR_OK, io_close(io_file));
+	fno.fdate = oldDate;
+	fno.ftime = 0;
+	CHECK_EQUAL(FR_OK, f_utime(filename, &fno));
+	
+	io_file = io_open(filename, FA_READ | FA_WRITE | IO_FA_CONTIGUOUS);
+	CHECK(io_file != NULL);
+	CHECK(io_file->directSector != 0);
+	randomString(10, data);
+	CHECK_EQUAL(FR_OK, io_write(io_file, data, 5, 10, &bytesrw));
+	CHECK_EQUAL(FR_OK, io_close(io_file));
+	
+	CHECK_EQUAL(FR_OK, f_stat(filename, &fno));
+	CHECK(fno.fdate != oldDate);
+	CHECK(remove(filename) == 0);
+}
+
+/**
+ * Test: Contiguous GrowOutOfContiguousArea
+ * Test case: a file opened with IO_FA_CONTIGUOUS stops using disk functions when it grows
+ * Preconditions: io_write must work (TestWrite)
+ * Test steps: 
+ *  - Initialize data structures
+ *  - Create a random file with random data in it
+ *  - Call io_open with IO_FA_CONTIGUOUS flag
+ *  - Call io_write to write at the end of the file
+ *  - Close the file with io_close
+ *  - Delete the file
+ * Expected result:
+ *  - the file must be in contiguous mode after io_open, and not after the file grew
+ *  - the file must have the correct size and contents (after closing it)
+ */
+TEST(Contiguous, GrowOutOfContiguousArea)
+{
+	IO_FileDescriptor* io_file;
+	const char filename[] = "testTmpFile";
+	int fd; // File descriptor
+	FRESULT res;
+	
+	ssize_t bytes;
+	char data_file[FILE_SIZE];
+	char data_read[FILE_SIZE];
+	UINT bytesrw;
+	
+	// Create and fill the file
+	fd = open(filename, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR | S_IXUSR);
+	CHECK(fd != -1);
+	randomString(FILE_SIZE, data_file);
+	bytes = write(fd, data_file, FILE_SIZE / 2 - 1);
+	CHECK(bytes == FILE_SIZE / 2 - 1);
+	close(fd);
+	
+	io_file = io_open(filename, FA_WRITE | FA_READ | IO_FA_CONTIGUOUS);
+	CHECK(io_file != NULL);
+	CHECK(io_file->directSector != 0);
+	
+	// Write in the contiguous area, then after it
+	res = io_write(io_file, data_file + FILE_SIZE / 2 - 1, FILE_SIZE / 2 - 1, 1, &bytesrw);
+	CHECK(res == FR_OK);
+	res = io_sync(io_file);
+	CHECK(res == FR_OK);
+	CHECK(io_file->directSector != 0);
+	res = io_write(io_file, data_file + FILE_SIZE / 2, FILE_SIZE / 2, FILE_SIZE / 2, &bytesrw);
+	CHECK(res == FR_OK);
+	res = io_sync(io_file);
+	CHECK(res == FR_OK);
+	CHECK(io_file->directSector == 0);
+	io_close(io_file);
+	
+	// Check file size and contents
+	CHECK_EQUAL(getFileSize((uint8_t*)filename), FILE_SIZE);
+	fd = open(filename, O_RDONLY);
+	CHECK(fd != -1);
+	bytes = read(fd, data_read, FILE_SIZE);
+	CHECK(bytes == FILE_SIZE);
+	close(fd);
+	MEMCMP_EQUAL(data_file, data_read, FILE_SIZE);
+	CHECK(remove(filename) == 0);
+}
+
+/**
+ * Test: Contiguous FreeExtentIndex
+ * Test case: the free-extent index finds the best fitting free area, and io_create_contiguous gives it to FatFs
+ * Preconditions: io_create_contiguous, io_close and io_unlink must work
+ * Test steps: 
+ *  - Initialize data structures
+ *  - Give the fake disk a FAT32 with 3 free extents (4, 20 and 8 clusters)
+ *  - Call io_extent_index_build, then io_extent_index_find with several sizes
+ *  - Call io_create_contiguous to create a file of 5 clusters
+ *  - Close the file with io_close, and delete it with io_unlink
+ *  - Change the mount ID of the volume
+ * Expected result:
+ *  - io_extent_index_find must return the smallest extent big enough, FR_DENIED if there is none
+ *  - f_expand must start looking from the extent of 8 clusters
+ *  - FatFs didn't use this extent (the fake doesn't allocate clusters): it must be forgotten
+ *  - clusters of the deleted file must be added to the index
+ *  - the index must not be used after the volume was mounted again
+ */
+TEST(Contiguous, FreeExtentIndex)
+{
+	IO_FileDescriptor* io_file;
+	const char filename[] = "testTmpFile";
+	const FATFS volume = fsvar;
+	BYTE fat[16 * FAKE_SSIZE]; // 64 FAT32 entries
+	DWORD start;
+	DWORD length;
+	DWORD clst;
+	
+	// Every cluster is used, except 10 to 13, 20 to 39 and 50 to 57
+	for (clst = 0; clst < 64; clst++)
+	{
+		DWORD value = (((clst >= 10) && (clst <= 13)) || ((clst >= 20) && (clst <= 39)) || ((clst >= 50) && (clst <= 57))) ? 0 : 0x0FFFFFFF;
+		fat[clst * 4] = (BYTE)value;
+		fat[clst * 4 + 1] = (BYTE)(value >> 8);
+		fat[clst * 4 + 2] = (BYTE)(value >> 16);
+		fat[clst * 4 + 3] = (BYTE)(value >> 24);
+	}
+	fakeFatImage = fat;
+	fsvar.fs_type = FS_FAT32;
+	fsvar.fatbase = 10;
+	fsvar.fsize = 16;
+	fsvar.n_fatent = 64;
+	fsvar.id++;
+	
+	CHECK_EQUAL(FR_NOT_ENABLED, io_extent_index_find(&fsvar, 1, &start, &length));
+	CHECK_EQUAL(FR_OK, io_extent_index_build(&fsvar));
+	CHECK_EQUAL(FR_OK, io_extent_index_find(&fsvar, 6, &start, &length));
+	CHECK_EQUAL(50, start);
+	CHECK_EQUAL(8, length);
+	CHECK_EQUAL(FR_OK, io_extent_index_find(&fsvar, 4, &start, &length));
+	CHECK_EQUAL(10, start);
+	CHECK_EQUAL(FR_OK, io_extent_index_find(&fsvar, 9, &start, &length));
+	CHECK_EQUAL(20, start);
+	CHECK_EQUAL(20, length);
+	CHECK_EQUAL(FR_DENIED, io_extent_index_find(&fsvar, 21, &start, &length));
+	
+	// FatFs is asked to look for 5 clusters from the extent of 8 clusters
+	io_file = io_create_contiguous(filename, FA_READ, 5 * 2 * FAKE_SSIZE);
+	CHECK(io_file != NULL);
+	CHECK_EQUAL(2 * FAKE_SSIZE, io_file->clusterSize);
+	CHECK_EQUAL(50, fakeExpandStart);
+	CHECK_EQUAL(FR_OK, io_extent_index_find(&fsvar, 6, &start, &length));
+	CHECK_EQUAL(20, start);
+	CHECK_EQUAL(FR_OK, io_close(io_file));
+	
+	// The clusters of the file are free again (the fake starts the first open file at cluster 2)
+	CHECK_EQUAL(FR_OK, io_unlink(filename));
+	CHECK_EQUAL(FR_OK, io_extent_index_find(&fsvar, 5, &start, &length));
+	CHECK_EQUAL(2, start);
+	CHECK_EQUAL(5, length);
+	
+	// Mounting the volume again makes the index obsolete
+	fsvar.id++;
+	CHECK_EQUAL(FR_NOT_ENABLED, io_extent_index_find(&fsvar, 1, &start, &length));
+	
+	fakeFatImage = NULL;
+	fsvar = volume;
+	fsvar.id += 2;
+}
+
+/**
+ * Test: Memory CustomAllocator
+ * Test case: IO API allocates memory with the hooks given to io_set_allocator
+ * Preconditions: io_open, io_write, io_read and io_close must work (TestOpen, TestWrite, TestRead)
+ * Test steps: 
+ *  - Initialize data structures
+ *  - Call io_set_allocator with counting hooks
+ *  - Call io_open to create a file, write and read it
+ *  - Close the file with io_close
+ *  - Delete the file
+ * Expected result:
+ *  - descriptors and buffers must be allocated with their own hooks
+ *  - every allocated block must be freed by io_close
+ */
+TEST(Memory, CustomAllocator)
+{
+	IO_FileDescriptor* io_file;
+	const char filename[] = "testTmpFile";
+	IO_Allocator hooks = {countingDescriptorAlloc, countingDescriptorFree, countingBufferAlloc, countingBufferFree};
+	
+	char data_write[FILE_SIZE];
+	UINT bytesrw;
+	FRESULT res;
+	void * buffer;
+
+	io_set_allocator(&hooks);
+	
+	io_file = io_open(filename, FA_READ | FA_WRITE);
+	CHECK(io_file != NULL);
+	CHECK(descriptorBlocks >= 2);
+	CHECK_EQUAL(0, bufferBlocks);
+	
+	randomString(FILE_SIZE, data_write);
+	res = io_write(io_file, data_write, 0, FILE_SIZE, &bytesrw);
+	CHECK_EQUAL(FR_OK, res);
+	buffer = io_read(io_file, 3, 5, &bytesrw);
+	CHECK(buffer != NULL);
+	MEMCMP_EQUAL(data_write + 3, buffer, 5);
+	CHECK_EQUAL(1, bufferBlocks);
+	CHECK(bufferBytes >= io_file->bufferSize);
+	
+	// Close the file
+	res = io_close(io_file);
+	CHECK_EQUAL(FR_OK, res);
+	CHECK_EQUAL(0, descriptorBlocks);
+	CHECK_EQUAL(0, bufferBlocks);
+	CHECK(remove(filename) == 0);
+}
+
+/**
+ * Test: Memory BufferAllocationFails
+ * Test case: IO API reports an error when a buffer can't be allocated
+ * Preconditions: io_open and io_close must work (TestOpen)
+ * Test steps: 
+ *  - Initialize data structures
+ *  - Call io_set_allocator with a buffer hook that always fails
+ *  - Call io_open to create a file, write and read it
+ *  - Close the file with io_close
+ *  - Delete the file
+ * Expected result:
+ *  - io_open must work
+ *  - io_write must return an error, and io_read must return NULL
+ */
+TEST(Memory, BufferAllocationFails)
+{
+	IO_FileDescriptor* io_file;
+	const char filename[] = "testTmpFile";
+	IO_Allocator hooks = {NULL, NULL, failingBufferAlloc, countingBufferFree};
+	
+	char data_write[FILE_SIZE];
+	UINT bytesrw;
+	FRESULT res;
+
+	io_set_allocator(&hooks);
+	
+	io_file = io_open(filename, FA_READ | FA_WRITE);
+	CHECK(io_file != NULL);
+	
+	randomString(FILE_SIZE, data_write);
+	res = io_write(io_file, data_write, 1, 5, &bytesrw);
+	CHECK(res != FR_OK);
+	CHECK_EQUAL(0, bytesrw);
+	CHECK(io_read(io_file, 0, 5, &bytesrw) == NULL);
+	
+	// Close the file
+	res = io_close(io_file);
+	CHECK_EQUAL(FR_OK, res);
+	CHECK(remove(filename) == 0);
+}
+
+/**
+ * Test: Memory BudgetEvictsLeastRecentlyUsed
+ * Test case: buffers of all files stay within the memory budget, least recently used ones are saved and freed
+ * Preconditions: io_open, io_write, io_read and io_close must work (TestOpen, TestWrite, TestRead)
+ * Test steps: 
+ *  - Initialize data structures
+ *  - Set a memory budget of two buffers
+ *  - Call io_open to create three files
+ *  - Write in the first file, read the second one and write in the third one
+ *  - Read the first file again
+ *  - Call io_trim_memory to free every buffer
+ *  - Close the files with io_close
+ *  - Delete the files
+ * Expected result:
+ *  - memory used must never go over the budget
+ *  - the first file must be evicted when writing in the third one, then the second one
+ *  - io_read must return the data previously written
+ *  - io_trim_memory must free every buffer
+ *  - the files must contain the data written
+ */
+TEST(Memory, BudgetEvictsLeastRecentlyUsed)
+{
+	IO_FileDescriptor* io_file[3];
+	const char* filename[3] = {"testTmpFile", "testTmpFile2", "testTmpFile3"};
+	IO_MemoryUsage usage;
+	int fd; // File descriptor
+	
+	char data_write[3][FILE_SIZE];
+	char data_read[FILE_SIZE];
+	ssize_t bytes;
+	UINT bytesrw;
+	FRESULT res;
+	void * buffer;
+	UINT i;
+	const UINT length = FAKE_SSIZE - 1; // Not a whole sector, so data goes through the buffer
+
+	for (i = 0; i < 3; i++)
+	{
+		remove(filename[i]);
+		randomString(FILE_SIZE, data_write[i]);
+	}
+	
+	// The second file already exists
+	fd = open(filename[1], O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IXUSR);
+	CHECK(fd != -1);
+	bytes = write(fd, data_write[1], FILE_SIZE);
+	CHECK(bytes == FILE_SIZE);
+	close(fd);
+	
+	for (i = 0; i < 3; i++)
+	{
+		io_file[i] = io_open(filename[i], FA_READ | FA_WRITE);
+		CHECK(io_file[i] != NULL);
+	}
+	
+	// Budget of two buffers
+	res = io_write(io_file[0], data_write[0], 0, length, &bytesrw);
+	CHECK_EQUAL(FR_OK, res);
+	io_memory_usage(&usage);
+	CHECK_EQUAL(1, usage.buffers);
+	CHECK_EQUAL(1, usage.dirtyBuffers);
+	res = io_set_memory_budget(usage.used * 2);
+	CHECK_EQUAL(FR_OK, res);
+	
+	buffer = io_read(io_file[1], 0, FAKE_SSIZE, &bytesrw);
+	CHECK(buffer != NULL);
+	res = io_write(io_file[2], data_write[2], 0, length, &bytesrw);
+	CHECK_EQUAL(FR_OK, res);
+	
+	// First file was saved and freed
+	io_memory_usage(&usage);
+	CHECK(usage.used <= usage.budget);
+	CHECK_EQUAL(2, usage.buffers);
+	CHECK_EQUAL(1, usage.evictions);
+	CHECK(io_file[0]->buffer == NULL);
+	CHECK_EQUAL(length, getFileSize((uint8_t*)filename[0]));
+	
+	// Reading the first file again evicts the second one
+	buffer = io_read(io_file[0], 0, length, &bytesrw);
+	CHECK(buffer != NULL);
+	MEMCMP_EQUAL(data_write[0], buffer, length);
+	CHECK(io_file[1]->buffer == NULL);
+	CHECK(io_file[2]->buffer != NULL);
+	
+	// Free everything
+	res = io_trim_memory(0);
+	CHECK_EQUAL(FR_OK, res);
+	io_memory_usage(&usage);
+	CHECK_EQUAL(0, usage.used);
+	CHECK_EQUAL(0, usage.buffers);
+	CHECK(usage.peak <= usage.budget);
+	
+	for (i = 0; i < 3; i++)
+	{
+		res = io_close(io_file[i]);
+		CHECK_EQUAL(FR_OK, res);
+	}
+	
+	// Check the contents of the files
+	for (i = 0; i < 3; i++)
+	{
+		fd = open(filename[i], O_RDONLY);
+		CHECK(fd != -1);
+		bytes = read(fd, data_read, FILE_SIZE);
+		close(fd);
+		CHECK(bytes == ((i == 1) ? FILE_SIZE : length));
+		MEMCMP_EQUAL(data_write[i], data_read, bytes);
+		CHECK(remove(filename[i]) == 0);
+	}
+}
+
+/**
+ * Test: Pool AcquireSpareFiles
+ * Test case: Files are created by renaming spare contiguous files
+ * Preconditions: io_create_contiguous, io_open and io_close must work (Contiguous, TestOpen)
+ * Test steps: 
+ *  - Initialize a pool of 2 spare files with io_pool_init, and fill it with io_pool_refill
+ *  - Acquire a file with io_pool_acquire, write and close it
+ *  - Acquire the same file again
+ *  - Acquire a file while the pool is empty
+ *  - Refill one file, and acquire it with a name that can't be used
+ *  - Refill the pool, and initialize it again
+ *  - Delete the files
+ * Expected result:
+ *  - io_pool_refill must create at most maxFiles files, all missing files with 0
+ *  - an acquired file must be opened in contiguous mode, with the size of the pool files, and its spare file must be gone
+ *  - an existing file must be replaced
+ *  - without spare file, the file must be created anyway
+ *  - a spare file that can't be renamed must stay in the pool
+ *  - io_pool_init must find the spare files that already exist
+ */
+TEST(Pool, AcquireSpareFiles)
+{
+	IO_FileDescriptor* io_file;
+	IO_Pool pool;
+	const char filename[] = "testTmpFile";
+	char data_write[FILE_SIZE];
+	char data_read[FILE_SIZE];
+	UINT bytesrw;
+	int fd;
+	
+	CHECK_EQUAL(FR_INVALID_PARAMETER, io_pool_init(&pool, "testSpare", IO_POOL_MAX_FILES + 1, FILE_SIZE));
+	CHECK_EQUAL(FR_OK, io_pool_init(&pool, "testSpare", 2, FILE_SIZE));
+	CHECK_EQUAL(0, io_pool_available(&pool));
+	CHECK_EQUAL(FR_OK, io_pool_refill(&pool, 1));
+	CHECK_EQUAL(1, io_pool_available(&pool));
+	CHECK_EQUAL(FR_OK, io_pool_refill(&pool, 0));
+	CHECK_EQUAL(2, io_pool_available(&pool));
+	CHECK_EQUAL(FILE_SIZE, getFileSize((uint8_t*)"testSpare1"));
+	
+	// The first spare file becomes "testTmpFile"
+	io_file = io_pool_acquire(&pool, filename, FA_READ);
+	CHECK(io_file != NULL);
+	CHECK(io_file->directSector != 0);
+	CHECK_EQUAL(1, io_pool_available(&pool));
+	CHECK(access("testSpare0", F_OK) != 0);
+	CHECK_EQUAL(FILE_SIZE, getFileSize((uint8_t*)filename));
+	randomString(FILE_SIZE, data_write);
+	CHECK_EQUAL(FR_OK, io_write(io_file, data_write, 0, FILE_SIZE, &bytesrw));
+	CHECK_EQUAL(FR_OK, io_close(io_file));
+	fd = open(filename, O_RDONLY);
+	CHECK(fd != -1);
+	CHECK_EQUAL(FILE_SIZE, read(fd, data_read, FILE_SIZE));
+	close(fd);
+	MEMCMP_EQUAL(data_write, data_read, FILE_SIZE);
+	
+	// The second spare file replaces it
+	io_file = io_pool_acquire(&pool, filename, FA_READ);
+	CHECK(io_file != NULL);
+	CHECK_EQUAL(0, io_pool_available(&pool));
+	CHECK(access("testSpare1", F_OK) != 0);
+	CHECK_EQUAL(FR_OK, io_close(io_file));
+	
+	// The pool is empty: the file is created with io_create_contiguous
+	io_file = io_pool_acquire(&pool, filename, FA_READ);
+	CHECK(io_file != NULL);
+	CHECK(io_file->directSector != 0);
+	CHECK_EQUAL(FR_OK, io_close(io_file));
+	CHECK_EQUAL(FILE_SIZE, getFileSize((uint8_t*)filename));
+	
+	// A spare file that can't be renamed stays in the pool
+	CHECK_EQUAL(FR_OK, io_pool_refill(&pool, 1));
+	CHECK_EQUAL(1, io_pool_available(&pool));
+	CHECK(io_pool_acquire(&pool, "noDirectory/testTmpFile", FA_READ) == NULL);
+	CHECK_EQUAL(1, io_pool_available(&pool));
+	CHECK(access("testSpare0", F_OK) == 0);
+	
+	// Spare files survive a reset
+	CHECK_EQUAL(FR_OK, io_pool_refill(&pool, 0));
+	CHECK_EQUAL(FR_OK, io_pool_init(&pool, "testSpare", 2, FILE_SIZE));
+	CHECK_EQUAL(2, io_pool_available(&pool));
+	CHECK_EQUAL(FR_OK, io_pool_init(&pool, "testSpare", 2, 2 * FILE_SIZE));
+	CHECK_EQUAL(0, io_pool_available(&pool));
+}
+
+/**
+ * Test: Ring CircularLog
+ * Test case: A ring file keeps the most recent data
+ * Preconditions: io_create_contiguous, io_write and io_read must work (Contiguous, TestWrite, TestRead)
+ * Test steps: 
+ *  - Create a ring file of 50 bytes with io_ring_create
+ *  - Append 40 bytes, and read them with io_ring_read
+ *  - Append 40 more bytes, rewind and read the ring
+ *  - Close the ring, open it again and read it
+ *  - Overwrite the file with zeroes and open it again
+ * Expected result:
+ *  - the capacity must be rounded up to 4 sectors, and the file must hold one more sector for the header
+ *  - io_ring_read must stop at the newest byte
+ *  - when the ring is full, the oldest sector must be dropped, and data must wrap around the end of the file
+ *  - the ring must be the same after being opened again
+ *  - a file without valid header must be rejected
+ */
+TEST(Ring, CircularLog)
+{
+	IO_Ring ring;
+	const char filename[] = "testTmpFile";
+	char data_write[2][40];
+	char data_read[FILE_SIZE + 1];
+	char zeroes[5 * FAKE_SSIZE];
+	UINT bytesrw;
+	int fd;
+	
+	CHECK_EQUAL(FR_OK, io_ring_create(&ring, filename, 50));
+	CHECK_EQUAL(4 * FAKE_SSIZE, ring.capacity);
+	CHECK_EQUAL(5 * FAKE_SSIZE, getFileSize((uint8_t*)filename));
+	CHECK(ring.fp->directSector != 0);
+	CHECK_EQUAL(FR_INVALID_PARAMETER, io_ring_append(&ring, zeroes, 5 * FAKE_SSIZE));
+	
+	randomString(40, data_write[0]);
+	randomString(40, data_write[1]);
+	CHECK_EQUAL(FR_OK, io_ring_append(&ring, data_write[0], 40));
+	CHECK_EQUAL(FR_OK, io_ring_read(&ring, data_read, FILE_SIZE, &bytesrw));
+	CHECK_EQUAL(40, bytesrw);
+	MEMCMP_EQUAL(data_write[0], data_read, 40);
+	CHECK_EQUAL(FR_OK, io_ring_read(&ring, data_read, FILE_SIZE, &bytesrw));
+	CHECK_EQUAL(0, bytesrw);
+	
+	// 80 bytes don't fit: the first sector is dropped
+	CHECK_EQUAL(FR_OK, io_ring_append(&ring, data_write[1], 40));
+	CHECK_EQUAL(FAKE_SSIZE, ring.head);
+	CHECK_EQUAL(FR_OK, io_ring_rewind(&ring));
+	CHECK_EQUAL(FR_OK, io_ring_read(&ring, data_read, FILE_SIZE + 1, &bytesrw));
+	CHECK_EQUAL(FILE_SIZE, bytesrw);
+	MEMCMP_EQUAL(data_write[0] + FAKE_SSIZE, data_read, 40 - FAKE_SSIZE);
+	MEMCMP_EQUAL(data_write[1], data_read + 40 - FAKE_SSIZE, 40);
+	CHECK_EQUAL(FR_OK, io_ring_close(&ring));
+	
+	memset(data_read, 0, sizeof(data_read));
+	CHECK_EQUAL(FR_OK, io_ring_open(&ring, filename));
+	CHECK_EQUAL(FR_OK, io_ring_read(&ring, data_read, FILE_SIZE, &bytesrw));
+	CHECK_EQUAL(FILE_SIZE, bytesrw);
+	MEMCMP_EQUAL(data_write[0] + FAKE_SSIZE, data_read, 40 - FAKE_SSIZE);
+	MEMCMP_EQUAL(data_write[1], data_read + 40 - FAKE_SSIZE, 40);
+	CHECK_EQUAL(FR_OK, io_ring_close(&ring));
+	
+	// Not a ring file
+	memset(zeroes, 0, sizeof(zeroes));
+	fd = open(filename, O_WRONLY | O_TRUNC);
+	CHECK(fd != -1);
+	CHECK_EQUAL((ssize_t)sizeof(zeroes), write(fd, zeroes, sizeof(zeroes)));
+	close(fd);
+	CHECK_EQUAL(FR_INVALID_OBJECT, io_ring_open(&ring, filename));
+	CHECK(ring.fp == NULL);
+}
+
+/**
+ * Test: Ring PowerLossAfterWrap
+ * Test case: The header of a ring file never covers sectors overwritten by newer data
+ * Preconditions: io_ring_create, io_ring_append and io_ring_read must work (CircularLog)
+ * Test steps: 
+ *  - Create a ring file of 4 sectors with io_ring_create
+ *  - Append 10 bytes, then 4 sectors, and sync the ring
+ *  - Append 10 bytes, save the data with io_sync but not the ring (power loss)
+ *  - Open the file again, and read it
+ * Expected result:
+ *  - when all data is dropped, the oldest byte must start a sector
+ *  - the header must be saved before the first sector is overwritten
+ *  - the ring opened again must give the 3 last sectors written before the power loss
+ */
+TEST(Ring, PowerLossAfterWrap)
+{
+	IO_Ring ring;
+	IO_Ring recovered;
+	const char filename[] = "testTmpFile";
+	char data_write[2][FILE_SIZE];
+	char data_read[FILE_SIZE];
+	UINT bytesrw;
+	
+	CHECK_EQUAL(FR_OK, io_ring_create(&ring, filename, FILE_SIZE));
+	randomString(FILE_SIZE, data_write[0]);
+	randomString(FILE_SIZE, data_write[1]);
+	
+	// 10 bytes and a whole ring: everything is dropped
+	CHECK_EQUAL(FR_OK, io_ring_append(&ring, data_write[1], 10));
+	CHECK_EQUAL(FR_OK, io_ring_append(&ring, data_write[0], FILE_SIZE));
+	CHECK_EQUAL(0, ring.head);
+	CHECK_EQUAL(FILE_SIZE, ring.used);
+	CHECK_EQUAL(FR_OK, io_ring_sync(&ring));
+	
+	// The first sector is dropped and overwritten, data reaches the disk
+	CHECK_EQUAL(FR_OK, io_ring_append(&ring, data_write[1], 10));
+	CHECK_EQUAL(FAKE_SSIZE, ring.head);
+	CHECK_EQUAL(FR_OK, io_sync(ring.fp));
+	
+	CHECK_EQUAL(FR_OK, io_ring_open(&recovered, filename));
+	CHECK_EQUAL(FAKE_SSIZE, recovered.head);
+	CHECK_EQUAL(FR_OK, io_ring_read(&recovered, data_read, FILE_SIZE, &bytesrw));
+	CHECK_EQUAL(FILE_SIZE - FAKE_SSIZE, bytesrw);
+	MEMCMP_EQUAL(data_write[0] + FAKE_SSIZE, data_read, FILE_SIZE - FAKE_SSIZE);
+	CHECK_EQUAL(FR_OK, io_ring_close(&recovered));
+	CHECK_EQUAL(FR_OK, io_ring_close(&ring));
+}
+
+/**
+ * Test: Log RecoverTail
+ * Test case: The end of a log is found with a binary search after a power loss
+ * Preconditions: io_create_contiguous, io_write and io_read must work (Contiguous, TestWrite, TestRead)
+ * Test steps: 
+ *  - Create a log of 64 data sectors with io_log_create
+ *  - Append 100 bytes and commit them, then append 20 bytes
+ *  - Close the file without committing (power loss), and open the log with io_log_open
+ *  - Read the log
+ *  - Create the log again, and copy the data sectors of the old log in the new file
+ * Expected result:
+ *  - io_log_open must check at most log2(64) + 1 sectors (2 io_read calls each), and read the header
+ *  - full sectors and committed data must be recovered, data of the last sector that wasn't committed must be lost
+ *  - appended data must follow recovered data
+ *  - sectors of the old log must be ignored by the new log
+ */
+TEST(Log, RecoverTail)
+{
+	IO_Log log;
+	IO_Stats stats;
+	const char filename[] = "testTmpFile";
+	const UINT payload = FAKE_SSIZE - IO_LOG_SECTOR_HEADER;
+	char data_write[128];
+	char data_read[129];
+	char old_sectors[65 * FAKE_SSIZE];
+	UINT bytesrw;
+	int fd;
+	
+	CHECK_EQUAL(FR_INVALID_PARAMETER, io_log_create(&log, filename, FAKE_SSIZE));
+	CHECK_EQUAL(FR_OK, io_log_create(&log, filename, 65 * FAKE_SSIZE));
+	CHECK_EQUAL(64, log.sectors);
+	CHECK(log.fp->directSector != 0);
+	
+	randomString(128, data_write);
+	CHECK_EQUAL(FR_OK, io_log_append(&log, data_write, 100));
+	CHECK_EQUAL(FR_OK, io_log_commit(&log));
+	CHECK_EQUAL(100 / payload + 1, log.next);
+	CHECK_EQUAL(FR_OK, io_log_append(&log, data_write + 100, 20));
+	CHECK_EQUAL(FR_OK, io_close(log.fp));
+	
+	// 100 committed bytes, and the 2 full sectors of the next 20 bytes
+	CHECK_EQUAL(FR_OK, io_log_open(&log, filename));
+	CHECK_EQUAL(FR_OK, io_stats(log.fp, &stats));
+	CHECK(stats.requests <= 2 * (6 + 1) + 1);
+	CHECK_EQUAL(100 / payload + 3, log.next);
+	CHECK_EQUAL(FR_OK, io_log_read(&log, data_read, sizeof(data_read), &bytesrw));
+	CHECK_EQUAL(100 + 2 * payload, bytesrw);
+	MEMCMP_EQUAL(data_write, data_read, bytesrw);
+	
+	CHECK_EQUAL(FR_OK, io_log_append(&log, data_write, 8));
+	CHECK_EQUAL(FR_OK, io_log_rewind(&log));
+	CHECK_EQUAL(FR_OK, io_log_read(&log, data_read, sizeof(data_read), &bytesrw));
+	CHECK_EQUAL(100 + 2 * payload + 8, bytesrw);
+	MEMCMP_EQUAL(data_write, data_read + 100 + 2 * payload, 8);
+	CHECK_EQUAL(FR_OK, io_log_close(&log));
+	
+	// A new log ignores what the old one left in its sectors
+	fd = open(filename, O_RDONLY);
+	CHECK(fd != -1);
+	CHECK_EQUAL((ssize_t)sizeof(old_sectors), read(fd, old_sectors, sizeof(old_sectors)));
+	close(fd);
+	CHECK_EQUAL(FR_OK, io_log_create(&log, filename, 65 * FAKE_SSIZE));
+	CHECK_EQUAL(FR_OK, io_close(log.fp));
+	fd = open(filename, O_WRONLY);
+	CHECK(fd != -1);
+	CHECK_EQUAL(FAKE_SSIZE, lseek(fd, FAKE_SSIZE, SEEK_SET));
+	CHECK_EQUAL(64 * FAKE_SSIZE, write(fd, old_sectors + FAKE_SSIZE, 64 * FAKE_SSIZE));
+	close(fd);
+	CHECK_EQUAL(FR_OK, io_log_open(&log, filename));
+	CHECK_EQUAL(0, log.next);
+	CHECK_EQUAL(FR_OK, io_log_read(&log, data_read, sizeof(data_read), &bytesrw));
+	CHECK_EQUAL(0, bytesrw);
+	CHECK_EQUAL(FR_OK, io_log_close(&log));
+}
+
+/**
+ * Test: Records PaddedRecords
+ * Test case: Records of 6 bytes are written, read and searched, and don't cross sector boundaries
+ * Preconditions: io_open, io_write and io_read must work (TestOpen, TestWrite, TestRead)
+ * Test steps: 
+ *  - Open a record file with io_rec_open and IO_REC_PADDED
+ *  - Write 10 records sorted by key (first 2 bytes) with io_rec_put
+ *  - Count and read them with io_rec_count and io_rec_get
+ *  - Search keys with io_rec_bsearch
+ *  - Close the file and read it
+ * Expected result:
+ *  - 2 records must be stored per sector of 16 bytes
+ *  - io_rec_bsearch must give the record matching the key, or the first greater one
+ *  - records must be at the expected positions in the file
+ */
+TEST(Records, PaddedRecords)
+{
+	IO_RecordFile rf;
+	const char filename[] = "testTmpFile";
+	uint8_t record[6];
+	uint8_t key[2];
+	uint8_t contents[5 * FAKE_SSIZE];
+	const uint8_t* ptr;
+	UINT count;
+	UINT index;
+	UINT i;
+	int fd;
+	
+	CHECK_EQUAL(FR_INVALID_PARAMETER, io_rec_open(&rf, filename, FA_READ | FA_WRITE | FA_OPEN_ALWAYS, FAKE_SSIZE + 1, IO_REC_PADDED));
+	CHECK_EQUAL(FR_OK, io_rec_open(&rf, filename, FA_READ | FA_WRITE | FA_OPEN_ALWAYS, 6, IO_REC_PADDED));
+	CHECK_EQUAL(2, rf.perSector);
+	
+	// Keys 0, 10, 20... 90
+	for (i = 0; i < 10; i++)
+	{
+		record[0] = (uint8_t)(i * 10);
+		record[1] = 0;
+		randomString(4, (char*)&record[2]);
+		CHECK_EQUAL(FR_OK, io_rec_put(&rf, i, record));
+	}
+	CHECK_EQUAL(FR_OK, io_rec_count(&rf, &count));
+	CHECK_EQUAL(10, count);
+	for (i = 0; i < 10; i++)
+	{
+		ptr = (const uint8_t*)io_rec_get(&rf, i);
+		CHECK(ptr != NULL);
+		CHECK_EQUAL(i * 10, ptr[0]);
+	}
+	CHECK(io_rec_get(&rf, 10) == NULL);
+	
+	key[1] = 0;
+	key[0] = 30;
+	CHECK_EQUAL(FR_OK, io_rec_bsearch(&rf, compareRecordKey, key, &index));
+	CHECK_EQUAL(3, index);
+	key[0] = 35;
+	CHECK_EQUAL(FR_OK, io_rec_bsearch(&rf, compareRecordKey, key, &index));
+	CHECK_EQUAL(4, index);
+	key[0] = 95;
+	CHECK_EQUAL(FR_OK, io_rec_bsearch(&rf, compareRecordKey, key, &index));
+	CHECK_EQUAL(10, index);
+	CHECK_EQUAL(FR_OK, io_rec_close(&rf));
+	
+	// Record 3 is the second record of the second sector, record 9 ends the file
+	fd = open(filename, O_RDONLY);
+	CHECK(fd != -1);
+	CHECK_EQUAL(4 * FAKE_SSIZE + 12, read(fd, contents, sizeof(contents)));
+	close(fd);
+	CHECK_EQUAL(30, contents[FAKE_SSIZE + 6]);
+	CHECK_EQUAL(90, contents[4 * FAKE_SSIZE + 6]);
+}
+
+/**
+ * Test: Records IndexOverflow
+ * Test case: Records whose position doesn't fit in a UINT are rejected instead of wrapping to the beginning of the file
+ * Preconditions: Records PaddedRecords must pass
+ * Test steps: 
+ *  - Write record 0 of a padded file (5 bytes, 3 records per sector of 16 bytes)
+ *  - Write the record ending exactly at 2^32 bytes, then the next one, with io_rec_put
+ *  - Read the record after it with io_rec_get
+ *  - Read record 0
+ * Expected result:
+ *  - the record ending at 2^32 bytes must not be rejected as out of range (writing it fails on the small fake disk)
+ *  - the next record must give FR_INVALID_PARAMETER and io_rec_get must give NULL
+ *  - record 0 must be unchanged
+ */
+TEST(Records, IndexOverflow)
+{
+	IO_RecordFile rf;
+	const char filename[] = "testTmpFile";
+	const uint8_t first[5] = {1, 2, 3, 4, 5};
+	const uint8_t other[5] = {9, 9, 9, 9, 9};
+	const uint8_t* ptr;
+	// (2^32 / 16) sectors of 3 records: the last record of the last sector ends at 2^32 - 1
+	const UINT last = (UINT)((((uint64_t)1 << 32) / FAKE_SSIZE) * 3 - 1);
+
+	CHECK_EQUAL(FR_OK, io_rec_open(&rf, filename, FA_READ | FA_WRITE | FA_OPEN_ALWAYS, 5, IO_REC_PADDED));
+	CHECK_EQUAL(FR_OK, io_rec_put(&rf, 0, first));
+	CHECK(io_rec_put(&rf, last, other) != FR_INVALID_PARAMETER);
+	CHECK_EQUAL(FR_INVALID_PARAMETER, io_rec_put(&rf, last + 1, other));
+	CHECK(io_rec_get(&rf, last + 1) == NULL);
+
+	ptr = (const uint8_t*)io_rec_get(&rf, 0);
+	CHECK(ptr != NULL);
+	MEMCMP_EQUAL(first, ptr, sizeof(first));
+	CHECK_EQUAL(FR_OK, io_rec_close(&rf));
+}
+
+/**
+ * Test: Tlv FramedRecords
+ * Test case: TLV records are written in frames of one sector, and read from any frame
+ * Preconditions: io_open, io_write and io_read must work (TestOpen, TestWrite, TestRead)
+ * Test steps: 
+ *  - Write records of 5, 20, 0 and 9 bytes with io_tlv_write, flush the writer
+ *  - Read the records from the first frame with io_tlv_seek and io_tlv_read
+ *  - Read records from the second frame (only continuation of a record) and from the last frame
+ *  - Prepare a new writer on the file
+ * Expected result:
+ *  - the records must fill 4 frames of 16 bytes, the record of 20 bytes must span 3 frames
+ *  - records must be read in order, with their type and value, then IO_TLV_END
+ *  - reading from a frame must start at the first record starting in it or in the following frames
+ *  - a value bigger than the buffer must be truncated, its length must be given
+ *  - the new writer must start after the last frame
+ */
+TEST(Tlv, FramedRecords)
+{
+	IO_FileDescriptor* io_file;
+	IO_TlvWriter writer;
+	IO_TlvReader reader;
+	const char filename[] = "testTmpFile";
+	const UINT lengths[4] = {5, 20, 0, 9};
+	char values[4][20];
+	char value[20];
+	uint8_t type;
+	UINT length;
+	UINT i;
+	
+	io_file = io_open(filename, FA_READ | FA_WRITE | FA_OPEN_ALWAYS);
+	CHECK(io_file != NULL);
+	CHECK_EQUAL(FR_OK, io_tlv_writer_init(&writer, io_file));
+	CHECK_EQUAL(FR_INVALID_PARAMETER, io_tlv_write(&writer, IO_TLV_END, value, 1));
+	for (i = 0; i < 4; i++)
+	{
+		randomString(20, values[i]);
+		CHECK_EQUAL(FR_OK, io_tlv_write(&writer, (uint8_t)(i + 1), values[i], lengths[i]));
+	}
+	CHECK_EQUAL(FR_OK, io_tlv_flush(&writer));
+	CHECK_EQUAL(4 * FAKE_SSIZE, getFileSize((uint8_t*)filename));
+	
+	CHECK_EQUAL(FR_OK, io_tlv_seek(&reader, io_file, 0));
+	for (i = 0; i < 4; i++)
+	{
+		CHECK_EQUAL(FR_OK, io_tlv_read(&reader, &type, value, sizeof(value), &length));
+		CHECK_EQUAL(i + 1, type);
+		CHECK_EQUAL(lengths[i], length);
+		MEMCMP_EQUAL(values[i], value, length);
+	}
+	CHECK_EQUAL(FR_OK, io_tlv_read(&reader, &type, value, sizeof(value), &length));
+	CHECK_EQUAL(IO_TLV_END, type);
+	
+	// The second frame only holds bytes of the second record: the third one starts in the third frame
+	CHECK_EQUAL(FR_OK, io_tlv_seek(&reader, io_file, 1));
+	CHECK_EQUAL(2, reader.frame);
+	CHECK_EQUAL(FR_OK, io_tlv_read(&reader, &type, value, sizeof(value), &length));
+	CHECK_EQUAL(3, type);
+	CHECK_EQUAL(FR_OK, io_tlv_seek(&reader, io_file, 3));
+	CHECK_EQUAL(FR_OK, io_tlv_read(&reader, &type, value, 4, &length));
+	CHECK_EQUAL(4, type);
+	CHECK_EQUAL(9, length);
+	MEMCMP_EQUAL(values[3], value, 4);
+	CHECK_EQUAL(FR_OK, io_tlv_read(&reader, &type, value, sizeof(value), &length));
+	CHECK_EQUAL(IO_TLV_END, type);
+	
+	CHECK_EQUAL(FR_OK, io_tlv_writer_init(&writer, io_file));
+	CHECK_EQUAL(4, writer.frame);
+	CHECK_EQUAL(FR_OK, io_close(io_file));
+}
+
+/**
+ * Test: TimeLog RangeQuery
+ * Test case: Records of a time range are found with the sparse index
+ * Preconditions: io_rec API must work (Records)
+ * Test steps: 
+ *  - Open a log of records of 8 bytes, with an index entry every 2 sectors (4 records)
+ *  - Append 40 records with timestamps 0, 10, 20... 390
+ *  - Append a record with a lower timestamp
+ *  - Close the log, open it again, and read records from 95 to 130
+ *  - Delete the index file, open the log again and read records from 390 to 1000
+ * Expected result:
+ *  - a record older than the previous one must be refused
+ *  - the index file must hold 10 entries
+ *  - records 100, 110, 120 and 130 must be given, after reading at most 3 records out of the range
+ *  - the index must be built again, the last record must be given
+ */
+TEST(TimeLog, RangeQuery)
+{
+	IO_TimeLog log;
+	IO_Stats stats;
+	const char filename[] = "testTmpFile";
+	const char indexname[] = "testIndexFile";
+	uint8_t record[8];
+	const uint8_t* ptr;
+	uint32_t requests;
+	UINT i;
+	
+	CHECK_EQUAL(FR_INVALID_PARAMETER, io_ts_open(&log, filename, indexname, 3, 2));
+	CHECK_EQUAL(FR_OK, io_ts_open(&log, filename, indexname, 8, 2));
+	memset(record, 0, sizeof(record));
+	for (i = 0; i < 40; i++)
+	{
+		record[0] = (uint8_t)(i * 10);
+		record[1] = (uint8_t)((i * 10) >> 8);
+		record[4] = (uint8_t)i;
+		CHECK_EQUAL(FR_OK, io_ts_append(&log, record));
+	}
+	record[0] = 0;
+	record[1] = 0;
+	CHECK_EQUAL(FR_INVALID_PARAMETER, io_ts_append(&log, record));
+	CHECK_EQUAL(FR_OK, io_ts_close(&log));
+	CHECK_EQUAL(10 * IO_TS_INDEX_ENTRY, getFileSize((uint8_t*)indexname));
+	
+	CHECK_EQUAL(FR_OK, io_ts_open(&log, filename, indexname, 8, 2));
+	CHECK_EQUAL(40, log.count);
+	CHECK_EQUAL(390, log.lastTime);
+	CHECK_EQUAL(FR_OK, io_stats(log.data.fp, &stats));
+	requests = stats.requests;
+	CHECK_EQUAL(FR_OK, io_ts_query(&log, 95, 130));
+	for (i = 10; i <= 13; i++)
+	{
+		ptr = (const uint8_t*)io_ts_next(&log);
+		CHECK(ptr != NULL);
+		CHECK_EQUAL(i, ptr[4]);
+	}
+	CHECK(io_ts_next(&log) == NULL);
+	CHECK_EQUAL(FR_OK, io_stats(log.data.fp, &stats));
+	// The first record of the range is read by io_ts_query and io_ts_next
+	CHECK(stats.requests - requests <= 4 + 3 + 1);
+	CHECK_EQUAL(FR_OK, io_ts_close(&log));
+	
+	// The index is built again from the records
+	CHECK(remove(indexname) == 0);
+	CHECK_EQUAL(FR_OK, io_ts_open(&log, filename, indexname, 8, 2));
+	CHECK_EQUAL(FR_OK, io_ts_query(&log, 390, 1000));
+	ptr = (const uint8_t*)io_ts_next(&log);
+	CHECK(ptr != NULL);
+	CHECK_EQUAL(39, ptr[4]);
+	CHECK(io_ts_next(&log) == NULL);
+	CHECK_EQUAL(FR_OK, io_ts_close(&log));
+	CHECK_EQUAL(10 * IO_TS_INDEX_ENTRY, getFileSize((uint8_t*)indexname));
+}
+
+/**
+ * Test: Columns SelectiveRead
+ * Test case: Samples of a channel are read without reading the other channels
+ * Preconditions: io_open, io_write and io_read must work (TestOpen, TestWrite, TestRead)
+ * Test steps: 
+ *  - Create a columnar file of 3 channels, with samples of 2, 4 and 1 bytes
+ *  - Append 20 rows, and close the writer
+ *  - Open the files with io_col_open, read samples 5 to 15 of channel 0, samples 10 to 25 of channel 2
+ * Expected result:
+ *  - 10 chunks must be written: 5 for channel 1, 3 for channel 0, 2 for channel 2
+ *  - samples must be the appended ones, only the 2 chunks holding them must be read from the data file
+ *  - reading must stop at the last row
+ */
+TEST(Columns, SelectiveRead)
+{
+	IO_ColumnWriter writer;
+	IO_ColumnReader reader;
+	IO_Stats stats;
+	const char filename[] = "testTmpFile";
+	const char dirname[] = "testIndexFile";
+	const uint8_t sizes[3] = {2, 4, 1};
+	uint8_t row[7];
+	uint8_t samples[32];
+	UINT read;
+	UINT i;
+	
+	CHECK_EQUAL(FR_INVALID_PARAMETER, io_col_create(&writer, filename, dirname, IO_COL_MAX_CHANNELS + 1, sizes));
+	CHECK_EQUAL(FR_OK, io_col_create(&writer, filename, dirname, 3, sizes));
+	for (i = 0; i < 20; i++)
+	{
+		// Channel 0: 100 + row, channel 1: 200 + row, channel 2: row
+		memset(row, 0, sizeof(row));
+		row[0] = (uint8_t)(100 + i);
+		row[2] = (uint8_t)(200 + i);
+		row[6] = (uint8_t)i;
+		CHECK_EQUAL(FR_OK, io_col_append(&writer, row));
+	}
+	CHECK_EQUAL(FR_OK, io_col_close(&writer));
+	CHECK_EQUAL(10 * FAKE_SSIZE, getFileSize((uint8_t*)filename));
+	CHECK_EQUAL(IO_COL_HEADER_SIZE + 10 * IO_COL_ENTRY_SIZE, getFileSize((uint8_t*)dirname));
+	
+	CHECK_EQUAL(FR_OK, io_col_open(&reader, filename, dirname));
+	CHECK_EQUAL(3, reader.channels);
+	CHECK_EQUAL(FR_INVALID_PARAMETER, io_col_read(&reader, 3, 0, samples, 1, &read));
+	CHECK_EQUAL(FR_OK, io_col_read(&reader, 0, 5, samples, 11, &read));
+	CHECK_EQUAL(11, read);
+	for (i = 0; i < 11; i++)
+	{
+		CHECK_EQUAL(105 + i, samples[2 * i]);
+	}
+	CHECK_EQUAL(FR_OK, io_stats(reader.data, &stats));
+	CHECK_EQUAL(2, stats.requests);
+	
+	CHECK_EQUAL(FR_OK, io_col_read(&reader, 2, 10, samples, 16, &read));
+	CHECK_EQUAL(10, read);
+	for (i = 0; i < 10; i++)
+	{
+		CHECK_EQUAL(10 + i, samples[i]);
+	}
+	CHECK_EQUAL(FR_OK, io_col_reader_close(&reader));
+}
+
+/**
+ * Test: Mux InterleavedStreams
+ * Test case: Streams written in turn in a contiguous file are read back separately
+ * Preconditions: io_create_contiguous, io_write and io_read must work (TestCreateContiguous, TestWrite, TestRead)
+ * Test steps: 
+ *  - Create a multiplexed file of 64 sectors with 3 streams
+ *  - Write 7, 2 and 5 bytes to streams 0, 1 and 2, 10 times, sync, write 30 bytes to stream 1 and close
+ *  - Open the file, read each stream
+ *  - Append 4 bytes to stream 0, close, open and read stream 0
+ * Expected result:
+ *  - 16 chunks must be written, the file size mustn't change
+ *  - each stream must give the bytes written to it, in order
+ *  - appended bytes must follow the bytes written before
+ */
+TEST(Mux, InterleavedStreams)
+{
+	IO_Mux mux;
+	IO_MuxReader reader;
+	const char filename[] = "testTmpFile";
+	const UINT lengths[3] = {7, 2, 5};
+	UINT written[3] = {0, 0, 0};
+	uint8_t data[80];
+	UINT br;
+	UINT s;
+	UINT i;
+	UINT j;
+	
+	CHECK_EQUAL(FR_INVALID_PARAMETER, io_mux_create(&mux, filename, IO_MUX_MAX_STREAMS + 1, 64 * FAKE_SSIZE));
+	CHECK_EQUAL(FR_OK, io_mux_create(&mux, filename, 3, 64 * FAKE_SSIZE));
+	CHECK_EQUAL(59, mux.capacity);
+	CHECK_EQUAL(FR_INVALID_PARAMETER, io_mux_write(&mux, 3, data, 1));
+	for (i = 0; i < 10; i++)
+	{
+		// Byte n of stream s: 80 * s + n
+		for (s = 0; s < 3; s++)
+		{
+			for (j = 0; j < lengths[s]; j++)
+			{
+				data[j] = (uint8_t)(80 * s + written[s] + j);
+			}
+			CHECK_EQUAL(FR_OK, io_mux_write(&mux, s, data, lengths[s]));
+			written[s] += lengths[s];
+		}
+	}
+	CHECK_EQUAL(FR_OK, io_mux_sync(&mux));
+	CHECK_EQUAL(13, mux.count);
+	for (j = 0; j < 30; j++)
+	{
+		data[j] = (uint8_t)(80 + written[1] + j);
+	}
+	CHECK_EQUAL(FR_OK, io_mux_write(&mux, 1, data, 30));
+	written[1] += 30;
+	CHECK_EQUAL(FR_OK, io_mux_close(&mux));
+	CHECK_EQUAL(64 * FAKE_SSIZE, getFileSize((uint8_t*)filename));
+	
+	CHECK_EQUAL(FR_OK, io_mux_open(&mux, filename));
+	CHECK_EQUAL(16, mux.count);
+	for (s = 0; s < 3; s++)
+	{
+		CHECK_EQUAL(FR_OK, io_mux_reader_init(&reader, &mux, s));
+		CHECK_EQUAL(FR_OK, io_mux_read(&reader, data, sizeof(data), &br));
+		CHECK_EQUAL(written[s], br);
+		for (j = 0; j < br; j++)
+		{
+			CHECK_EQUAL((uint8_t)(80 * s + j), data[j]);
+		}
+	}
+	
+	data[0] = 70;
+	data[1] = 71;
+	data[2] = 72;
+	data[3] = 73;
+	CHECK_EQUAL(FR_OK, io_mux_write(&mux, 0, data, 4));
+	CHECK_EQUAL(FR_OK, io_mux_close(&mux));
+	CHECK_EQUAL(FR_OK, io_mux_open(&mux, filename));
+	CHECK_EQUAL(17, mux.count);
+	CHECK_EQUAL(FR_OK, io_mux_reader_init(&reader, &mux, 0));
+	for (j = 0; j < 74; j += br)
+	{
+		// Read by 9 bytes, across chunks
+		CHECK_EQUAL(FR_OK, io_mux_read(&reader, &data[j], (74 - j < 9) ? 74 - j : 9, &br));
+		CHECK(br != 0);
+	}
+	for (j = 0; j < 74; j++)
+	{
+		CHECK_EQUAL(j, data[j]);
+	}
+	CHECK_EQUAL(FR_OK, io_mux_read(&reader, data, 1, &br));
+	CHECK_EQUAL(0, br);
+	CHECK_EQUAL(FR_OK, io_mux_close(&mux));
+}
+
+/**
+  * @brief Compares the key of a record (16-bit little-endian word) to a key, for io_rec_bsearch
+  * @param record[IN] Record
+  * @param key[IN] Key
+  * @retval Negative value if the record is lower, 0 if it matches, positive value else
+  */
+static int compareRecordKey(const void* record, const void* key)
+{
+	const uint8_t* r = (const uint8_t*)record;
+	const uint8_t* k = (const uint8_t*)key;
+	
+	return (int)(r[0] | (r[1] << 8)) - (int)(k[0] | (k[1] << 8));
+}
+
+/**
+  * @brief Sink function for io_forward, appends data to forwardedData
+  * @param data[IN] Data to send, or 0 to check if the sink is ready
+  * @param btf[IN] Number of bytes to send
+  * @retval Number of bytes received, or 1 if the sink is ready
+  */
+static UINT forwardSink(const BYTE* data, UINT btf)
+{
+	if (btf == 0)
+	{
+		// Ready while there is room left
+		return (forwardedSize < FILE_SIZE) ? 1 : 0;
+	}
+	if (btf > FILE_SIZE - forwardedSize)
+	{
+		btf = FILE_SIZE - forwardedSize;
+	}
+	memcpy(forwardedData + forwardedSize, data, btf);
+	forwardedSize += btf;
+	return btf;
+}
+
+/**
+  * @brief Descriptor allocation hook counting allocated blocks
+  */
+static void* countingDescriptorAlloc(size_t size)
+{
+	descriptorBlocks++;
+	return malloc(size);
+}
+
+/**
+  * @brief Descriptor free hook counting allocated blocks
+  */
+static void countingDescriptorFree(void* ptr)
+{
+	if (ptr != NULL)
+	{
+		descriptorBlocks--;
+	}
+	free(ptr);
+}
+
+/**
+  * @brief Buffer allocation hook counting allocated blocks and bytes
+  */
+static void* countingBufferAlloc(size_t size)
+{
+	bufferBlocks++;
+	bufferBytes += size;
+	return malloc(size);
+}
+
+/**
+  * @brief Buffer free hook counting allocated blocks
+  */
+static void countingBufferFree(void* ptr)
+{
+	if (ptr != NULL)
+	{
+		bufferBlocks--;
+	}
+	free(ptr);
+}
+
+/**
+  * @brief Buffer allocation hook simulating a full memory region
+  */
+static void* failingBufferAlloc(size_t size)
+{
+	(void)size;
+	return NULL;
 }
 
 /**